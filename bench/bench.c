@@ -0,0 +1,307 @@
+// Host microbenchmarks for the ingest and render paths, see `make bench`.
+// Runs on SDL's dummy video driver and prints one key=value line per
+// benchmark so the output of two builds can be diffed.
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "SDL2_inprint.h"
+#include "command.h"
+#include "render.h"
+#include "ringbuffer.h"
+#include "slip.h"
+#include "workload.h"
+
+// Each repetition runs for at least this long
+#define TARGET_REP_NS 20000000ull
+#define DEFAULT_REPS 15
+
+typedef struct {
+    const char *name;
+    void (*run)(uint64_t iterations);
+    // Payload bytes per operation, for throughput, 0 if not meaningful
+    uint32_t bytes_per_op;
+} benchmark_s;
+
+static int reps = DEFAULT_REPS;
+static volatile uint32_t sink;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* SLIP */
+
+static uint8_t slip_buf[1024];
+static uint8_t *stream = NULL;
+static uint32_t stream_size = 0;
+static uint32_t stream_packets = 0;
+
+static int count_message(uint8_t *data, uint32_t size) {
+    sink += size + data[0];
+    return 1;
+}
+
+/* Command packets as the M8 sends them */
+
+static uint8_t rect_packet[12] = {0xFE, 16, 0, 32, 0, 100, 0, 10, 0, 0x20, 0x40, 0x60};
+static uint8_t char_packet[12] = {0xFD, 'A', 64, 0, 48, 0, 0xFF, 0xFF, 0xFF, 0, 0, 0};
+static uint8_t waveform_packet[4 + 320];
+static uint8_t joypad_packet[3] = {0xFB, 0, 0};
+
+static void prepare_packets() {
+    waveform_packet[0] = 0xFC;
+    waveform_packet[1] = 0x00;
+    waveform_packet[2] = 0xC0; // needs escaping in SLIP
+    waveform_packet[3] = 0xFF;
+    for (int i = 0; i < 320; i++) {
+        waveform_packet[4 + i] = (uint8_t) (10 + (i * 7) % 11);
+    }
+
+    // A full screen redraw followed by a second of playback with the scope
+    workload_s w;
+    uint64_t due;
+    stream = malloc(WORKLOAD_MAX_EVENT_BYTES * 2);
+    workload_init(&w, WORKLOAD_RESET, 0, 1);
+    stream_size = workload_next(&w, stream, &due);
+    stream_packets = w.packets;
+
+    workload_init(&w, WORKLOAD_SCOPE, 0, 1);
+    workload_next(&w, stream + stream_size, &due); // its own initial redraw is not wanted
+    w.packets = 0;
+    while (due < 1000000) {
+        uint32_t n = workload_next(&w, stream + stream_size, &due);
+        if (stream_size + n > WORKLOAD_MAX_EVENT_BYTES * 2) {
+            break;
+        }
+        stream_size += n;
+    }
+    stream_packets += w.packets;
+}
+
+static void bench_slip_read_byte(uint64_t iterations) {
+    static const slip_descriptor_s descriptor = {
+            .buf = slip_buf, .buf_size = sizeof(slip_buf), .recv_message = count_message};
+    slip_handler_s slip;
+    slip_init(&slip, &descriptor);
+
+    uint32_t pos = 0;
+    for (uint64_t i = 0; i < iterations; i++) {
+        slip_read_byte(&slip, stream[pos]);
+        if (++pos == stream_size) {
+            pos = 0;
+        }
+    }
+}
+
+static void bench_process_rect(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        rect_packet[1] = (uint8_t) (i & 0xFF);
+        process_command(rect_packet, sizeof(rect_packet));
+    }
+}
+
+static void bench_process_char(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        char_packet[1] = (uint8_t) ('!' + i % 90);
+        char_packet[2] = (uint8_t) ((i % 40) * 8);
+        process_command(char_packet, sizeof(char_packet));
+    }
+}
+
+static void bench_process_waveform(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        waveform_packet[4 + i % 320] ^= 1;
+        process_command(waveform_packet, sizeof(waveform_packet));
+    }
+}
+
+static void bench_process_joypad(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        process_command(joypad_packet, sizeof(joypad_packet));
+    }
+}
+
+/* Rendering */
+
+static SDL_Surface *target = NULL;
+
+static void bench_inprint_char(uint64_t iterations) {
+    char str[2] = {0, 0};
+    for (uint64_t i = 0; i < iterations; i++) {
+        str[0] = (char) ('!' + i % 90);
+        inprint(target, str, (Sint16) ((i % 40) * 8), 100, 0xFFFFFF, 0x000000);
+    }
+}
+
+static void bench_inprint_transparent(uint64_t iterations) {
+    char str[2] = {0, 0};
+    for (uint64_t i = 0; i < iterations; i++) {
+        str[0] = (char) ('!' + i % 90);
+        inprint(target, str, (Sint16) ((i % 40) * 8), 100, 0xFFFFFF, -1);
+    }
+}
+
+static void bench_inprint_line(uint64_t iterations) {
+    static const char line[] = "SONG  00 01 02 03 04 05 06 07 -- --  ";
+    for (uint64_t i = 0; i < iterations; i++) {
+        inprint(target, line, 0, (Sint16) ((i % 20) * 10), 0xFFFFFF, 0x000000);
+    }
+}
+
+static void bench_draw_rectangle(uint64_t iterations) {
+    struct draw_rectangle_command cmd = {{16, 32}, {100, 10}, {0x20, 0x40, 0x60}};
+    for (uint64_t i = 0; i < iterations; i++) {
+        cmd.pos.y = (uint16_t) (20 + i % 200);
+        draw_rectangle(&cmd);
+    }
+}
+
+static void bench_draw_waveform(uint64_t iterations) {
+    struct draw_oscilloscope_waveform_command cmd;
+    cmd.color = (struct color) {0x00, 0xC0, 0xFF};
+    cmd.waveform_size = 320;
+    for (uint64_t i = 0; i < iterations; i++) {
+        for (int x = 0; x < 320; x++) {
+            cmd.waveform[x] = (uint8_t) ((x + i) % 21);
+        }
+        draw_waveform(&cmd);
+    }
+}
+
+static void bench_render_screen(uint64_t iterations) {
+    struct draw_rectangle_command cmd = {{0, 230}, {1, 1}, {0, 0, 0}};
+    for (uint64_t i = 0; i < iterations; i++) {
+        // Smallest possible change, so the cost is the present itself
+        cmd.color.r = (uint8_t) i;
+        draw_rectangle(&cmd);
+        render_screen();
+    }
+}
+
+/* Ring buffers */
+
+static RingBuffer *ring = NULL;
+static LockFreeRingBuffer *lf_ring = NULL;
+static uint8_t chunk[256];
+
+static void bench_ring_buffer(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        ring_buffer_push(ring, chunk, sizeof(chunk));
+        ring_buffer_pop(ring, chunk, sizeof(chunk));
+    }
+}
+
+static void bench_lf_ring_buffer(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        lf_ring_buffer_push(lf_ring, chunk, sizeof(chunk));
+        lf_ring_buffer_pop(lf_ring, chunk, sizeof(chunk));
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_benchmark(const benchmark_s *b) {
+    // Warm up caches and find an iteration count that fills a repetition
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t start = now_ns();
+        b->run(iterations);
+        uint64_t elapsed = now_ns() - start;
+        if (elapsed >= TARGET_REP_NS / 4 || iterations >= (1ull << 30)) {
+            iterations = elapsed > 0 ? iterations * TARGET_REP_NS / elapsed : iterations * 2;
+            break;
+        }
+        iterations *= 2;
+    }
+    if (iterations == 0) {
+        iterations = 1;
+    }
+
+    uint64_t samples[reps];
+    for (int r = 0; r < reps; r++) {
+        uint64_t start = now_ns();
+        b->run(iterations);
+        samples[r] = now_ns() - start;
+    }
+    qsort(samples, reps, sizeof(uint64_t), compare_u64);
+
+    double median = (double) samples[reps / 2] / iterations;
+    double best = (double) samples[0] / iterations;
+    double worst = (double) samples[reps - 1] / iterations;
+
+    printf("bench=%s ns_op=%.2f ns_op_min=%.2f ns_op_max=%.2f ops_s=%.0f", b->name, median,
+           best, worst, median > 0 ? 1e9 / median : 0.0);
+    if (b->bytes_per_op > 0) {
+        printf(" mb_s=%.2f", median > 0 ? b->bytes_per_op * 1e3 / median : 0.0);
+    }
+    printf(" iterations=%llu reps=%d\n", (unsigned long long) iterations, reps);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+            if (reps < 1) {
+                reps = 1;
+            }
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    // No display needed, and nothing should open a window on a dev box
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (initialize_sdl(0, 0) != 1) {
+        fprintf(stderr, "bench: could not initialize SDL\n");
+        return 1;
+    }
+    target = SDL_CreateRGBSurface(0, 320, 240, 32, 0, 0, 0, 0);
+
+    prepare_packets();
+    ring = ring_buffer_create(4096);
+    lf_ring = lf_ring_buffer_create(4096);
+
+    const benchmark_s benchmarks[] = {
+            {"slip_read_byte", bench_slip_read_byte, 1},
+            {"process_command_rect", bench_process_rect, sizeof(rect_packet)},
+            {"process_command_char", bench_process_char, sizeof(char_packet)},
+            {"process_command_waveform", bench_process_waveform, sizeof(waveform_packet)},
+            {"process_command_joypad", bench_process_joypad, sizeof(joypad_packet)},
+            {"inprint_char", bench_inprint_char, 0},
+            {"inprint_char_transparent", bench_inprint_transparent, 0},
+            {"inprint_line", bench_inprint_line, 0},
+            {"draw_rectangle", bench_draw_rectangle, 0},
+            {"draw_waveform", bench_draw_waveform, 0},
+            {"render_screen", bench_render_screen, 0},
+            {"ring_buffer_push_pop", bench_ring_buffer, sizeof(chunk)},
+            {"lf_ring_buffer_push_pop", bench_lf_ring_buffer, sizeof(chunk)},
+    };
+
+    printf("# m8c bench, %d repetitions, median/min/max ns per operation\n", reps);
+    printf("# slip stream: %u bytes, %u packets\n", stream_size, stream_packets);
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        if (filter == NULL || strstr(benchmarks[i].name, filter) != NULL) {
+            run_benchmark(&benchmarks[i]);
+        }
+    }
+
+    ring_buffer_free(ring);
+    lf_ring_buffer_free(lf_ring);
+    free(stream);
+    SDL_FreeSurface(target);
+    close_renderer();
+    SDL_Quit();
+    return 0;
+}
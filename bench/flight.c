@@ -0,0 +1,349 @@
+// Flight recorder decoder: turns the ring file m8c keeps (flight_recorder=)
+// into a session that can be looked at and played back.
+//
+//   m8c-flight --decode RING DIR   write DIR/display.slip, DIR/input.script
+//                                  and DIR/events.txt
+//   m8c-flight --play RING         draw the recorded display traffic at the
+//                                  pace it arrived, on SDL's dummy driver
+//                                  unless SDL_VIDEODRIVER says otherwise
+//
+// display.slip is the raw stream read from the M8. input.script repeats the
+// recorded buttons and notes through m8c's input_script= option.
+
+#include <SDL.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "command.h"
+#include "flight_recorder.h"
+#include "input.h"
+#include "render.h"
+#include "slip.h"
+
+// Display silence this long is worth a line in the timeline
+#define DISPLAY_GAP_US 100000
+
+typedef struct {
+    flight_channel_t channel;
+    uint64_t ts_us;
+    uint32_t seq;
+    uint32_t length;
+    const uint8_t *data;
+} entry_s;
+
+static const char *channel_names[FLIGHT_CHANNELS] = {"display", "out", "audio", "event"};
+
+static const struct {
+    const char *name;
+    uint8_t value;
+} buttons[] = {
+        {"up", key_up},     {"down", key_down},     {"left", key_left}, {"right", key_right},
+        {"select", key_select}, {"start", key_start}, {"opt", key_opt},   {"edit", key_edit},
+};
+
+static uint8_t *file = NULL;
+static long file_size = 0;
+static const flight_header_s *header = NULL;
+
+static entry_s *entries = NULL;
+static uint32_t entry_count = 0;
+static uint32_t entry_capacity = 0;
+
+static int load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "m8c-flight: cannot open %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file = malloc(file_size > 0 ? file_size : 1);
+    if (file == NULL || fread(file, 1, file_size, f) != (size_t) file_size) {
+        fprintf(stderr, "m8c-flight: cannot read %s\n", path);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    header = (const flight_header_s *) file;
+    if (file_size < (long) sizeof(flight_header_s) || header->magic != FLIGHT_MAGIC) {
+        fprintf(stderr, "m8c-flight: %s is not a flight recording\n", path);
+        return 0;
+    }
+    if (header->version != FLIGHT_VERSION) {
+        fprintf(stderr, "m8c-flight: %s is version %u, this reads %u\n", path, header->version,
+                FLIGHT_VERSION);
+        return 0;
+    }
+    return 1;
+}
+
+static void add_entry(const entry_s *e) {
+    if (entry_count == entry_capacity) {
+        entry_capacity = entry_capacity ? entry_capacity * 2 : 4096;
+        entries = realloc(entries, entry_capacity * sizeof(entry_s));
+        if (entries == NULL) {
+            fprintf(stderr, "m8c-flight: out of memory\n");
+            exit(2);
+        }
+    }
+    entries[entry_count++] = *e;
+}
+
+// Adds the records in [from, to) of a ring, stops at the first one that does not fit
+static int walk(int channel, const uint8_t *ring, uint32_t from, uint32_t to) {
+    while (from + sizeof(flight_record_s) <= to) {
+        const flight_record_s *r = (const flight_record_s *) (ring + from);
+        uint32_t size = FLIGHT_RECORD_SIZE(r->length);
+        if (r->length > to - from || from + size > to) {
+            fprintf(stderr, "m8c-flight: %s ring is damaged at %u\n", channel_names[channel],
+                    from);
+            return 0;
+        }
+        entry_s e = {channel, r->ts_us, r->seq, r->length, (const uint8_t *) (r + 1)};
+        add_entry(&e);
+        from += size;
+    }
+    return 1;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const entry_s *x = a, *y = b;
+    if (x->ts_us != y->ts_us) {
+        return x->ts_us < y->ts_us ? -1 : 1;
+    }
+    if (x->channel != y->channel) {
+        return (int) x->channel - (int) y->channel;
+    }
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static void read_rings() {
+    for (int i = 0; i < FLIGHT_CHANNELS; i++) {
+        const flight_channel_s *ch = &header->channels[i];
+        if ((long) ch->offset + ch->size > file_size || ch->head > ch->size ||
+            ch->tail > ch->size || ch->wrap_end > ch->size) {
+            fprintf(stderr, "m8c-flight: %s ring header is damaged\n", channel_names[i]);
+            continue;
+        }
+        const uint8_t *ring = file + ch->offset;
+        uint32_t first = entry_count;
+        if (ch->wrap_end != 0 && walk(i, ring, ch->tail, ch->wrap_end)) {
+            walk(i, ring, 0, ch->head);
+        } else if (ch->wrap_end == 0) {
+            walk(i, ring, ch->tail, ch->head);
+        }
+        fprintf(stderr, "%-8s %7u records, %u dropped\n", channel_names[i], entry_count - first,
+                ch->dropped);
+    }
+    // Stable across channels recorded in the same microsecond
+    qsort(entries, entry_count, sizeof(entry_s), compare_entries);
+}
+
+static double seconds(uint64_t ts_us) {
+    return (double) (int64_t) (ts_us - header->start_us) / 1000000.0;
+}
+
+static FILE *open_out(const char *dir, const char *name, const char *mode) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, mode);
+    if (f == NULL) {
+        fprintf(stderr, "m8c-flight: cannot write %s: %s\n", path, strerror(errno));
+    }
+    return f;
+}
+
+// Outgoing messages as input script commands, batches hold several of them
+static void write_script(FILE *f, const entry_s *e, uint64_t *last_us, uint8_t *keys,
+                         int *last_note) {
+    uint32_t wait_ms = (uint32_t) ((e->ts_us - *last_us) / 1000);
+    int waited = 0;
+
+    for (uint32_t i = 0; i < e->length;) {
+        const uint8_t *m = e->data + i;
+        uint32_t left = e->length - i;
+        if (!waited && (m[0] == 'C' || m[0] == 'K' || m[0] == 'R')) {
+            if (*last_us != 0 && wait_ms > 0) {
+                fprintf(f, "wait %u\n", wait_ms);
+            }
+            *last_us = e->ts_us;
+            waited = 1;
+        }
+        if (m[0] == 'C' && left >= 2) {
+            uint8_t changed = *keys ^ m[1];
+            for (size_t b = 0; b < sizeof(buttons) / sizeof(buttons[0]); b++) {
+                if (changed & buttons[b].value) {
+                    fprintf(f, "%s %s\n", m[1] & buttons[b].value ? "press" : "release",
+                            buttons[b].name);
+                }
+            }
+            *keys = m[1];
+            i += 2;
+        } else if (m[0] == 'K' && left >= 3) {
+            if (m[1] == 0xFF) {
+                if (*last_note >= 0) {
+                    fprintf(f, "noteoff %d\n", *last_note);
+                }
+            } else {
+                fprintf(f, "note %u %u\n", m[1], m[2]);
+                *last_note = m[1];
+            }
+            i += 3;
+        } else if (m[0] == 'R') {
+            fprintf(f, "reset\n");
+            i++;
+        } else if (m[0] == 'E' || m[0] == 'D') {
+            fprintf(f, "# %s\n", m[0] == 'E' ? "enable display" : "disconnect");
+            i++;
+        } else {
+            fprintf(f, "# unknown message 0x%02x, %u bytes left\n", m[0], left);
+            break;
+        }
+    }
+}
+
+static void write_event(FILE *f, const entry_s *e, uint64_t *last_display_us,
+                        flight_audio_sample_s *last_audio) {
+    double t = seconds(e->ts_us);
+    switch (e->channel) {
+        case FLIGHT_DISPLAY:
+            if (*last_display_us != 0 && e->ts_us - *last_display_us >= DISPLAY_GAP_US) {
+                fprintf(f, "%10.6f display   resumed after %.1f ms\n", t,
+                        (e->ts_us - *last_display_us) / 1000.0);
+            }
+            *last_display_us = e->ts_us;
+            break;
+        case FLIGHT_OUT:
+            fprintf(f, "%10.6f out      ", t);
+            for (uint32_t i = 0; i < e->length && i < 16; i++) {
+                fprintf(f, " %02x", e->data[i]);
+            }
+            fprintf(f, e->length > 16 ? " ... (%u bytes)\n" : "\n", e->length);
+            break;
+        case FLIGHT_AUDIO: {
+            if (e->length < sizeof(flight_audio_sample_s)) {
+                break;
+            }
+            flight_audio_sample_s s;
+            memcpy(&s, e->data, sizeof(s));
+            // Only changes worth reading: underruns and fill moving between tenths
+            if (s.underrun || s.fill_percent / 10 != last_audio->fill_percent / 10) {
+                fprintf(f, "%10.6f audio     fill %u%%%s\n", t, s.fill_percent,
+                        s.underrun ? ", underrun" : "");
+            }
+            *last_audio = s;
+            break;
+        }
+        case FLIGHT_EVENT:
+            fprintf(f, "%10.6f event     %.*s\n", t, (int) e->length, (const char *) e->data);
+            break;
+        default:
+            break;
+    }
+}
+
+static int decode(const char *dir) {
+    FILE *display = open_out(dir, "display.slip", "wb");
+    FILE *script = open_out(dir, "input.script", "w");
+    FILE *events = open_out(dir, "events.txt", "w");
+    if (display == NULL || script == NULL || events == NULL) {
+        return 2;
+    }
+
+    time_t start = (time_t) (header->start_unix_us / 1000000);
+    char when[64];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&start));
+    fprintf(events, "# recording started %s, times in seconds from then\n", when);
+    fprintf(script, "# replayed from a flight recording started %s\n", when);
+
+    uint64_t last_display_us = 0, last_script_us = 0;
+    flight_audio_sample_s last_audio = {0, 0};
+    uint8_t keys = 0;
+    int last_note = -1;
+    uint32_t display_bytes = 0;
+
+    for (uint32_t i = 0; i < entry_count; i++) {
+        const entry_s *e = &entries[i];
+        if (e->channel == FLIGHT_DISPLAY) {
+            fwrite(e->data, 1, e->length, display);
+            display_bytes += e->length;
+        } else if (e->channel == FLIGHT_OUT) {
+            write_script(script, e, &last_script_us, &keys, &last_note);
+        }
+        write_event(events, e, &last_display_us, &last_audio);
+    }
+    fclose(display);
+    fclose(script);
+    fclose(events);
+
+    if (entry_count > 0) {
+        printf("%.3f s to %.3f s, %u display bytes, written to %s\n", seconds(entries[0].ts_us),
+               seconds(entries[entry_count - 1].ts_us), display_bytes, dir);
+    }
+    return 0;
+}
+
+static int draw_packet(uint8_t *data, uint32_t size) {
+    return process_command(data, size);
+}
+
+static int play() {
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (initialize_sdl(0, 0) != 1) {
+        fprintf(stderr, "m8c-flight: could not initialize SDL\n");
+        return 2;
+    }
+
+    static uint8_t slip_buffer[1024];
+    static const slip_descriptor_s descriptor = {
+            .buf = slip_buffer, .buf_size = sizeof(slip_buffer), .recv_message = draw_packet};
+    slip_handler_s slip;
+    slip_init(&slip, &descriptor);
+
+    // The recording starts anywhere in the stream, packets before the first
+    // frame end are dropped by the SLIP decoder like after a reconnect
+    uint64_t first_us = 0;
+    uint32_t start_ticks = SDL_GetTicks();
+    int errors = 0;
+    for (uint32_t i = 0; i < entry_count; i++) {
+        const entry_s *e = &entries[i];
+        if (e->channel != FLIGHT_DISPLAY) {
+            continue;
+        }
+        if (first_us == 0) {
+            first_us = e->ts_us;
+        }
+        uint32_t due_ms = (uint32_t) ((e->ts_us - first_us) / 1000);
+        int32_t ahead = (int32_t) (due_ms - (SDL_GetTicks() - start_ticks));
+        if (ahead > 0) {
+            SDL_Delay(ahead);
+        }
+        for (uint32_t b = 0; b < e->length; b++) {
+            if (slip_read_byte(&slip, e->data[b]) != SLIP_NO_ERROR) {
+                errors++;
+            }
+        }
+        render_screen();
+    }
+    printf("played %.3f s, %d SLIP errors\n", (SDL_GetTicks() - start_ticks) / 1000.0, errors);
+    close_renderer();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int decoding = argc == 4 && strcmp(argv[1], "--decode") == 0;
+    if (!decoding && !(argc == 3 && strcmp(argv[1], "--play") == 0)) {
+        fprintf(stderr, "usage: m8c-flight --decode RING DIR | --play RING\n");
+        return 2;
+    }
+    if (!load(argv[2])) {
+        return 2;
+    }
+    read_rings();
+    return decoding ? decode(argv[3]) : play();
+}
@@ -0,0 +1,309 @@
+// Golden frame harness: plays fixed command streams through process_command()
+// and compares the presented screen at checkpoints with stored images.
+//
+//   m8c-golden --record DIR   write the checkpoint images and checksums
+//   m8c-golden --check DIR    compare against them, exit 1 on any difference
+//
+// Built with GOLDEN_BASELINE it links against the renderer of an older commit,
+// see golden-record-base in the Makefile, and only uses what that one had.
+
+#include <SDL.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "command.h"
+#include "render.h"
+#ifndef GOLDEN_BASELINE
+#include "screen_model.h"
+#endif
+#include "slip.h"
+#include "workload.h"
+
+#define MANIFEST "golden.txt"
+#define MAX_CHECKPOINTS 64
+
+/* The cases run one after another on the same canvas, so the state each one
+   leaves behind (font, background colour, scope) is part of the next. */
+typedef struct {
+    const char *name;
+    workload_scenario_t scenario;
+    int events;
+    int checkpoint_every;
+} golden_case_s;
+
+static const golden_case_s cases[] = {
+        {"reset", WORKLOAD_RESET, 2, 1},
+        {"scope", WORKLOAD_SCOPE, 31, 10},
+        {"scroll", WORKLOAD_SCROLL, 41, 10},
+        {"large", WORKLOAD_LARGE, 2, 1},        // system info switches to the large font
+        {"small_after_large", WORKLOAD_RESET, 1, 1}, // and back
+        {"theme", WORKLOAD_THEME, 4, 1},        // each event changes the background colour
+};
+
+typedef struct {
+    char name[64];
+    uint32_t checksum;
+} checkpoint_s;
+
+static checkpoint_s golden[MAX_CHECKPOINTS];
+static int golden_count = 0;
+static int golden_bpp = 0;
+
+static int draw_packet(uint8_t *data, uint32_t size) {
+    return process_command(data, size);
+}
+
+static uint32_t canvas_rgb(SDL_Surface *s, int x, int y) {
+    const uint8_t *p = (const uint8_t *) s->pixels + y * s->pitch + x * s->format->BytesPerPixel;
+    Uint32 pixel;
+    switch (s->format->BytesPerPixel) {
+        case 1:
+            pixel = *p;
+            break;
+        case 2:
+            pixel = *(const Uint16 *) p;
+            break;
+        case 3:
+            pixel = SDL_BYTEORDER == SDL_LIL_ENDIAN ? p[0] | p[1] << 8 | p[2] << 16
+                                                    : p[0] << 16 | p[1] << 8 | p[2];
+            break;
+        default:
+            pixel = *(const Uint32 *) p;
+            break;
+    }
+    Uint8 r, g, b;
+    SDL_GetRGB(pixel, s->format, &r, &g, &b);
+    return (uint32_t) r << 16 | g << 8 | b;
+}
+
+// FNV-1a over the RGB of every pixel, independent of the surface format
+static uint32_t checksum(SDL_Surface *s) {
+    uint32_t hash = 2166136261u;
+    SDL_LockSurface(s);
+    for (int y = 0; y < s->h; y++) {
+        for (int x = 0; x < s->w; x++) {
+            uint32_t rgb = canvas_rgb(s, x, y);
+            for (int i = 0; i < 3; i++) {
+                hash ^= (rgb >> (i * 8)) & 0xFF;
+                hash *= 16777619u;
+            }
+        }
+    }
+    SDL_UnlockSurface(s);
+    return hash;
+}
+
+static int read_manifest(const char *dir) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, MANIFEST);
+    FILE *f = fopen(path, "r");
+    if (f == NULL && errno == ENOENT) {
+        fprintf(stderr, "m8c-golden: no goldens in %s, record them with "
+                        "make golden-record-base first\n", dir);
+        return 0;
+    }
+    if (f == NULL) {
+        fprintf(stderr, "m8c-golden: cannot read %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+    char line[128];
+    while (fgets(line, sizeof(line), f) != NULL && golden_count < MAX_CHECKPOINTS) {
+        if (sscanf(line, "# bpp=%d", &golden_bpp) == 1 || line[0] == '#') {
+            continue;
+        }
+        checkpoint_s *c = &golden[golden_count];
+        if (sscanf(line, "%63s %x", c->name, &c->checksum) == 2) {
+            golden_count++;
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+static const checkpoint_s *find_golden(const char *name) {
+    for (int i = 0; i < golden_count; i++) {
+        if (strcmp(golden[i].name, name) == 0) {
+            return &golden[i];
+        }
+    }
+    return NULL;
+}
+
+/* Loads the stored image and reports every differing pixel: how many, where,
+   and by how much. Writes the actual frame and a diff image next to it. */
+static void report_diff(SDL_Surface *canvas, const char *dir, const char *name) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.bmp", dir, name);
+    SDL_Surface *expected = SDL_LoadBMP(path);
+    if (expected == NULL) {
+        printf("  %s: no image to compare with (%s)\n", name, path);
+        return;
+    }
+    if (expected->w != canvas->w || expected->h != canvas->h) {
+        printf("  %s: image is %dx%d, canvas is %dx%d\n", name, expected->w, expected->h,
+               canvas->w, canvas->h);
+        SDL_FreeSurface(expected);
+        return;
+    }
+
+    SDL_Surface *diff = SDL_CreateRGBSurface(0, canvas->w, canvas->h, 32, 0xFF0000, 0xFF00,
+                                             0xFF, 0);
+    int count = 0, max_delta = 0;
+    int x1 = canvas->w, y1 = canvas->h, x2 = -1, y2 = -1;
+    SDL_LockSurface(canvas);
+    SDL_LockSurface(expected);
+    SDL_LockSurface(diff);
+    for (int y = 0; y < canvas->h; y++) {
+        Uint32 *row = (Uint32 *) ((uint8_t *) diff->pixels + y * diff->pitch);
+        for (int x = 0; x < canvas->w; x++) {
+            uint32_t a = canvas_rgb(canvas, x, y);
+            uint32_t e = canvas_rgb(expected, x, y);
+            if (a == e) {
+                // Unchanged pixels are dimmed so the differences stand out
+                row[x] = (e >> 2) & 0x3F3F3F;
+                continue;
+            }
+            row[x] = 0xFF00FF;
+            if (count++ < 8) {
+                printf("  %s: pixel %d,%d is %06X, expected %06X\n", name, x, y, a, e);
+            }
+            for (int i = 0; i < 3; i++) {
+                int d = abs((int) ((a >> (i * 8)) & 0xFF) - (int) ((e >> (i * 8)) & 0xFF));
+                if (d > max_delta) {
+                    max_delta = d;
+                }
+            }
+            if (x < x1) x1 = x;
+            if (y < y1) y1 = y;
+            if (x > x2) x2 = x;
+            if (y > y2) y2 = y;
+        }
+    }
+    SDL_UnlockSurface(diff);
+    SDL_UnlockSurface(expected);
+    SDL_UnlockSurface(canvas);
+
+    printf("  %s: %d pixels differ in %d,%d-%d,%d, largest channel delta %d\n", name, count,
+           x1, y1, x2, y2, max_delta);
+    snprintf(path, sizeof(path), "%s/%s.actual.bmp", dir, name);
+    SDL_SaveBMP(canvas, path);
+    snprintf(path, sizeof(path), "%s/%s.diff.bmp", dir, name);
+    SDL_SaveBMP(diff, path);
+    SDL_FreeSurface(diff);
+    SDL_FreeSurface(expected);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3 || (strcmp(argv[1], "--record") != 0 && strcmp(argv[1], "--check") != 0)) {
+        fprintf(stderr, "usage: m8c-golden --record|--check DIR\n");
+        return 2;
+    }
+    int record = strcmp(argv[1], "--record") == 0;
+    const char *dir = argv[2];
+
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (initialize_sdl(0, 0) != 1) {
+        fprintf(stderr, "m8c-golden: could not initialize SDL\n");
+        return 2;
+    }
+    // What render_screen() presented, every renderer version has one
+    SDL_Surface *canvas = SDL_GetVideoSurface();
+#ifndef GOLDEN_BASELINE
+    // Proves the retained model against the same frames on the way
+    screen_model_init(1);
+#endif
+
+    if (!record && !read_manifest(dir)) {
+        return 2;
+    }
+    if (!record && golden_bpp != 0 && golden_bpp != canvas->format->BitsPerPixel) {
+        printf("warning: goldens were recorded at %d bpp, canvas is %d bpp\n", golden_bpp,
+               canvas->format->BitsPerPixel);
+    }
+
+    FILE *manifest = NULL;
+    if (record) {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", dir, MANIFEST);
+        manifest = fopen(path, "w");
+        if (manifest == NULL) {
+            fprintf(stderr, "m8c-golden: cannot write %s: %s\n", path, strerror(errno));
+            return 2;
+        }
+        fprintf(manifest, "# bpp=%d\n", canvas->format->BitsPerPixel);
+    }
+
+    static uint8_t slip_buffer[1024];
+    static const slip_descriptor_s descriptor = {
+            .buf = slip_buffer, .buf_size = sizeof(slip_buffer), .recv_message = draw_packet};
+    slip_handler_s slip;
+    slip_init(&slip, &descriptor);
+
+    uint8_t *buf = malloc(WORKLOAD_MAX_EVENT_BYTES);
+    int checked = 0, failed = 0, model_mismatches = 0;
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        workload_s w;
+        workload_init(&w, cases[c].scenario, 0, 1);
+        for (int e = 0; e < cases[c].events; e++) {
+            uint64_t due;
+            uint32_t n = workload_next(&w, buf, &due);
+            for (uint32_t i = 0; i < n; i++) {
+                slip_read_byte(&slip, buf[i]);
+            }
+            render_screen();
+            if (e % cases[c].checkpoint_every != 0) {
+                continue;
+            }
+
+            char name[64];
+            snprintf(name, sizeof(name), "%s_%02d", cases[c].name, e);
+            uint32_t sum = checksum(canvas);
+#ifndef GOLDEN_BASELINE
+            if (screen_model_verify(render_canvas()) > 0) {
+                printf("  %s: screen model repaint differs from the canvas\n", name);
+                model_mismatches++;
+            }
+#endif
+
+            if (record) {
+                char path[512];
+                snprintf(path, sizeof(path), "%s/%s.bmp", dir, name);
+                if (SDL_SaveBMP(canvas, path) != 0) {
+                    fprintf(stderr, "m8c-golden: cannot write %s\n", path);
+                    return 2;
+                }
+                fprintf(manifest, "%s %08x\n", name, sum);
+                printf("golden=%s checksum=%08x recorded\n", name, sum);
+                continue;
+            }
+
+            const checkpoint_s *expected = find_golden(name);
+            checked++;
+            if (expected == NULL) {
+                printf("golden=%s checksum=%08x missing\n", name, sum);
+                failed++;
+            } else if (expected->checksum != sum) {
+                printf("golden=%s checksum=%08x expected=%08x FAIL\n", name, sum,
+                       expected->checksum);
+                report_diff(canvas, dir, name);
+                failed++;
+            } else {
+                printf("golden=%s checksum=%08x ok\n", name, sum);
+            }
+        }
+    }
+
+    free(buf);
+    if (manifest != NULL) {
+        fclose(manifest);
+    }
+    if (!record) {
+        printf("checked=%d failed=%d model_mismatches=%d\n", checked, failed, model_mismatches);
+    }
+    close_renderer();
+    SDL_Quit();
+    return failed > 0 || model_mismatches > 0 ? 1 : 0;
+}
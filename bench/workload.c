@@ -0,0 +1,287 @@
+#include "workload.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "slip.h"
+
+// Character grid of the song view for each font
+#define SMALL_COL_W 8
+#define SMALL_ROW_H 10
+#define SMALL_ROWS 24
+#define LARGE_COL_W 10
+#define LARGE_ROW_H 12
+#define LARGE_ROWS 20
+#define LARGE_OFFSET_Y 40
+#define COLUMNS 32
+
+// Rows of the song view that scroll with the cursor
+#define VIEW_TOP 3
+#define VIEW_ROWS 16
+
+// Playhead steps per second at 120 BPM sixteenths
+#define STEPS_PER_SECOND 8
+
+typedef struct {
+    uint8_t r, g, b;
+} rgb_s;
+
+// Background, text, highlight and cursor colour of each theme
+static const rgb_s themes[][4] = {
+        {{0x00, 0x00, 0x00}, {0xF0, 0xF0, 0xF0}, {0x00, 0xC0, 0xFF}, {0x30, 0x30, 0x50}},
+        {{0x10, 0x08, 0x20}, {0xE0, 0xD0, 0xFF}, {0xFF, 0x60, 0xA0}, {0x40, 0x20, 0x60}},
+        {{0xF0, 0xF0, 0xE8}, {0x20, 0x20, 0x20}, {0xD0, 0x40, 0x00}, {0xC0, 0xC0, 0xB0}},
+        {{0x00, 0x18, 0x10}, {0x80, 0xFF, 0xC0}, {0xFF, 0xFF, 0x00}, {0x00, 0x40, 0x30}},
+};
+#define THEME_COUNT (sizeof(themes) / sizeof(themes[0]))
+
+static const char *names[WORKLOAD_COUNT] = {"reset", "scope", "scroll", "large", "theme"};
+static const double default_rates[WORKLOAD_COUNT] = {1, 60, 20, 1, 2};
+
+typedef struct {
+    uint8_t *out;
+    uint32_t size;
+    workload_s *w;
+} writer_s;
+
+static uint32_t next_random(workload_s *w) {
+    // xorshift32, the same stream for the same seed on every machine
+    uint32_t x = w->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    w->rng = x;
+    return x;
+}
+
+static void put_packet(writer_s *wr, const uint8_t *data, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        if (data[i] == SLIP_SPECIAL_BYTE_END) {
+            wr->out[wr->size++] = SLIP_SPECIAL_BYTE_ESC;
+            wr->out[wr->size++] = SLIP_ESCAPED_BYTE_END;
+        } else if (data[i] == SLIP_SPECIAL_BYTE_ESC) {
+            wr->out[wr->size++] = SLIP_SPECIAL_BYTE_ESC;
+            wr->out[wr->size++] = SLIP_ESCAPED_BYTE_ESC;
+        } else {
+            wr->out[wr->size++] = data[i];
+        }
+    }
+    wr->out[wr->size++] = SLIP_SPECIAL_BYTE_END;
+    wr->w->packets++;
+}
+
+static void put_rect(writer_s *wr, int x, int y, int w, int h, rgb_s c) {
+    uint8_t p[12] = {0xFE, x & 0xFF, x >> 8, y & 0xFF, y >> 8, w & 0xFF, w >> 8, h & 0xFF,
+                     h >> 8, c.r, c.g, c.b};
+    put_packet(wr, p, sizeof(p));
+}
+
+static void put_char(writer_s *wr, char ch, int x, int y, rgb_s fg, rgb_s bg) {
+    uint8_t p[12] = {0xFD, (uint8_t) ch, x & 0xFF, x >> 8, y & 0xFF, y >> 8,
+                     fg.r, fg.g, fg.b, bg.r, bg.g, bg.b};
+    put_packet(wr, p, sizeof(p));
+}
+
+static void put_text(writer_s *wr, const char *text, int col, int y, int col_w, rgb_s fg,
+                     rgb_s bg) {
+    for (int i = 0; text[i] != 0; i++) {
+        put_char(wr, text[i], (col + i) * col_w, y, fg, bg);
+    }
+}
+
+static void put_system_info(writer_s *wr, int large) {
+    uint8_t p[6] = {0xFF, 2, 3, 0, 0, large ? 1 : 0};
+    put_packet(wr, p, sizeof(p));
+}
+
+static void put_waveform(writer_s *wr, workload_s *w, int size, rgb_s c) {
+    uint8_t p[4 + 320] = {0xFC, c.r, c.g, c.b};
+    double phase = w->events * 0.37;
+    for (int i = 0; i < size; i++) {
+        double v = sin(phase + i * 0.11) * 7 + sin(phase * 3 + i * 0.029) * 3;
+        p[4 + i] = (uint8_t) (10 + v + (int) (next_random(w) % 3) - 1);
+    }
+    put_packet(wr, p, 4 + size);
+}
+
+// One row of the song view: row number and eight chain columns
+static void song_row_text(workload_s *w, int row, char *text) {
+    static const char hex[] = "0123456789ABCDEF";
+    int n = 0;
+    text[n++] = hex[(row >> 4) & 0xF];
+    text[n++] = hex[row & 0xF];
+    text[n++] = ' ';
+    for (int t = 0; t < 8; t++) {
+        uint32_t r = next_random(w);
+        if (r % 4 == 0) {
+            text[n++] = '-';
+            text[n++] = '-';
+        } else {
+            text[n++] = hex[(r >> 4) & 0xF];
+            text[n++] = hex[(r >> 8) & 0xF];
+        }
+        text[n++] = ' ';
+    }
+    text[n - 1] = 0;
+}
+
+static void full_redraw(writer_s *wr, workload_s *w, int large) {
+    const rgb_s *theme = themes[w->theme];
+    int col_w = large ? LARGE_COL_W : SMALL_COL_W;
+    int row_h = large ? LARGE_ROW_H : SMALL_ROW_H;
+    int rows = large ? LARGE_ROWS : SMALL_ROWS;
+    int top = large ? LARGE_OFFSET_Y : 0;
+    char text[COLUMNS + 1];
+
+    put_rect(wr, 0, top, 320, 240, theme[0]);
+    put_text(wr, "SONG", 0, top + row_h, col_w, theme[2], theme[0]);
+    put_text(wr, "TEMPO 120.00  LIVE", 12, top + row_h, col_w, theme[1], theme[0]);
+
+    for (int r = 0; r < rows - VIEW_TOP; r++) {
+        int y = top + (VIEW_TOP + r) * row_h;
+        if (r == w->cursor_row) {
+            put_rect(wr, 3 * col_w - 1, y - 1, 2 * col_w + 1, row_h, theme[3]);
+        }
+        song_row_text(w, w->scroll + r, text);
+        put_text(wr, text, 0, y, col_w, r == w->cursor_row ? theme[2] : theme[1], theme[0]);
+    }
+
+    // Mixer meters on the right edge and an empty scope
+    put_rect(wr, 300, top + 200, 4, 30, theme[2]);
+    put_rect(wr, 306, top + 200, 4, 30, theme[2]);
+    put_waveform(wr, w, 0, theme[2]);
+}
+
+static void scope_frame(writer_s *wr, workload_s *w) {
+    const rgb_s *theme = themes[w->theme];
+    char text[COLUMNS + 1];
+
+    put_waveform(wr, w, 320, theme[2]);
+
+    // Meters move every frame
+    int left = 5 + next_random(w) % 25;
+    int right = 5 + next_random(w) % 25;
+    put_rect(wr, 300, 200, 4, 30 - left, theme[0]);
+    put_rect(wr, 300, 230 - left, 4, left, theme[2]);
+    put_rect(wr, 306, 200, 4, 30 - right, theme[0]);
+    put_rect(wr, 306, 230 - right, 4, right, theme[2]);
+
+    // The playhead moves on to the next row every step
+    uint32_t frames_per_step = (uint32_t) (w->rate / STEPS_PER_SECOND);
+    if (frames_per_step == 0 || w->events % frames_per_step == 0) {
+        int previous = w->cursor_row;
+        w->cursor_row = (w->cursor_row + 1) % VIEW_ROWS;
+        song_row_text(w, w->scroll + previous, text);
+        put_text(wr, text, 0, (VIEW_TOP + previous) * SMALL_ROW_H, SMALL_COL_W, theme[1],
+                 theme[0]);
+        song_row_text(w, w->scroll + w->cursor_row, text);
+        put_text(wr, text, 0, (VIEW_TOP + w->cursor_row) * SMALL_ROW_H, SMALL_COL_W, theme[2],
+                 theme[0]);
+    }
+}
+
+static void scroll_step(writer_s *wr, workload_s *w) {
+    const rgb_s *theme = themes[w->theme];
+    char text[COLUMNS + 1];
+
+    if (w->cursor_row == VIEW_ROWS - 1) {
+        // Past the bottom the whole view scrolls by one row
+        w->scroll++;
+        for (int r = 0; r < VIEW_ROWS; r++) {
+            int y = (VIEW_TOP + r) * SMALL_ROW_H;
+            put_rect(wr, 0, y - 1, 320, SMALL_ROW_H, theme[0]);
+            song_row_text(w, w->scroll + r, text);
+            put_text(wr, text, 0, y, SMALL_COL_W, r == w->cursor_row ? theme[2] : theme[1],
+                     theme[0]);
+        }
+        put_rect(wr, 3 * SMALL_COL_W - 1, (VIEW_TOP + w->cursor_row) * SMALL_ROW_H - 1,
+                 2 * SMALL_COL_W + 1, SMALL_ROW_H, theme[3]);
+    } else {
+        int previous = w->cursor_row++;
+        int y = (VIEW_TOP + previous) * SMALL_ROW_H;
+        put_rect(wr, 0, y - 1, 320, SMALL_ROW_H, theme[0]);
+        song_row_text(w, w->scroll + previous, text);
+        put_text(wr, text, 0, y, SMALL_COL_W, theme[1], theme[0]);
+
+        y = (VIEW_TOP + w->cursor_row) * SMALL_ROW_H;
+        put_rect(wr, 3 * SMALL_COL_W - 1, y - 1, 2 * SMALL_COL_W + 1, SMALL_ROW_H, theme[3]);
+        song_row_text(w, w->scroll + w->cursor_row, text);
+        put_text(wr, text, 0, y, SMALL_COL_W, theme[2], theme[0]);
+    }
+
+    // Row counter in the header
+    snprintf(text, sizeof(text), "ROW %02X", (w->scroll + w->cursor_row) & 0xFF);
+    put_text(wr, text, 32, SMALL_ROW_H, SMALL_COL_W, theme[1], theme[0]);
+}
+
+int workload_find(const char *name) {
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *workload_name(workload_scenario_t scenario) {
+    return scenario < WORKLOAD_COUNT ? names[scenario] : "unknown";
+}
+
+double workload_default_rate(workload_scenario_t scenario) {
+    return scenario < WORKLOAD_COUNT ? default_rates[scenario] : 1;
+}
+
+void workload_init(workload_s *w, workload_scenario_t scenario, double rate, uint32_t seed) {
+    memset(w, 0, sizeof(*w));
+    w->scenario = scenario;
+    w->rate = rate > 0 ? rate : workload_default_rate(scenario);
+    w->rng = seed != 0 ? seed : 0x4D38;
+}
+
+uint32_t workload_next(workload_s *w, uint8_t *out, uint64_t *due_us) {
+    writer_s wr = {.out = out, .size = 0, .w = w};
+
+    *due_us = (uint64_t) (w->events * 1000000.0 / w->rate);
+
+    switch (w->scenario) {
+        case WORKLOAD_RESET:
+            if (w->events == 0) {
+                put_system_info(&wr, 0);
+            }
+            full_redraw(&wr, w, 0);
+            break;
+        case WORKLOAD_SCOPE:
+            if (w->events == 0) {
+                put_system_info(&wr, 0);
+                full_redraw(&wr, w, 0);
+            }
+            scope_frame(&wr, w);
+            break;
+        case WORKLOAD_SCROLL:
+            if (w->events == 0) {
+                put_system_info(&wr, 0);
+                full_redraw(&wr, w, 0);
+            }
+            scroll_step(&wr, w);
+            break;
+        case WORKLOAD_LARGE:
+            if (w->events == 0) {
+                put_system_info(&wr, 1);
+            }
+            full_redraw(&wr, w, 1);
+            break;
+        case WORKLOAD_THEME:
+            if (w->events == 0) {
+                put_system_info(&wr, 0);
+            }
+            w->theme = w->events % THEME_COUNT;
+            full_redraw(&wr, w, 0);
+            break;
+        default:
+            break;
+    }
+
+    w->events++;
+    return wr.size;
+}
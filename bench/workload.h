@@ -0,0 +1,46 @@
+#ifndef M8C_WORKLOAD_H
+#define M8C_WORKLOAD_H
+
+#include <stdint.h>
+
+/* Synthetic M8 traffic: SLIP framed draw commands that model typical
+   screens, generated one event at a time with the time it is due. */
+
+typedef enum {
+    WORKLOAD_RESET,  // full screen redraw, as after reset_display()
+    WORKLOAD_SCOPE,  // playback with the oscilloscope at 60 Hz
+    WORKLOAD_SCROLL, // cursor held down in the song view
+    WORKLOAD_LARGE,  // full redraws with the large font
+    WORKLOAD_THEME,  // theme colour changes, each one redraws everything
+    WORKLOAD_COUNT
+} workload_scenario_t;
+
+// Largest event, a full redraw with every character escaped twice over
+#define WORKLOAD_MAX_EVENT_BYTES 65536
+
+typedef struct {
+    workload_scenario_t scenario;
+    double rate;        // events per second
+    uint32_t rng;
+    uint32_t events;
+    uint32_t packets;   // commands generated so far
+    int cursor_row;
+    int scroll;
+    uint8_t theme;
+} workload_s;
+
+// -1 when the name is unknown
+int workload_find(const char *name);
+const char *workload_name(workload_scenario_t scenario);
+
+// Events per second the scenario runs at by default
+double workload_default_rate(workload_scenario_t scenario);
+
+// rate <= 0 picks the default rate
+void workload_init(workload_s *w, workload_scenario_t scenario, double rate, uint32_t seed);
+
+/* Writes the SLIP bytes of the next event to out and returns their count.
+   due_us is set to when the event happens, relative to the first one. */
+uint32_t workload_next(workload_s *w, uint8_t *out, uint64_t *due_us);
+
+#endif //M8C_WORKLOAD_H
@@ -0,0 +1,281 @@
+// Writes synthetic M8 traffic to a file, or drives it through the SLIP decoder
+// and command queue of m8c to find where the queue starts to overflow.
+
+#include <SDL.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "command.h"
+#include "command_queue.h"
+#include "render.h"
+#include "slip.h"
+#include "workload.h"
+
+// Rate multiplier per ramp step in --drive mode, and when to give up
+#define RAMP_FACTOR 1.5
+#define MAX_RAMP_STEPS 24
+
+typedef struct {
+    workload_scenario_t scenario;
+    double rate;
+    double seconds;
+    uint32_t seed;
+    const char *out;
+    int realtime;
+    int drive;
+    int idle_ms;
+} options_s;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until_us(uint64_t deadline) {
+    uint64_t now = now_us();
+    if (deadline > now) {
+        struct timespec ts = {(time_t) ((deadline - now) / 1000000),
+                              (long) ((deadline - now) % 1000000) * 1000};
+        while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        }
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+            "usage: m8c-workload <scenario> [--rate events/s] [--seconds s] [--seed n]\n"
+            "                    [--out file] [--realtime] [--drive [--idle-ms ms]]\n"
+            "scenarios:");
+    for (int i = 0; i < WORKLOAD_COUNT; i++) {
+        fprintf(stderr, " %s (%g/s)", workload_name(i), workload_default_rate(i));
+    }
+    fprintf(stderr, "\n");
+}
+
+// Stream the scenario to a file or FIFO, paced in real time if asked to
+static int write_stream(const options_s *opt) {
+    FILE *f = stdout;
+    if (opt->out != NULL && strcmp(opt->out, "-") != 0) {
+        f = fopen(opt->out, "wb");
+        if (f == NULL) {
+            fprintf(stderr, "m8c-workload: cannot open %s: %s\n", opt->out, strerror(errno));
+            return 1;
+        }
+    }
+
+    workload_s w;
+    workload_init(&w, opt->scenario, opt->rate, opt->seed);
+    uint8_t *buf = malloc(WORKLOAD_MAX_EVENT_BYTES);
+    uint64_t start = now_us();
+    uint64_t total = 0;
+    uint32_t events = 0;
+    uint32_t commands = 0;
+    uint64_t due;
+
+    for (;;) {
+        uint32_t n = workload_next(&w, buf, &due);
+        if (due > (uint64_t) (opt->seconds * 1000000)) {
+            break;
+        }
+        if (opt->realtime) {
+            sleep_until_us(start + due);
+        }
+        if (fwrite(buf, 1, n, f) != n) {
+            fprintf(stderr, "m8c-workload: write failed: %s\n", strerror(errno));
+            break;
+        }
+        if (opt->realtime) {
+            fflush(f);
+        }
+        total += n;
+        events++;
+        commands = w.packets;
+    }
+
+    fprintf(stderr, "scenario=%s rate=%g events=%u commands=%u bytes=%llu seconds=%g\n",
+            workload_name(opt->scenario), w.rate, events, commands,
+            (unsigned long long) total, opt->seconds);
+    free(buf);
+    if (f != stdout) {
+        fclose(f);
+    }
+    return 0;
+}
+
+/* Drive mode: a producer thread plays the part of the USB thread and feeds
+   the generated bytes through slip_read_byte() into pullCommand(), while the
+   main thread pops, draws and presents like the m8c main loop. */
+
+static uint8_t slip_buffer[1024];
+static const slip_descriptor_s slip_descriptor = {
+        .buf = slip_buffer,
+        .buf_size = sizeof(slip_buffer),
+        .recv_message = pullCommand,
+};
+
+static const options_s *options;
+static volatile int producer_exit = 0;
+static uint32_t rate_milli;       // current event rate * 1000
+static uint32_t produced = 0;     // commands pushed into the queue
+static uint64_t produced_bytes = 0;
+
+static int producer(void *data) {
+    slip_handler_s slip;
+    slip_init(&slip, &slip_descriptor);
+
+    workload_s w;
+    workload_init(&w, options->scenario, options->rate, options->seed);
+    uint8_t *buf = malloc(WORKLOAD_MAX_EVENT_BYTES);
+    uint64_t next = now_us();
+    uint64_t due;
+
+    while (!__atomic_load_n(&producer_exit, __ATOMIC_ACQUIRE)) {
+        sleep_until_us(next);
+        uint32_t before = w.packets;
+        uint32_t n = workload_next(&w, buf, &due);
+        for (uint32_t i = 0; i < n; i++) {
+            slip_read_byte(&slip, buf[i]);
+        }
+        __atomic_add_fetch(&produced, w.packets - before, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&produced_bytes, n, __ATOMIC_RELAXED);
+
+        // Pace by the current rate, which the ramp keeps raising
+        next += (uint64_t) (1000000000.0 / __atomic_load_n(&rate_milli, __ATOMIC_RELAXED));
+        if (next < now_us()) {
+            next = now_us();
+        }
+    }
+    free(buf);
+    return 0;
+}
+
+static int drive(const options_s *opt) {
+    options = opt;
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    if (initialize_sdl(0, 0) != 1 || !command_queue_init()) {
+        fprintf(stderr, "m8c-workload: could not initialize SDL\n");
+        return 1;
+    }
+
+    double rate = opt->rate > 0 ? opt->rate : workload_default_rate(opt->scenario);
+    __atomic_store_n(&rate_milli, (uint32_t) (rate * 1000), __ATOMIC_RELAXED);
+    SDL_Thread *thread = SDL_CreateThread(producer, NULL);
+
+    uint32_t step_ms = (uint32_t) (opt->seconds * 1000);
+    uint32_t consumed = 0, frames = 0;
+    uint32_t last_produced = 0, last_consumed = 0, last_frames = 0, last_overflows = 0;
+    uint64_t last_bytes = 0;
+    uint32_t step_start = SDL_GetTicks();
+    int steps = 0;
+    double threshold = 0;
+
+    printf("# scenario=%s idle_ms=%d queue=%d step_s=%g\n", workload_name(opt->scenario),
+           opt->idle_ms, COMMAND_QUEUE_SIZE, opt->seconds);
+    for (;;) {
+        uint8_t *com;
+        uint32_t size;
+        int draws = 0;
+        while (popCommand(&com, &size) > 0) {
+            process_command(com, size);
+            draws++;
+        }
+        consumed += draws;
+        if (draws > 0) {
+            render_screen();
+            frames++;
+        }
+        SDL_Delay(opt->idle_ms);
+
+        uint32_t elapsed = SDL_GetTicks() - step_start;
+        if (elapsed < step_ms) {
+            continue;
+        }
+
+        uint32_t p = __atomic_load_n(&produced, __ATOMIC_RELAXED);
+        uint64_t b = __atomic_load_n(&produced_bytes, __ATOMIC_RELAXED);
+        uint32_t o = command_queue_overflows();
+        double seconds = elapsed / 1000.0;
+        printf("rate=%.1f commands_s=%.0f drawn_s=%.0f bytes_s=%.0f fps=%.1f overflows=%u\n",
+               rate, (p - last_produced) / seconds, (consumed - last_consumed) / seconds,
+               (b - last_bytes) / seconds, (frames - last_frames) / seconds, o - last_overflows);
+        fflush(stdout);
+
+        if (o != last_overflows) {
+            threshold = (p - last_produced) / seconds;
+            break;
+        }
+        if (++steps >= MAX_RAMP_STEPS) {
+            break;
+        }
+
+        last_produced = p;
+        last_consumed = consumed;
+        last_frames = frames;
+        last_overflows = o;
+        last_bytes = b;
+        rate *= RAMP_FACTOR;
+        __atomic_store_n(&rate_milli, (uint32_t) (rate * 1000), __ATOMIC_RELAXED);
+        step_start = SDL_GetTicks();
+    }
+
+    __atomic_store_n(&producer_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(thread, NULL);
+
+    if (threshold > 0) {
+        printf("overflow_commands_s=%.0f\n", threshold);
+    } else {
+        printf("overflow_commands_s=none\n");
+    }
+    command_queue_destroy();
+    close_renderer();
+    SDL_Quit();
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    options_s opt = {.rate = 0, .seconds = 0, .seed = 1, .idle_ms = 10};
+    int scenario = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            opt.rate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            opt.seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            opt.seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            opt.out = argv[++i];
+        } else if (strcmp(argv[i], "--idle-ms") == 0 && i + 1 < argc) {
+            opt.idle_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            opt.realtime = 1;
+        } else if (strcmp(argv[i], "--drive") == 0) {
+            opt.drive = 1;
+        } else if (scenario < 0) {
+            scenario = workload_find(argv[i]);
+            if (scenario < 0) {
+                fprintf(stderr, "m8c-workload: unknown scenario %s\n", argv[i]);
+                usage();
+                return 1;
+            }
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (scenario < 0 || opt.seconds < 0) {
+        usage();
+        return 1;
+    }
+    opt.scenario = scenario;
+
+    // --seconds is the length of the stream, or of each ramp step with --drive
+    if (opt.seconds == 0) {
+        opt.seconds = opt.drive ? 2 : 10;
+    }
+    return opt.drive ? drive(&opt) : write_stream(&opt);
+}
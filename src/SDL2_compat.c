@@ -4,21 +4,27 @@
 
 #include "stdio.h"
 #include "stdarg.h"
+#include "SDL2_compat.h"
 
 void SDL_Log(const char * data, ...) {
-    printf(data);
-}
-
-void SDL_LogDebug(int type, const char * data, va_list args) {
-    printf(data, args);
+    va_list args;
+    va_start(args, data);
+    log_writev(LOG_INFO, SDL_LOG_CATEGORY_APPLICATION, data, args);
+    va_end(args);
 }
 
 void SDL_LogError(int type, const char * data, ...) {
-    printf(data);
+    va_list args;
+    va_start(args, data);
+    log_writev(LOG_ERROR, type, data, args);
+    va_end(args);
 }
 
 void SDL_LogCritical(int type, const char * data, ...) {
-    printf(data);
+    va_list args;
+    va_start(args, data);
+    log_writev(LOG_CRITICAL, type, data, args);
+    va_end(args);
 }
 
 char* SDL_GetPrefPath(const char *org, const char *app) {
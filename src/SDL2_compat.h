@@ -6,6 +6,7 @@
 #define M8C_SDL2_COMPAT_H
 
 #include "stdio.h"
+#include "log.h"
 
 static const int SDL_LOG_CATEGORY_APPLICATION = 1;
 static const int SDL_LOG_CATEGORY_ERROR = 2;
@@ -14,14 +15,22 @@ static const int SDL_LOG_PRIORITY_INFO = 4;
 static const int SDL_LOG_CATEGORY_VIDEO = 4;
 static const int SDL_LOG_CATEGORY_INPUT = 5;
 
+// The SDL2 logging calls, queued through log.h
+void SDL_Log(const char * data, ...) __attribute__((format(printf, 1, 2)));
 
-void SDL_Log(const char * data, ...);
+void SDL_LogError(int type, const char * data, ...) __attribute__((format(printf, 2, 3)));
 
-void SDL_LogDebug(int type, const char * data, ...);
+void SDL_LogCritical(int type, const char * data, ...) __attribute__((format(printf, 2, 3)));
 
-void SDL_LogError(int type, const char * data, ...);
-
-void SDL_LogCritical(int type, const char * data, ...);
+// Debug messages are compiled in with DEBUG_MSG only, the arguments are checked either way
+#ifdef DEBUG_MSG
+#define SDL_LogDebug(type, ...) log_write(LOG_DEBUG, type, __VA_ARGS__)
+#else
+#define SDL_LogDebug(type, ...)                                                                \
+    do {                                                                                       \
+        if (0) log_write(LOG_DEBUG, type, __VA_ARGS__);                                        \
+    } while (0)
+#endif
 
 
 #endif //M8C_SDL2_COMPAT_H
@@ -100,13 +100,18 @@ int audio_init(int audio_buffer_size, const char *output_device_name, SDL_mutex
     return 1;
 }
 
-void audio_destroy() {
+int audio_destroy() {
     SDL_Log("Closing audio devices");
 //    SDL_PauseAudioDevice(devid_in, 1);
 //    SDL_PauseAudioDevice(devid_out, 1);
 //    SDL_CloseAudioDevice(devid_in);
 //    SDL_CloseAudioDevice(devid_out);
     SDL_CloseAudio();
+    return 1;
+}
+
+void audio_get_stats(audio_stats_s *stats) {
+    *stats = (audio_stats_s) {0, 0, 0, 0, 0};
 }
 
 #endif
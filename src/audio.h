@@ -3,7 +3,27 @@
 #ifndef AUDIO_H
 #define AUDIO_H
 
+#include <stdint.h>
+
 int audio_init(int audio_buffer_size, const char *output_device_name);
-void audio_destroy();
+int audio_destroy();
+
+/* Stops the USB side of the audio stream but keeps the output device, ring
+   buffer and transfers, so audio_init() after a reconnect only has to claim
+   the interface again. */
+int audio_disconnect();
+
+typedef struct {
+    uint32_t fill_percent; // M8 audio waiting in the ring buffer
+    uint32_t underruns;    // output callbacks that found too little audio
+    uint32_t overruns;     // USB packets that did not fit into the ring buffer
+    int playing;           // the output is running and calling back for audio
+    int transfers_in_flight; // isochronous transfers owned by libusb
+} audio_stats_s;
+
+void audio_get_stats(audio_stats_s *stats);
+
+// Digital silence lasting longer than this puts the output to sleep, 0 disables
+void audio_set_silence_hold(int hold_ms);
 
 #endif
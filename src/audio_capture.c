@@ -0,0 +1,312 @@
+#include "audio_capture.h"
+
+#include <SDL.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ringbuffer.h"
+#include "threads.h"
+#include "SDL2_compat.h"
+
+// About 24 seconds of audio, enough to ride out slow SD card writes
+#define STAGING_SIZE (4 * 1024 * 1024)
+
+// Size of one write() to the card. The header is padded to the same size so
+// every data write starts at an aligned file offset.
+#define CHUNK_SIZE (64 * 1024)
+#define HEADER_SIZE 4096
+#define FILE_ALIGN 4096
+
+// Rewrite the sizes in the header this often so a crash leaves a valid file
+#define HEADER_FIXUP_MS 2000
+
+#define WRITER_IDLE_MS 20
+
+#define WAV_FREQ 44100
+#define WAV_CHANNELS 2
+#define WAV_BITS 16
+
+static LockFreeRingBuffer *staging = NULL;
+static SDL_Thread *writer_thread = NULL;
+static int fd = -1;
+
+// requested is the main thread's side, active opens the tap for the
+// transfer callback and is only set by the writer once a file is under way
+static int requested = 0;
+static int active = 0;
+static uint32_t start_generation = 0;
+static int do_exit = 0;
+
+/* Where each recording starts in the staging buffer. The writer bumps take,
+   the transfer callback answers with its write position at that moment,
+   and the writer drops everything before it: a push from the last
+   recording that was still under way when it stopped. */
+static uint32_t take = 0;
+static uint32_t take_seen = 0;  // written by the transfer callback only
+static uint32_t take_start = 0; // likewise
+
+static uint32_t overruns = 0;
+static uint32_t dropped_bytes = 0;
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+/* RIFF header with a JUNK chunk that pads the data chunk to start at
+   HEADER_SIZE */
+static void build_header(uint8_t *h, uint32_t data_bytes) {
+    SDL_memset(h, 0, HEADER_SIZE);
+
+    SDL_memcpy(h, "RIFF", 4);
+    put_le32(h + 4, HEADER_SIZE - 8 + data_bytes);
+    SDL_memcpy(h + 8, "WAVE", 4);
+
+    SDL_memcpy(h + 12, "fmt ", 4);
+    put_le32(h + 16, 16);
+    put_le16(h + 20, 1); // PCM
+    put_le16(h + 22, WAV_CHANNELS);
+    put_le32(h + 24, WAV_FREQ);
+    put_le32(h + 28, WAV_FREQ * WAV_CHANNELS * WAV_BITS / 8);
+    put_le16(h + 32, WAV_CHANNELS * WAV_BITS / 8);
+    put_le16(h + 34, WAV_BITS);
+
+    SDL_memcpy(h + 36, "JUNK", 4);
+    put_le32(h + 40, HEADER_SIZE - 44 - 8);
+
+    SDL_memcpy(h + HEADER_SIZE - 8, "data", 4);
+    put_le32(h + HEADER_SIZE - 4, data_bytes);
+}
+
+static void fixup_header(uint32_t data_bytes) {
+    uint8_t size[4];
+    put_le32(size, HEADER_SIZE - 8 + data_bytes);
+    pwrite(fd, size, 4, 4);
+    put_le32(size, data_bytes);
+    pwrite(fd, size, 4, HEADER_SIZE - 4);
+}
+
+// Opens the tap, then the file, the staging buffer holds the audio meanwhile
+static int begin_recording() {
+    __atomic_add_fetch(&take, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&overruns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dropped_bytes, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+
+    char filename[64];
+    time_t now = time(NULL);
+    strftime(filename, sizeof(filename), "m8c-%Y%m%d-%H%M%S.wav", localtime(&now));
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        SDL_Log("Capture: could not create %s\n", filename);
+        __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    build_header(header, 0);
+    if (write(fd, header, HEADER_SIZE) != HEADER_SIZE) {
+        SDL_Log("Capture: could not write header to %s\n", filename);
+        __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+        close(fd);
+        fd = -1;
+        return 0;
+    }
+
+    SDL_Log("Capture started: %s\n", filename);
+    return 1;
+}
+
+static void finish_recording(uint32_t written) {
+    fixup_header(written);
+    close(fd);
+    fd = -1;
+
+    SDL_Log("Capture finished: %u bytes (%.1f s), %u overruns, %u bytes dropped\n",
+            written, (float) written / (WAV_FREQ * WAV_CHANNELS * WAV_BITS / 8),
+            __atomic_load_n(&overruns, __ATOMIC_RELAXED),
+            __atomic_load_n(&dropped_bytes, __ATOMIC_RELAXED));
+}
+
+/* Runs from the first recording until audio_capture_destroy(). Everything
+   that touches the card happens here, so starting and stopping never holds
+   up the main loop. */
+static int writer_loop(void *data) {
+    // Stay out of the way of the USB, audio and render threads, and drop
+    // the real-time scheduling the main thread may have passed on
+    threads_apply(THREAD_ROLE_BACKGROUND);
+    setpriority(PRIO_PROCESS, 0, 10);
+
+    uint8_t *chunk = NULL;
+    if (posix_memalign((void **) &chunk, FILE_ALIGN, CHUNK_SIZE) != 0) {
+        SDL_Log("Capture: could not allocate write buffer\n");
+        __atomic_store_n(&requested, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    int recording = 0;
+    int synced = 0; // the start of this recording in the staging buffer is known
+    uint32_t generation = 0;
+    uint32_t written = 0;
+    uint32_t reported_overruns = 0;
+    uint32_t ticks_fixup = 0;
+    int write_failed = 0;
+
+    for (;;) {
+        int wanted = __atomic_load_n(&requested, __ATOMIC_ACQUIRE);
+        uint32_t current_generation = __atomic_load_n(&start_generation, __ATOMIC_ACQUIRE);
+        // A stop followed by a start before we noticed still ends this file
+        int finishing = recording && (!wanted || current_generation != generation);
+
+        if (recording) {
+            // Nothing of this recording is in the buffer before the callback
+            // has marked where it starts
+            if (!synced && __atomic_load_n(&take_seen, __ATOMIC_ACQUIRE) ==
+                           __atomic_load_n(&take, __ATOMIC_RELAXED)) {
+                lf_ring_buffer_discard_to(staging, __atomic_load_n(&take_start, __ATOMIC_RELAXED));
+                synced = 1;
+            }
+            uint32_t used = synced ? lf_ring_buffer_used(staging) : 0;
+
+            // Batch into full chunks, only write a partial one when finishing
+            if (used >= CHUNK_SIZE || (finishing && used > 0)) {
+                uint32_t n = lf_ring_buffer_pop(staging, chunk, CHUNK_SIZE);
+                if (!write_failed) {
+                    ssize_t rc = write(fd, chunk, n);
+                    if (rc != (ssize_t) n) {
+                        SDL_Log("Capture: write to card failed, discarding further audio\n");
+                        write_failed = 1;
+                    } else {
+                        written += n;
+                    }
+                }
+                continue;
+            }
+
+            if (finishing) {
+                finish_recording(written);
+                recording = 0;
+                continue;
+            }
+
+            if (SDL_GetTicks() - ticks_fixup > HEADER_FIXUP_MS) {
+                ticks_fixup = SDL_GetTicks();
+                fixup_header(written);
+
+                uint32_t current = __atomic_load_n(&overruns, __ATOMIC_RELAXED);
+                if (current != reported_overruns) {
+                    SDL_Log("Capture: %u overruns so far\n", current);
+                    reported_overruns = current;
+                }
+            }
+        } else if (wanted && current_generation != generation) {
+            generation = current_generation;
+            if (begin_recording()) {
+                recording = 1;
+                synced = 0;
+                written = 0;
+                reported_overruns = 0;
+                ticks_fixup = SDL_GetTicks();
+                write_failed = 0;
+            } else {
+                __atomic_compare_exchange_n(&requested, &wanted, 0, 0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_RELAXED);
+            }
+            continue;
+        } else if (__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        SDL_Delay(WRITER_IDLE_MS);
+    }
+
+    free(chunk);
+    return 0;
+}
+
+int audio_capture_start() {
+    if (__atomic_load_n(&requested, __ATOMIC_ACQUIRE)) {
+        return 1;
+    }
+
+    // The staging buffer is kept for the lifetime of the program so the
+    // transfer callback never sees it disappear
+    if (staging == NULL) {
+        staging = lf_ring_buffer_create(STAGING_SIZE);
+    }
+
+    __atomic_add_fetch(&start_generation, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&requested, 1, __ATOMIC_RELEASE);
+
+    if (writer_thread == NULL) {
+        writer_thread = SDL_CreateThread(&writer_loop, NULL);
+        if (writer_thread == NULL) {
+            SDL_Log("Capture: could not start writer thread\n");
+            __atomic_store_n(&requested, 0, __ATOMIC_RELEASE);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void audio_capture_stop() {
+    if (!__atomic_load_n(&requested, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    // Stop the tap first so the writer sees a buffer that only shrinks
+    __atomic_store_n(&active, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&requested, 0, __ATOMIC_RELEASE);
+    SDL_Log("Capture stopping\n");
+}
+
+int audio_capture_toggle() {
+    if (audio_capture_active()) {
+        audio_capture_stop();
+        return 0;
+    }
+    return audio_capture_start();
+}
+
+int audio_capture_active() {
+    return __atomic_load_n(&requested, __ATOMIC_ACQUIRE);
+}
+
+void audio_capture_write(const uint8_t *data, uint32_t length) {
+    uint32_t current = __atomic_load_n(&take, __ATOMIC_ACQUIRE);
+    if (current != take_seen) {
+        __atomic_store_n(&take_start, lf_ring_buffer_mark(staging), __ATOMIC_RELAXED);
+        __atomic_store_n(&take_seen, current, __ATOMIC_RELEASE);
+    }
+    if (!__atomic_load_n(&active, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (lf_ring_buffer_push(staging, data, length) != length) {
+        __atomic_add_fetch(&overruns, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&dropped_bytes, length, __ATOMIC_RELAXED);
+    }
+}
+
+void audio_capture_destroy() {
+    audio_capture_stop();
+    if (writer_thread != NULL) {
+        __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+        SDL_WaitThread(writer_thread, NULL);
+        writer_thread = NULL;
+    }
+    if (staging != NULL) {
+        lf_ring_buffer_free(staging);
+        staging = NULL;
+    }
+}
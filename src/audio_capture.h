@@ -0,0 +1,26 @@
+#ifndef M8C_AUDIO_CAPTURE_H
+#define M8C_AUDIO_CAPTURE_H
+
+#include <stdint.h>
+
+// Start recording the M8 audio stream into a new WAV file. The file is created
+// by the writer thread, which logs if that fails. Returns 1 if recording was
+// requested.
+int audio_capture_start();
+
+// Stop recording. The writer thread drains the buffer and closes the file in
+// the background.
+void audio_capture_stop();
+
+int audio_capture_toggle();
+
+int audio_capture_active();
+
+// Called from the iso transfer callback with raw 44.1kHz S16 stereo data.
+// Never blocks; drops the packet and counts an overrun if the buffer is full.
+void audio_capture_write(const uint8_t *data, uint32_t length);
+
+// Stop recording, wait for the file to be finished and free the buffer
+void audio_capture_destroy();
+
+#endif //M8C_AUDIO_CAPTURE_H
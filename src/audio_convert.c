@@ -0,0 +1,317 @@
+#include "audio_convert.h"
+#include "SDL2_compat.h"
+
+#include <math.h>
+#include <time.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_CONVERT_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_CONVERT_SSE2 1
+#endif
+
+// Filter coefficients are Q14 so a phase that sums to 1.0 still fits in int16
+#define COEFF_BITS 14
+
+// Output is produced in chunks of this many frames before packing
+#define CHUNK_FRAMES 256
+
+// Seconds of output audio between CPU usage reports
+#define REPORT_SECONDS 10
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline int16_t saturate16(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t) v;
+}
+
+// Windowed sinc low-pass, one row per fractional position between input samples
+static void build_filter(audio_convert_s *cv) {
+    const int half = AUDIO_CONVERT_TAPS / 2;
+    double cutoff = 0.5 * 0.95;
+    if (cv->out_freq < cv->in_freq) {
+        // downsampling, keep the band below the new Nyquist frequency
+        cutoff *= (double) cv->out_freq / cv->in_freq;
+    }
+
+    for (int p = 0; p < AUDIO_CONVERT_PHASES; p++) {
+        double frac = (double) p / AUDIO_CONVERT_PHASES;
+        double taps[AUDIO_CONVERT_TAPS];
+        double sum = 0;
+
+        for (int k = 0; k < AUDIO_CONVERT_TAPS; k++) {
+            double d = k - (half - 1) - frac;
+            double x = 2.0 * cutoff * d;
+            double sinc = (x == 0.0) ? 1.0 : sin(M_PI * x) / (M_PI * x);
+            // Blackman window over [-half, half]
+            double w = (d + half) / (2.0 * half);
+            double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+            taps[k] = sinc * window;
+            sum += taps[k];
+        }
+
+        // Normalize every phase to unity gain so there is no ripple in level
+        for (int k = 0; k < AUDIO_CONVERT_TAPS; k++) {
+            cv->coeffs[p][k] = (int16_t) lrint(taps[k] / sum * (1 << COEFF_BITS));
+        }
+    }
+}
+
+int audio_convert_init(audio_convert_s *cv, int in_freq, const SDL_AudioSpec *obtained) {
+    SDL_memset(cv, 0, sizeof(*cv));
+
+    cv->in_freq = in_freq;
+    cv->out_freq = obtained->freq;
+    cv->out_format = obtained->format;
+    cv->out_channels = obtained->channels;
+
+    switch (obtained->format) {
+        case AUDIO_U8:
+        case AUDIO_S8:
+            cv->out_frame_size = obtained->channels;
+            break;
+        case AUDIO_S16LSB:
+        case AUDIO_S16MSB:
+        case AUDIO_U16LSB:
+        case AUDIO_U16MSB:
+            cv->out_frame_size = 2 * obtained->channels;
+            break;
+        default:
+            SDL_Log("Unsupported audio output format 0x%X\n", obtained->format);
+            return 0;
+    }
+
+    if (obtained->channels < 1 || obtained->freq <= 0) {
+        SDL_Log("Unsupported audio output spec\n");
+        return 0;
+    }
+
+    cv->bypass = (obtained->freq == in_freq && obtained->format == AUDIO_S16SYS &&
+                  obtained->channels == 2);
+    cv->resample = (obtained->freq != in_freq);
+
+    if (cv->resample) {
+        cv->step = ((uint64_t) in_freq << 32) / (uint64_t) obtained->freq;
+        build_filter(cv);
+
+        // Room for the filter history plus one callback worth of new input
+        uint32_t max_in = (uint32_t) (((uint64_t) obtained->samples * cv->step) >> 32) + 2;
+        cv->hist_capacity = max_in + 2 * AUDIO_CONVERT_TAPS;
+        cv->hist_l = SDL_malloc(cv->hist_capacity * sizeof(int16_t));
+        cv->hist_r = SDL_malloc(cv->hist_capacity * sizeof(int16_t));
+        if (cv->hist_l == NULL || cv->hist_r == NULL) {
+            audio_convert_free(cv);
+            return 0;
+        }
+
+        // Prime with silence so the first outputs have a full filter history
+        cv->hist_frames = AUDIO_CONVERT_TAPS - 1;
+        SDL_memset(cv->hist_l, 0, cv->hist_capacity * sizeof(int16_t));
+        SDL_memset(cv->hist_r, 0, cv->hist_capacity * sizeof(int16_t));
+    }
+
+    if (!cv->bypass) {
+        SDL_Log("Converting audio from %d Hz S16 stereo to %d Hz format 0x%X, %d channels\n",
+                in_freq, obtained->freq, obtained->format, obtained->channels);
+    }
+
+    return 1;
+}
+
+void audio_convert_free(audio_convert_s *cv) {
+    SDL_free(cv->hist_l);
+    SDL_free(cv->hist_r);
+    cv->hist_l = NULL;
+    cv->hist_r = NULL;
+}
+
+uint32_t audio_convert_frames_needed(audio_convert_s *cv, uint32_t out_frames) {
+    if (!cv->resample) {
+        return out_frames;
+    }
+    if (out_frames == 0) {
+        return 0;
+    }
+    uint64_t last = cv->pos + (uint64_t) (out_frames - 1) * cv->step;
+    uint64_t end = (last >> 32) + AUDIO_CONVERT_TAPS;
+    return end > cv->hist_frames ? (uint32_t) (end - cv->hist_frames) : 0;
+}
+
+static inline int32_t dot_taps(const int16_t *x, const int16_t *h) {
+#if defined(AUDIO_CONVERT_NEON)
+    int16x8_t x0 = vld1q_s16(x);
+    int16x8_t x1 = vld1q_s16(x + 8);
+    int16x8_t h0 = vld1q_s16(h);
+    int16x8_t h1 = vld1q_s16(h + 8);
+    int32x4_t acc = vmull_s16(vget_low_s16(x0), vget_low_s16(h0));
+    acc = vmlal_s16(acc, vget_high_s16(x0), vget_high_s16(h0));
+    acc = vmlal_s16(acc, vget_low_s16(x1), vget_low_s16(h1));
+    acc = vmlal_s16(acc, vget_high_s16(x1), vget_high_s16(h1));
+    int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+    sum = vpadd_s32(sum, sum);
+    return vget_lane_s32(sum, 0);
+#elif defined(AUDIO_CONVERT_SSE2)
+    __m128i acc = _mm_madd_epi16(_mm_loadu_si128((const __m128i *) x),
+                                 _mm_loadu_si128((const __m128i *) h));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) (x + 8)),
+                                            _mm_loadu_si128((const __m128i *) (h + 8))));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+#else
+    int32_t acc = 0;
+    for (int k = 0; k < AUDIO_CONVERT_TAPS; k++) {
+        acc += (int32_t) x[k] * h[k];
+    }
+    return acc;
+#endif
+}
+
+// Resample n frames from the history into interleaved stereo
+static void resample_chunk(audio_convert_s *cv, int16_t *out, uint32_t n) {
+    const int32_t round = 1 << (COEFF_BITS - 1);
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t idx = (uint32_t) (cv->pos >> 32);
+        uint32_t phase = (uint32_t) ((cv->pos & 0xFFFFFFFFull) * AUDIO_CONVERT_PHASES >> 32);
+        const int16_t *h = cv->coeffs[phase];
+
+        out[2 * i] = saturate16((dot_taps(&cv->hist_l[idx], h) + round) >> COEFF_BITS);
+        out[2 * i + 1] = saturate16((dot_taps(&cv->hist_r[idx], h) + round) >> COEFF_BITS);
+
+        cv->pos += cv->step;
+    }
+}
+
+// Write n interleaved stereo S16 frames in the output format
+static uint8_t *pack_chunk(audio_convert_s *cv, const int16_t *in, uint32_t n, uint8_t *out) {
+    const int channels = cv->out_channels;
+
+    for (uint32_t i = 0; i < n; i++) {
+        int16_t l = in[2 * i];
+        int16_t r = in[2 * i + 1];
+        if (channels == 1) {
+            l = (int16_t) (((int32_t) l + r) >> 1);
+        }
+
+        for (int c = 0; c < channels; c++) {
+            // Anything beyond the first two channels stays silent
+            int16_t s = c == 0 ? l : (c == 1 ? r : 0);
+            switch (cv->out_format) {
+                case AUDIO_U8:
+                    *out++ = (uint8_t) ((s >> 8) ^ 0x80);
+                    break;
+                case AUDIO_S8:
+                    *out++ = (uint8_t) (s >> 8);
+                    break;
+                case AUDIO_S16LSB:
+                    *out++ = (uint8_t) s;
+                    *out++ = (uint8_t) ((uint16_t) s >> 8);
+                    break;
+                case AUDIO_S16MSB:
+                    *out++ = (uint8_t) ((uint16_t) s >> 8);
+                    *out++ = (uint8_t) s;
+                    break;
+                case AUDIO_U16LSB:
+                    *out++ = (uint8_t) s;
+                    *out++ = (uint8_t) (((uint16_t) s ^ 0x8000) >> 8);
+                    break;
+                case AUDIO_U16MSB:
+                    *out++ = (uint8_t) (((uint16_t) s ^ 0x8000) >> 8);
+                    *out++ = (uint8_t) s;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return out;
+}
+
+static void append_history(audio_convert_s *cv, const int16_t *in, uint32_t in_frames) {
+    uint32_t room = cv->hist_capacity - cv->hist_frames;
+    if (in_frames > room) {
+        in_frames = room;
+    }
+    int16_t *l = cv->hist_l + cv->hist_frames;
+    int16_t *r = cv->hist_r + cv->hist_frames;
+    for (uint32_t i = 0; i < in_frames; i++) {
+        l[i] = in[2 * i];
+        r[i] = in[2 * i + 1];
+    }
+    cv->hist_frames += in_frames;
+}
+
+void audio_convert_process(audio_convert_s *cv, const int16_t *in, uint32_t in_frames,
+                           uint8_t *out, uint32_t out_frames) {
+    if (cv->bypass) {
+        SDL_memcpy(out, in, in_frames * 4);
+        if (in_frames < out_frames) {
+            SDL_memset(out + in_frames * 4, 0, (out_frames - in_frames) * 4);
+        }
+        return;
+    }
+
+    uint64_t start = now_ns();
+    int16_t chunk[CHUNK_FRAMES * 2];
+
+    if (cv->resample) {
+        append_history(cv, in, in_frames);
+
+        // Pad with silence if the ring buffer could not deliver enough
+        uint32_t missing = audio_convert_frames_needed(cv, out_frames);
+        if (missing > 0 && cv->hist_frames + missing <= cv->hist_capacity) {
+            SDL_memset(cv->hist_l + cv->hist_frames, 0, missing * sizeof(int16_t));
+            SDL_memset(cv->hist_r + cv->hist_frames, 0, missing * sizeof(int16_t));
+            cv->hist_frames += missing;
+        }
+
+        for (uint32_t done = 0; done < out_frames;) {
+            uint32_t n = out_frames - done < CHUNK_FRAMES ? out_frames - done : CHUNK_FRAMES;
+            resample_chunk(cv, chunk, n);
+            out = pack_chunk(cv, chunk, n, out);
+            done += n;
+        }
+
+        // Drop the input that no future output sample can reach anymore
+        uint32_t consumed = (uint32_t) (cv->pos >> 32);
+        if (consumed > cv->hist_frames) {
+            consumed = cv->hist_frames;
+        }
+        uint32_t keep = cv->hist_frames - consumed;
+        SDL_memmove(cv->hist_l, cv->hist_l + consumed, keep * sizeof(int16_t));
+        SDL_memmove(cv->hist_r, cv->hist_r + consumed, keep * sizeof(int16_t));
+        cv->hist_frames = keep;
+        cv->pos -= (uint64_t) consumed << 32;
+    } else {
+        for (uint32_t done = 0; done < out_frames;) {
+            uint32_t n = out_frames - done < CHUNK_FRAMES ? out_frames - done : CHUNK_FRAMES;
+            if (done + n <= in_frames) {
+                out = pack_chunk(cv, in + 2 * done, n, out);
+            } else {
+                uint32_t have = done < in_frames ? in_frames - done : 0;
+                SDL_memcpy(chunk, in + 2 * done, have * 4);
+                SDL_memset(chunk + 2 * have, 0, (n - have) * 4);
+                out = pack_chunk(cv, chunk, n, out);
+            }
+            done += n;
+        }
+    }
+
+    cv->cpu_ns += now_ns() - start;
+    cv->out_frames += out_frames;
+    if (cv->out_frames >= (uint64_t) cv->out_freq * REPORT_SECONDS) {
+        SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+                     "Audio conversion: %.3f ms CPU per second of audio\n",
+                     (double) cv->cpu_ns / 1e6 * cv->out_freq / cv->out_frames);
+        cv->cpu_ns = 0;
+        cv->out_frames = 0;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef M8C_AUDIO_CONVERT_H
+#define M8C_AUDIO_CONVERT_H
+
+#include <SDL.h>
+#include <stdint.h>
+
+// Length of the resampling filter per output sample and number of filter
+// phases between two input samples
+#define AUDIO_CONVERT_TAPS 16
+#define AUDIO_CONVERT_PHASES 128
+
+/* Converts the M8's 44.1kHz S16 stereo stream into whatever SDL actually
+   opened. Input frames are kept deinterleaved so the filter can run over
+   contiguous samples. */
+typedef struct {
+    int in_freq;
+    int out_freq;
+    uint16_t out_format;
+    uint8_t out_channels;
+    int out_frame_size;
+
+    int bypass;   // output spec matches the input, no conversion at all
+    int resample; // sample rates differ
+
+    uint64_t pos;  // read position in the history, 32.32 fixed point
+    uint64_t step; // input frames per output frame, 32.32 fixed point
+    int16_t *hist_l;
+    int16_t *hist_r;
+    uint32_t hist_frames;
+    uint32_t hist_capacity;
+
+    int16_t coeffs[AUDIO_CONVERT_PHASES][AUDIO_CONVERT_TAPS];
+
+    // CPU time spent in audio_convert_process(), reset every report
+    uint64_t cpu_ns;
+    uint64_t out_frames;
+} audio_convert_s;
+
+// Set up a converter from in_freq S16 stereo into the obtained spec. Returns 1
+// on success.
+int audio_convert_init(audio_convert_s *cv, int in_freq, const SDL_AudioSpec *obtained);
+
+void audio_convert_free(audio_convert_s *cv);
+
+// Number of input frames that have to be supplied to produce out_frames
+uint32_t audio_convert_frames_needed(audio_convert_s *cv, uint32_t out_frames);
+
+// Append in_frames S16 stereo frames and write out_frames frames in the output
+// format. Missing input is treated as silence.
+void audio_convert_process(audio_convert_s *cv, const int16_t *in, uint32_t in_frames,
+                           uint8_t *out, uint32_t out_frames);
+
+#endif //M8C_AUDIO_CONVERT_H
@@ -0,0 +1,332 @@
+#include "audio_dsp.h"
+#include <SDL.h>
+#include "SDL2_compat.h"
+
+#include <time.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define AUDIO_DSP_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define AUDIO_DSP_SSE2 1
+#endif
+
+// Gains are Q12, 4096 is unity
+#define GAIN_BITS 12
+#define GAIN_UNITY (1 << GAIN_BITS)
+#define GAIN_MAX_PERCENT 400
+
+// Peaks are held at about -1 dBFS
+#define LIMIT_THRESHOLD 29000
+
+// Above the knee the curve bends over and only approaches the ceiling. It
+// starts at the threshold, so peaks the limiter already holds pass unchanged.
+#define KNEE LIMIT_THRESHOLD
+#define CEILING 32767
+
+// The curve above the knee as a table, one entry per 128 of excess, enough
+// for a full scale sample at the highest gain
+#define KNEE_STEP_BITS 7
+#define KNEE_STEPS 800
+
+// Limiter gain recovers by 1/128th of the remaining distance per block
+#define RELEASE_SHIFT 7
+
+// Frames processed with one gain value
+#define BLOCK_FRAMES 8
+#define BLOCK_FRAMES_SHIFT 3
+#define BLOCK_SAMPLES (BLOCK_FRAMES * 2)
+
+// Seconds of audio between CPU usage reports
+#define REPORT_SECONDS 10
+#define REPORT_FREQ 44100
+
+static int32_t gain = GAIN_UNITY;
+static int limiter_enabled = 0;
+static int downmix_enabled = 0;
+static int32_t envelope = GAIN_UNITY;
+static int16_t knee_table[KNEE_STEPS + 1];
+
+static uint64_t cpu_ns = 0;
+static uint64_t processed_frames = 0;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void audio_dsp_init(int gain_percent, int limiter, int downmix) {
+    if (gain_percent < 0) gain_percent = 0;
+    if (gain_percent > GAIN_MAX_PERCENT) gain_percent = GAIN_MAX_PERCENT;
+
+    gain = gain_percent * GAIN_UNITY / 100;
+    limiter_enabled = limiter;
+    downmix_enabled = downmix;
+    envelope = gain;
+
+    // KNEE + excess * R / (excess + R), R being the room left above the knee
+    for (int i = 0; i <= KNEE_STEPS; i++) {
+        int32_t over = i << KNEE_STEP_BITS;
+        knee_table[i] = (int16_t) (KNEE + (int64_t) over * (CEILING - KNEE) /
+                                          (over + CEILING - KNEE));
+    }
+
+    if (audio_dsp_enabled()) {
+        SDL_Log("Audio processing: gain %d%%, limiter %s, downmix %s\n", gain_percent,
+                limiter ? "on" : "off", downmix ? "on" : "off");
+    }
+}
+
+int audio_dsp_enabled() {
+    return gain != GAIN_UNITY || limiter_enabled || downmix_enabled;
+}
+
+static inline int16_t saturate16(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t) v;
+}
+
+// Replace both channels with (L + R) / 2
+static inline void downmix_block(int16_t *s) {
+#if defined(AUDIO_DSP_NEON)
+    int16x8x2_t lr = vld2q_s16(s);
+    int16x8_t m = vhaddq_s16(lr.val[0], lr.val[1]);
+    lr.val[0] = m;
+    lr.val[1] = m;
+    vst2q_s16(s, lr);
+#elif defined(AUDIO_DSP_SSE2)
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i l = _mm_srai_epi32(_mm_slli_epi32(x, 16), 16);
+        __m128i r = _mm_srai_epi32(x, 16);
+        __m128i m = _mm_srai_epi32(_mm_add_epi32(l, r), 1);
+        m = _mm_or_si128(_mm_and_si128(m, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(m, 16));
+        _mm_storeu_si128((__m128i *) (s + i), m);
+    }
+#else
+    for (int i = 0; i < BLOCK_SAMPLES; i += 2) {
+        int16_t m = (int16_t) (((int32_t) s[i] + s[i + 1]) >> 1);
+        s[i] = m;
+        s[i + 1] = m;
+    }
+#endif
+}
+
+// Largest absolute sample value in the block
+static inline int32_t peak_block(const int16_t *s) {
+#if defined(AUDIO_DSP_NEON)
+    int16x8_t a = vmaxq_s16(vqabsq_s16(vld1q_s16(s)), vqabsq_s16(vld1q_s16(s + 8)));
+    int16x4_t p = vpmax_s16(vget_low_s16(a), vget_high_s16(a));
+    p = vpmax_s16(p, p);
+    p = vpmax_s16(p, p);
+    return vget_lane_s16(p, 0);
+#elif defined(AUDIO_DSP_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i x0 = _mm_loadu_si128((const __m128i *) s);
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (s + 8));
+    __m128i a = _mm_max_epi16(_mm_max_epi16(x0, _mm_subs_epi16(zero, x0)),
+                              _mm_max_epi16(x1, _mm_subs_epi16(zero, x1)));
+    a = _mm_max_epi16(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(1, 0, 3, 2)));
+    a = _mm_max_epi16(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+    a = _mm_max_epi16(a, _mm_srli_epi32(a, 16));
+    return (int16_t) _mm_cvtsi128_si32(a);
+#else
+    int32_t peak = 0;
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        int32_t a = s[i] < 0 ? -(int32_t) s[i] : s[i];
+        if (a > peak) peak = a;
+    }
+    return peak;
+#endif
+}
+
+// Multiply by a Q12 gain with rounding and saturation
+static inline void scale_block(int16_t *s, int32_t g) {
+#if defined(AUDIO_DSP_NEON)
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        int16x8_t x = vld1q_s16(s + i);
+        int32x4_t lo = vmull_n_s16(vget_low_s16(x), (int16_t) g);
+        int32x4_t hi = vmull_n_s16(vget_high_s16(x), (int16_t) g);
+        vst1q_s16(s + i, vcombine_s16(vqrshrn_n_s32(lo, GAIN_BITS), vqrshrn_n_s32(hi, GAIN_BITS)));
+    }
+#elif defined(AUDIO_DSP_SSE2)
+    const __m128i gv = _mm_set1_epi16((int16_t) g);
+    const __m128i round = _mm_set1_epi32(1 << (GAIN_BITS - 1));
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i plo = _mm_mullo_epi16(x, gv);
+        __m128i phi = _mm_mulhi_epi16(x, gv);
+        __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(plo, phi), round), GAIN_BITS);
+        __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(plo, phi), round), GAIN_BITS);
+        _mm_storeu_si128((__m128i *) (s + i), _mm_packs_epi32(lo, hi));
+    }
+#else
+    const int32_t round = 1 << (GAIN_BITS - 1);
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        s[i] = saturate16((s[i] * g + round) >> GAIN_BITS);
+    }
+#endif
+}
+
+/* Instant attack, exponential release. The gain for a block is chosen so
+   that its peak lands on the threshold, which needs no lookahead since the
+   whole block is known before it is scaled. limit_block() ramps to it over
+   the block. */
+static inline int32_t limiter_gain(int32_t peak) {
+    int32_t target = gain;
+    if (peak > 0) {
+        int32_t required = (LIMIT_THRESHOLD << GAIN_BITS) / peak;
+        if (required < target) {
+            target = required;
+        }
+    }
+
+    if (target < envelope) {
+        envelope = target;
+    } else if (target > envelope) {
+        int32_t step = (target - envelope) >> RELEASE_SHIFT;
+        envelope += step > 0 ? step : 1;
+    }
+    return envelope;
+}
+
+/* Unity up to the knee, above it the excess is compressed so the output
+   never quite reaches the ceiling. The slope is 1 at the knee, so there is
+   no corner. Interpolated from knee_table, no division per sample. */
+static inline int16_t soft_knee(int32_t v) {
+    int32_t a = v < 0 ? -v : v;
+    if (a <= KNEE) {
+        return (int16_t) v;
+    }
+    int32_t over = a - KNEE;
+    int32_t i = over >> KNEE_STEP_BITS;
+    if (i >= KNEE_STEPS) {
+        a = knee_table[KNEE_STEPS];
+    } else {
+        int32_t frac = over & ((1 << KNEE_STEP_BITS) - 1);
+        a = knee_table[i] + (((knee_table[i + 1] - knee_table[i]) * frac) >> KNEE_STEP_BITS);
+    }
+    return (int16_t) (v < 0 ? -a : a);
+}
+
+// Only reached for the samples a sudden attack leaves above the threshold
+static void knee_samples(int16_t *s, const int32_t *v, int n) {
+    for (int i = 0; i < n; i++) {
+        s[i] = soft_knee(v[i]);
+    }
+}
+
+/* The gain moves from the last block's value to this one's frame by frame,
+   so it never steps at a block boundary. Samples the ramp leaves above the
+   threshold go through the knee rather than being clipped. */
+static inline void limit_block(int16_t *s, int32_t from, int32_t to) {
+    int16_t g[BLOCK_SAMPLES] __attribute__((aligned(16)));
+    for (int f = 0; f < BLOCK_FRAMES; f++) {
+        g[2 * f] = (int16_t) (from + (((to - from) * (f + 1)) >> BLOCK_FRAMES_SHIFT));
+        g[2 * f + 1] = g[2 * f];
+    }
+
+#if defined(AUDIO_DSP_NEON)
+    const int32x4_t knee = vdupq_n_s32(KNEE);
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        int16x8_t x = vld1q_s16(s + i);
+        int16x8_t gv = vld1q_s16(g + i);
+        int32x4_t lo = vrshrq_n_s32(vmull_s16(vget_low_s16(x), vget_low_s16(gv)), GAIN_BITS);
+        int32x4_t hi = vrshrq_n_s32(vmull_s16(vget_high_s16(x), vget_high_s16(gv)), GAIN_BITS);
+        uint32x4_t over = vorrq_u32(vcgtq_s32(vabsq_s32(lo), knee),
+                                    vcgtq_s32(vabsq_s32(hi), knee));
+        uint32x2_t o = vorr_u32(vget_low_u32(over), vget_high_u32(over));
+        if ((vget_lane_u32(o, 0) | vget_lane_u32(o, 1)) == 0) {
+            vst1q_s16(s + i, vcombine_s16(vmovn_s32(lo), vmovn_s32(hi)));
+        } else {
+            int32_t v[8];
+            vst1q_s32(v, lo);
+            vst1q_s32(v + 4, hi);
+            knee_samples(s + i, v, 8);
+        }
+    }
+#elif defined(AUDIO_DSP_SSE2)
+    const __m128i round = _mm_set1_epi32(1 << (GAIN_BITS - 1));
+    const __m128i knee = _mm_set1_epi32(KNEE);
+    const __m128i neg_knee = _mm_set1_epi32(-KNEE);
+    for (int i = 0; i < BLOCK_SAMPLES; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *) (s + i));
+        __m128i gv = _mm_load_si128((const __m128i *) (g + i));
+        __m128i plo = _mm_mullo_epi16(x, gv);
+        __m128i phi = _mm_mulhi_epi16(x, gv);
+        __m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(plo, phi), round), GAIN_BITS);
+        __m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(plo, phi), round), GAIN_BITS);
+        __m128i over = _mm_or_si128(
+                _mm_or_si128(_mm_cmpgt_epi32(lo, knee), _mm_cmplt_epi32(lo, neg_knee)),
+                _mm_or_si128(_mm_cmpgt_epi32(hi, knee), _mm_cmplt_epi32(hi, neg_knee)));
+        if (_mm_movemask_epi8(over) == 0) {
+            _mm_storeu_si128((__m128i *) (s + i), _mm_packs_epi32(lo, hi));
+        } else {
+            int32_t v[8];
+            _mm_storeu_si128((__m128i *) v, lo);
+            _mm_storeu_si128((__m128i *) (v + 4), hi);
+            knee_samples(s + i, v, 8);
+        }
+    }
+#else
+    const int32_t round = 1 << (GAIN_BITS - 1);
+    int32_t v[BLOCK_SAMPLES];
+    for (int i = 0; i < BLOCK_SAMPLES; i++) {
+        v[i] = (s[i] * g[i] + round) >> GAIN_BITS;
+    }
+    knee_samples(s, v, BLOCK_SAMPLES);
+#endif
+}
+
+static void process_block(int16_t *s) {
+    if (downmix_enabled) {
+        downmix_block(s);
+    }
+
+    int32_t g = gain;
+    if (limiter_enabled) {
+        int32_t from = envelope;
+        limit_block(s, from, limiter_gain(peak_block(s)));
+        return;
+    }
+
+    if (g != GAIN_UNITY) {
+        scale_block(s, g);
+    }
+}
+
+void audio_dsp_process(int16_t *samples, uint32_t frames) {
+    if (!audio_dsp_enabled()) {
+        return;
+    }
+
+    uint64_t start = now_ns();
+
+    uint32_t blocks = frames / BLOCK_FRAMES;
+    for (uint32_t b = 0; b < blocks; b++) {
+        process_block(samples + b * BLOCK_SAMPLES);
+    }
+
+    // Pad a partial block with silence, it does not raise the peak
+    uint32_t rest = frames % BLOCK_FRAMES;
+    if (rest > 0) {
+        int16_t tail[BLOCK_SAMPLES] = {0};
+        int16_t *s = samples + blocks * BLOCK_SAMPLES;
+        SDL_memcpy(tail, s, rest * 2 * sizeof(int16_t));
+        process_block(tail);
+        SDL_memcpy(s, tail, rest * 2 * sizeof(int16_t));
+    }
+
+    cpu_ns += now_ns() - start;
+    processed_frames += frames;
+    if (processed_frames >= REPORT_FREQ * REPORT_SECONDS) {
+        SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION,
+                     "Audio processing: %.3f ms CPU per second of audio\n",
+                     (double) cpu_ns / 1e6 * REPORT_FREQ / processed_frames);
+        cpu_ns = 0;
+        processed_frames = 0;
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef M8C_AUDIO_DSP_H
+#define M8C_AUDIO_DSP_H
+
+#include <stdint.h>
+
+// Set up the output processing. gain_percent is clamped to 0-400.
+void audio_dsp_init(int gain_percent, int limiter, int downmix);
+
+// Returns 1 if audio_dsp_process() would change the signal
+int audio_dsp_enabled();
+
+// Process interleaved S16 stereo frames in place
+void audio_dsp_process(int16_t *samples, uint32_t frames);
+
+#endif //M8C_AUDIO_DSP_H
@@ -6,6 +6,8 @@
 
 #include "command.h"
 #include "render.h"
+#include "protocol_profile.h"
+#include "stats.h"
 #include "SDL2_compat.h"
 
 // Convert 2 little-endian 8bit bytes to a 16bit integer
@@ -28,14 +30,27 @@ enum m8_command_bytes {
 };
 
 static inline void dump_packet(uint32_t size, uint8_t *recv_buf) {
-    for (uint16_t a = 0; a < size; a++) {
-        SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "0x%02X ", recv_buf[a]);
+#ifdef DEBUG_MSG
+    // One message per packet, with as many bytes as a log string holds
+    char hex[LOG_MAX_STRING + 1];
+    int len = 0;
+    uint32_t shown = 0;
+    for (; shown < size && len + 3 <= LOG_MAX_STRING; shown++) {
+        len += snprintf(hex + len, sizeof(hex) - len, "%02X ", recv_buf[shown]);
     }
-    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "\n");
+    hex[len] = '\0';
+    if (shown < size) {
+        SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "%u bytes, first %u: %s", size, shown, hex);
+    } else {
+        SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "%u bytes: %s", size, hex);
+    }
+#endif
 }
 
 int process_command(uint8_t *data, uint32_t size) {
 
+    protocol_profile_packet(data, size);
+
     uint8_t recv_buf[size + 1];
 
     memcpy(recv_buf, data, size);
@@ -51,6 +66,7 @@ int process_command(uint8_t *data, uint32_t size) {
                         "Invalid draw rectangle packet: expected length %d, got %d\n",
                         draw_rectangle_command_datalength, size);
                 dump_packet(size, recv_buf);
+                stats_add(STAT_CMD_INVALID, 1);
                 return 0;
                 break;
             } else {
@@ -61,6 +77,7 @@ int process_command(uint8_t *data, uint32_t size) {
                         {recv_buf[9],              recv_buf[10], recv_buf[11]}};           // color r/g/b
 
                 draw_rectangle(&rectcmd);
+                stats_add(STAT_CMD_RECT, 1);
                 return 1;
             }
 
@@ -74,6 +91,7 @@ int process_command(uint8_t *data, uint32_t size) {
                         "Invalid draw character packet: expected length %d, got %d\n",
                         draw_character_command_datalength, size);
                 dump_packet(size, recv_buf);
+                stats_add(STAT_CMD_INVALID, 1);
                 return 0;
                 break;
             } else {
@@ -83,6 +101,7 @@ int process_command(uint8_t *data, uint32_t size) {
                         {recv_buf[6], recv_buf[7], recv_buf[8]},    // foreground r/g/b
                         {recv_buf[9], recv_buf[10], recv_buf[11]}}; // background r/g/b
                 draw_character(&charcmd);
+                stats_add(STAT_CMD_CHAR, 1);
                 return 1;
             }
 
@@ -100,6 +119,7 @@ int process_command(uint8_t *data, uint32_t size) {
                         draw_oscilloscope_waveform_command_mindatalength,
                         draw_oscilloscope_waveform_command_maxdatalength, size);
                 dump_packet(size, recv_buf);
+                stats_add(STAT_CMD_INVALID, 1);
                 return 0;
                 break;
             } else {
@@ -113,6 +133,7 @@ int process_command(uint8_t *data, uint32_t size) {
                 osccmd.waveform_size = size - 4;
 
                 draw_waveform(&osccmd);
+                stats_add(STAT_CMD_WAVEFORM, 1);
                 return 1;
             }
 
@@ -126,11 +147,13 @@ int process_command(uint8_t *data, uint32_t size) {
                         "got %d\n",
                         joypad_keypressedstate_command_datalength, size);
                 dump_packet(size, recv_buf);
+                stats_add(STAT_CMD_INVALID, 1);
                 return 0;
                 break;
             }
 
             // nothing is done with joypad key pressed packets for now
+            stats_add(STAT_CMD_JOYPAD, 1);
             return 1;
             break;
         }
@@ -142,6 +165,7 @@ int process_command(uint8_t *data, uint32_t size) {
                              "got %d\n",
                              system_info_command_datalength, size);
                 dump_packet(size, recv_buf);
+                stats_add(STAT_CMD_INVALID, 1);
                 break;
             }
 
@@ -160,6 +184,7 @@ int process_command(uint8_t *data, uint32_t size) {
             } else {
                 set_large_mode(0);
             }
+            stats_add(STAT_CMD_SYSTEM_INFO, 1);
             return 1;
             break;
         }
@@ -168,6 +193,7 @@ int process_command(uint8_t *data, uint32_t size) {
 
             SDL_LogError(SDL_LOG_CATEGORY_ERROR, "Invalid packet\n");
             dump_packet(size, recv_buf);
+            stats_add(STAT_CMD_INVALID, 1);
             return 0;
             break;
     }
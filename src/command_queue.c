@@ -0,0 +1,76 @@
+#include "command_queue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+static int writeCursor = 0;
+static int readCursor = 0;
+static uint8_t **command = NULL;
+static uint32_t *command_sizes = NULL;
+static uint32_t overflows = 0;
+
+int command_queue_init() {
+    command = calloc(COMMAND_QUEUE_SIZE, sizeof(uint8_t *));
+    command_sizes = calloc(COMMAND_QUEUE_SIZE, sizeof(uint32_t));
+    writeCursor = 0;
+    readCursor = 0;
+    overflows = 0;
+    return command != NULL && command_sizes != NULL;
+}
+
+void command_queue_destroy() {
+    if (command != NULL) {
+        for (int i = 0; i < COMMAND_QUEUE_SIZE; i++) {
+            free(command[i]);
+        }
+    }
+    free(command);
+    free(command_sizes);
+    command = NULL;
+    command_sizes = NULL;
+}
+
+int pullCommand(uint8_t *data, uint32_t size) {
+
+    // The main thread may still be drawing the packet it popped last, one
+    // slot is kept back for it. A full queue drops the new packet.
+    int waiting = writeCursor - __atomic_load_n(&readCursor, __ATOMIC_ACQUIRE);
+    if (waiting >= COMMAND_QUEUE_SIZE - 1) {
+        __atomic_add_fetch(&overflows, 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    stats_max(STAT_QUEUE_HIGH_WATER, waiting + 1);
+
+    uint8_t *recv_buf = malloc(size * sizeof(uint8_t));
+    if (recv_buf == NULL) {
+        return 0;
+    }
+    memcpy(recv_buf, data, size);
+
+    free(command[writeCursor % COMMAND_QUEUE_SIZE]);
+    command[writeCursor % COMMAND_QUEUE_SIZE] = recv_buf;
+
+    command_sizes[writeCursor % COMMAND_QUEUE_SIZE] = size;
+    __atomic_store_n(&writeCursor, writeCursor + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int popCommand(uint8_t **data, uint32_t *size) {
+    int compare = __atomic_load_n(&writeCursor, __ATOMIC_ACQUIRE) - readCursor;
+    if (compare == 0) return 0;
+    *data = command[readCursor % COMMAND_QUEUE_SIZE];
+    *size = command_sizes[readCursor % COMMAND_QUEUE_SIZE];
+    __atomic_store_n(&readCursor, readCursor + 1, __ATOMIC_RELEASE);
+    return compare;
+}
+
+uint32_t command_queue_overflows() {
+    return __atomic_load_n(&overflows, __ATOMIC_RELAXED);
+}
+
+int command_queue_depth() {
+    return __atomic_load_n(&writeCursor, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&readCursor, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,26 @@
+#ifndef M8C_COMMAND_QUEUE_H
+#define M8C_COMMAND_QUEUE_H
+
+#include <stdint.h>
+
+// Packets that can wait for the main thread before new ones are dropped
+#define COMMAND_QUEUE_SIZE 4096
+
+/* Carries complete SLIP packets from the USB thread, which pulls them in,
+   to the main thread, which pops and draws them. */
+int command_queue_init();
+void command_queue_destroy();
+
+// SLIP recv_message callback, copies the packet into the queue
+int pullCommand(uint8_t *data, uint32_t size);
+
+// Returns the number of packets that were waiting, 0 when the queue is empty
+int popCommand(uint8_t **data, uint32_t *size);
+
+// Packets dropped because the main thread fell behind
+uint32_t command_queue_overflows();
+
+// Packets waiting to be drawn, from any thread
+int command_queue_depth();
+
+#endif //M8C_COMMAND_QUEUE_H
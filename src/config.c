@@ -6,6 +6,7 @@
 #include "SDL2_compat.h"
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <SDL_keysym.h>
 #include <SDL_rwops.h>
@@ -31,11 +32,26 @@ config_params_s init_config() {
     c.init_use_gpu = 1;    // default to use hardware acceleration
     c.idle_ms = 10;        // default to high performance
     c.wait_for_device = 1; // default to exit if device disconnected
+    c.fast_reconnect = 1;  // keep audio output and the last frame while the M8 is away
+    c.screensaver_fps = 20;       // cube frame rate while waiting for the M8
+    c.screensaver_static_s = 60;  // freeze the cube after this long, 0 keeps it spinning
+    c.show_hud = 0;        // performance figures in the bottom left corner
     c.wait_packets = 1024; // default zero-byte attempts to disconnect (about 2
     // sec for default idle_ms)
     c.audio_enabled = 1;   // route M8 audio to default output
     c.audio_buffer_size = 1024; // requested audio buffer size in samples
     c.audio_device_name = NULL; // Use this device, leave NULL to use the default output device
+    c.audio_gain = 100;         // output volume in percent, up to 400
+    c.audio_limiter = 0;        // soft limit peaks, useful with audio_gain above 100
+    c.audio_downmix = 0;        // sum stereo to mono for a single speaker
+    c.audio_silence_hold_ms = 3000; // idle the output after this much silence, 0 = never
+
+    c.thread_render_priority = 0; // 0 = as started, 1-99 = SCHED_FIFO priority
+    c.thread_render_affinity = 0; // 0 = as started, otherwise a bitmask of CPUs
+    c.thread_usb_priority = 0;
+    c.thread_usb_affinity = 0;
+    c.thread_audio_priority = 0;
+    c.thread_audio_affinity = 0;
 
     c.key_up = SDLK_w;
     c.key_left = SDLK_q;
@@ -51,6 +67,37 @@ config_params_s init_config() {
     c.key_edit_alt = SDLK_x;
     c.key_delete = SDLK_DELETE;
     c.key_reset = SDLK_u;
+    c.key_capture = SDLK_F12;
+    c.key_hud = SDLK_F11;
+
+    // Linux input event codes, see linux/input-event-codes.h
+    c.evdev_device = NULL; // "auto", a /dev/input/event* node or a recording, NULL = off
+    c.button_up = 103;     // KEY_UP
+    c.button_left = 105;   // KEY_LEFT
+    c.button_down = 108;   // KEY_DOWN
+    c.button_right = 106;  // KEY_RIGHT
+    c.button_select = 314; // BTN_SELECT
+    c.button_start = 315;  // BTN_START
+    c.button_opt = 304;    // BTN_SOUTH
+    c.button_edit = 305;   // BTN_EAST
+    c.button_reset = 316;  // BTN_MODE
+    c.button_quit = 0;     // unbound
+    c.button_hud = 0;      // unbound
+
+    c.midi_device = NULL; // raw MIDI port, FIFO or file to play as keyjazz, NULL = off
+    c.midi_channel = 0;   // 0 = all channels, 1-16 = only this channel
+
+    c.latency_probe = 0; // log button press to screen latency percentiles
+    c.input_script = NULL; // script file or FIFO to read input commands from, NULL = off
+    c.verify_repaint = 0; // compare the retained screen model with every frame
+    c.trace_path = NULL; // Chrome trace-event JSON written on exit, NULL = off
+    c.control_socket = NULL; // UNIX socket serving counters and commands, NULL = off
+    c.protocol_profile = 0; // log the command mix and redundant packets on exit
+    c.flight_recorder = "m8c-flight.bin"; // ring of recent USB traffic, NULL = off
+    c.flight_recorder_kb = 4096;
+    c.watchdog_ms = 2000; // log threads stalled this long, 0 = off
+    c.watchdog_action = "log"; // then also "resync" the display or "reconnect" the M8
+    c.log_level = LOG_INFO; // debug messages need a build with DEBUG_MSG
 
     return c;
 }
@@ -66,7 +113,7 @@ void write_config(config_params_s *conf) {
 
     SDL_Log("Writing config file to %s", config_path);
 
-    const unsigned int INI_LINE_COUNT = 25;
+    const unsigned int INI_LINE_COUNT = 70;
     const unsigned int LINELEN = 50;
 
     // Entries for the config file
@@ -80,6 +127,14 @@ void write_config(config_params_s *conf) {
     snprintf(ini_values[initPointer++], LINELEN, "idle_ms=%d\n", conf->idle_ms);
     snprintf(ini_values[initPointer++], LINELEN, "wait_for_device=%s\n",
              conf->wait_for_device ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "fast_reconnect=%s\n",
+             conf->fast_reconnect ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "screensaver_fps=%d\n",
+             conf->screensaver_fps);
+    snprintf(ini_values[initPointer++], LINELEN, "screensaver_static_s=%d\n",
+             conf->screensaver_static_s);
+    snprintf(ini_values[initPointer++], LINELEN, "show_hud=%s\n",
+             conf->show_hud ? "true" : "false");
     snprintf(ini_values[initPointer++], LINELEN, "wait_packets=%d\n",
              conf->wait_packets);
     snprintf(ini_values[initPointer++], LINELEN, "[audio]\n");
@@ -89,6 +144,27 @@ void write_config(config_params_s *conf) {
              conf->audio_buffer_size);
     snprintf(ini_values[initPointer++], LINELEN, "audio_device_name=%s\n",
              conf->audio_device_name ? conf->audio_device_name : "Default");
+    snprintf(ini_values[initPointer++], LINELEN, "audio_gain=%d\n",
+             conf->audio_gain);
+    snprintf(ini_values[initPointer++], LINELEN, "audio_limiter=%s\n",
+             conf->audio_limiter ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "audio_downmix=%s\n",
+             conf->audio_downmix ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "audio_silence_hold_ms=%d\n",
+             conf->audio_silence_hold_ms);
+    snprintf(ini_values[initPointer++], LINELEN, "[threads]\n");
+    snprintf(ini_values[initPointer++], LINELEN, "render_priority=%d\n",
+             conf->thread_render_priority);
+    snprintf(ini_values[initPointer++], LINELEN, "render_affinity=0x%X\n",
+             conf->thread_render_affinity);
+    snprintf(ini_values[initPointer++], LINELEN, "usb_priority=%d\n",
+             conf->thread_usb_priority);
+    snprintf(ini_values[initPointer++], LINELEN, "usb_affinity=0x%X\n",
+             conf->thread_usb_affinity);
+    snprintf(ini_values[initPointer++], LINELEN, "audio_priority=%d\n",
+             conf->thread_audio_priority);
+    snprintf(ini_values[initPointer++], LINELEN, "audio_affinity=0x%X\n",
+             conf->thread_audio_affinity);
     snprintf(ini_values[initPointer++], LINELEN, "[keyboard]\n");
     snprintf(ini_values[initPointer++], LINELEN, "key_up=%d\n", conf->key_up);
     snprintf(ini_values[initPointer++], LINELEN, "key_left=%d\n", conf->key_left);
@@ -113,6 +189,62 @@ void write_config(config_params_s *conf) {
              conf->key_delete);
     snprintf(ini_values[initPointer++], LINELEN, "key_reset=%d\n",
              conf->key_reset);
+    snprintf(ini_values[initPointer++], LINELEN, "key_capture=%d\n",
+             conf->key_capture);
+    snprintf(ini_values[initPointer++], LINELEN, "key_hud=%d\n",
+             conf->key_hud);
+    snprintf(ini_values[initPointer++], LINELEN, "[gamepad]\n");
+    snprintf(ini_values[initPointer++], LINELEN, "evdev_device=%s\n",
+             conf->evdev_device ? conf->evdev_device : "none");
+    snprintf(ini_values[initPointer++], LINELEN, "button_up=%d\n",
+             conf->button_up);
+    snprintf(ini_values[initPointer++], LINELEN, "button_left=%d\n",
+             conf->button_left);
+    snprintf(ini_values[initPointer++], LINELEN, "button_down=%d\n",
+             conf->button_down);
+    snprintf(ini_values[initPointer++], LINELEN, "button_right=%d\n",
+             conf->button_right);
+    snprintf(ini_values[initPointer++], LINELEN, "button_select=%d\n",
+             conf->button_select);
+    snprintf(ini_values[initPointer++], LINELEN, "button_start=%d\n",
+             conf->button_start);
+    snprintf(ini_values[initPointer++], LINELEN, "button_opt=%d\n",
+             conf->button_opt);
+    snprintf(ini_values[initPointer++], LINELEN, "button_edit=%d\n",
+             conf->button_edit);
+    snprintf(ini_values[initPointer++], LINELEN, "button_reset=%d\n",
+             conf->button_reset);
+    snprintf(ini_values[initPointer++], LINELEN, "button_quit=%d\n",
+             conf->button_quit);
+    snprintf(ini_values[initPointer++], LINELEN, "button_hud=%d\n",
+             conf->button_hud);
+    snprintf(ini_values[initPointer++], LINELEN, "[midi]\n");
+    snprintf(ini_values[initPointer++], LINELEN, "midi_device=%s\n",
+             conf->midi_device ? conf->midi_device : "none");
+    snprintf(ini_values[initPointer++], LINELEN, "midi_channel=%d\n",
+             conf->midi_channel);
+    snprintf(ini_values[initPointer++], LINELEN, "[debug]\n");
+    snprintf(ini_values[initPointer++], LINELEN, "latency_probe=%s\n",
+             conf->latency_probe ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "input_script=%s\n",
+             conf->input_script ? conf->input_script : "none");
+    snprintf(ini_values[initPointer++], LINELEN, "verify_repaint=%s\n",
+             conf->verify_repaint ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "trace=%s\n",
+             conf->trace_path ? conf->trace_path : "none");
+    snprintf(ini_values[initPointer++], LINELEN, "control_socket=%s\n",
+             conf->control_socket ? conf->control_socket : "none");
+    snprintf(ini_values[initPointer++], LINELEN, "protocol_profile=%s\n",
+             conf->protocol_profile ? "true" : "false");
+    snprintf(ini_values[initPointer++], LINELEN, "flight_recorder=%s\n",
+             conf->flight_recorder ? conf->flight_recorder : "none");
+    snprintf(ini_values[initPointer++], LINELEN, "flight_recorder_kb=%d\n",
+             conf->flight_recorder_kb);
+    snprintf(ini_values[initPointer++], LINELEN, "watchdog_ms=%d\n", conf->watchdog_ms);
+    snprintf(ini_values[initPointer++], LINELEN, "watchdog_action=%s\n",
+             conf->watchdog_action);
+    snprintf(ini_values[initPointer++], LINELEN, "log_level=%s\n",
+             log_level_name(conf->log_level));
 
     // Ensure we aren't writing off the end of the array
     assert(initPointer == INI_LINE_COUNT);
@@ -153,6 +285,10 @@ void read_config(config_params_s *conf) {
     read_audio_config(ini, conf);
     read_graphics_config(ini, conf);
     read_key_config(ini, conf);
+    read_thread_config(ini, conf);
+    read_gamepad_config(ini, conf);
+    read_midi_config(ini, conf);
+    read_debug_config(ini, conf);
 
     // Frees the mem used for the config
     ini_free(ini);
@@ -167,6 +303,10 @@ void read_audio_config(ini_t *ini, config_params_s *conf) {
             ini_get(ini, "audio", "audio_buffer_size");
     const char *param_audio_device_name =
             ini_get(ini, "audio", "audio_device_name");
+    const char *param_audio_gain = ini_get(ini, "audio", "audio_gain");
+    const char *param_audio_limiter = ini_get(ini, "audio", "audio_limiter");
+    const char *param_audio_downmix = ini_get(ini, "audio", "audio_downmix");
+    const char *param_audio_silence_hold_ms = ini_get(ini, "audio", "audio_silence_hold_ms");
 
     if (param_audio_enabled != NULL) {
         if (strcmpci(param_audio_enabled, "true") == 0) {
@@ -183,6 +323,22 @@ void read_audio_config(ini_t *ini, config_params_s *conf) {
     if (param_audio_buffer_size != NULL) {
         conf->audio_buffer_size = SDL_atoi(param_audio_buffer_size);
     }
+
+    if (param_audio_gain != NULL) {
+        conf->audio_gain = SDL_atoi(param_audio_gain);
+    }
+
+    if (param_audio_limiter != NULL) {
+        conf->audio_limiter = strcmpci(param_audio_limiter, "true") == 0;
+    }
+
+    if (param_audio_downmix != NULL) {
+        conf->audio_downmix = strcmpci(param_audio_downmix, "true") == 0;
+    }
+
+    if (param_audio_silence_hold_ms != NULL) {
+        conf->audio_silence_hold_ms = SDL_atoi(param_audio_silence_hold_ms);
+    }
 }
 
 void read_graphics_config(ini_t *ini, config_params_s *conf) {
@@ -190,7 +346,11 @@ void read_graphics_config(ini_t *ini, config_params_s *conf) {
     const char *param_gpu = ini_get(ini, "graphics", "use_gpu");
     const char *idle_ms = ini_get(ini, "graphics", "idle_ms");
     const char *param_wait = ini_get(ini, "graphics", "wait_for_device");
+    const char *param_fast_reconnect = ini_get(ini, "graphics", "fast_reconnect");
+    const char *screensaver_fps = ini_get(ini, "graphics", "screensaver_fps");
+    const char *screensaver_static_s = ini_get(ini, "graphics", "screensaver_static_s");
     const char *wait_packets = ini_get(ini, "graphics", "wait_packets");
+    const char *show_hud = ini_get(ini, "graphics", "show_hud");
 
     if (strcmpci(param_fs, "true") == 0) {
         conf->init_fullscreen = 1;
@@ -214,8 +374,21 @@ void read_graphics_config(ini_t *ini, config_params_s *conf) {
             conf->wait_for_device = 0;
         }
     }
+    if (param_fast_reconnect != NULL) {
+        conf->fast_reconnect = strcmpci(param_fast_reconnect, "true") == 0;
+    }
+    if (screensaver_fps != NULL) {
+        conf->screensaver_fps = SDL_atoi(screensaver_fps);
+        if (conf->screensaver_fps < 1) {
+            conf->screensaver_fps = 1;
+        }
+    }
+    if (screensaver_static_s != NULL)
+        conf->screensaver_static_s = SDL_atoi(screensaver_static_s);
     if (wait_packets != NULL)
         conf->wait_packets = SDL_atoi(wait_packets);
+    if (show_hud != NULL)
+        conf->show_hud = strcmpci(show_hud, "true") == 0;
 }
 
 void read_key_config(ini_t *ini, config_params_s *conf) {
@@ -235,6 +408,8 @@ void read_key_config(ini_t *ini, config_params_s *conf) {
     const char *key_edit_alt = ini_get(ini, "keyboard", "key_edit_alt");
     const char *key_delete = ini_get(ini, "keyboard", "key_delete");
     const char *key_reset = ini_get(ini, "keyboard", "key_reset");
+    const char *key_capture = ini_get(ini, "keyboard", "key_capture");
+    const char *key_hud = ini_get(ini, "keyboard", "key_hud");
 
     if (key_up)
         conf->key_up = SDL_atoi(key_up);
@@ -264,5 +439,147 @@ void read_key_config(ini_t *ini, config_params_s *conf) {
         conf->key_delete = SDL_atoi(key_delete);
     if (key_reset)
         conf->key_reset = SDL_atoi(key_reset);
+    if (key_capture)
+        conf->key_capture = SDL_atoi(key_capture);
+    if (key_hud)
+        conf->key_hud = SDL_atoi(key_hud);
 }
 
+void read_thread_config(ini_t *ini, config_params_s *conf) {
+    const char *render_priority = ini_get(ini, "threads", "render_priority");
+    const char *render_affinity = ini_get(ini, "threads", "render_affinity");
+    const char *usb_priority = ini_get(ini, "threads", "usb_priority");
+    const char *usb_affinity = ini_get(ini, "threads", "usb_affinity");
+    const char *audio_priority = ini_get(ini, "threads", "audio_priority");
+    const char *audio_affinity = ini_get(ini, "threads", "audio_affinity");
+
+    // Affinity masks are accepted both as decimal and as 0x-prefixed hex
+    if (render_priority)
+        conf->thread_render_priority = SDL_atoi(render_priority);
+    if (render_affinity)
+        conf->thread_render_affinity = (int) strtol(render_affinity, NULL, 0);
+    if (usb_priority)
+        conf->thread_usb_priority = SDL_atoi(usb_priority);
+    if (usb_affinity)
+        conf->thread_usb_affinity = (int) strtol(usb_affinity, NULL, 0);
+    if (audio_priority)
+        conf->thread_audio_priority = SDL_atoi(audio_priority);
+    if (audio_affinity)
+        conf->thread_audio_affinity = (int) strtol(audio_affinity, NULL, 0);
+}
+
+void read_gamepad_config(ini_t *ini, config_params_s *conf) {
+    const char *evdev_device = ini_get(ini, "gamepad", "evdev_device");
+    const char *button_up = ini_get(ini, "gamepad", "button_up");
+    const char *button_left = ini_get(ini, "gamepad", "button_left");
+    const char *button_down = ini_get(ini, "gamepad", "button_down");
+    const char *button_right = ini_get(ini, "gamepad", "button_right");
+    const char *button_select = ini_get(ini, "gamepad", "button_select");
+    const char *button_start = ini_get(ini, "gamepad", "button_start");
+    const char *button_opt = ini_get(ini, "gamepad", "button_opt");
+    const char *button_edit = ini_get(ini, "gamepad", "button_edit");
+    const char *button_reset = ini_get(ini, "gamepad", "button_reset");
+    const char *button_quit = ini_get(ini, "gamepad", "button_quit");
+    const char *button_hud = ini_get(ini, "gamepad", "button_hud");
+
+    if (evdev_device != NULL && strcmpci(evdev_device, "none") != 0) {
+        conf->evdev_device = SDL_strdup(evdev_device);
+    }
+    if (button_up)
+        conf->button_up = SDL_atoi(button_up);
+    if (button_left)
+        conf->button_left = SDL_atoi(button_left);
+    if (button_down)
+        conf->button_down = SDL_atoi(button_down);
+    if (button_right)
+        conf->button_right = SDL_atoi(button_right);
+    if (button_select)
+        conf->button_select = SDL_atoi(button_select);
+    if (button_start)
+        conf->button_start = SDL_atoi(button_start);
+    if (button_opt)
+        conf->button_opt = SDL_atoi(button_opt);
+    if (button_edit)
+        conf->button_edit = SDL_atoi(button_edit);
+    if (button_reset)
+        conf->button_reset = SDL_atoi(button_reset);
+    if (button_quit)
+        conf->button_quit = SDL_atoi(button_quit);
+    if (button_hud)
+        conf->button_hud = SDL_atoi(button_hud);
+}
+
+void read_midi_config(ini_t *ini, config_params_s *conf) {
+    const char *midi_device = ini_get(ini, "midi", "midi_device");
+    const char *midi_channel = ini_get(ini, "midi", "midi_channel");
+
+    if (midi_device != NULL && strcmpci(midi_device, "none") != 0) {
+        conf->midi_device = SDL_strdup(midi_device);
+    }
+    if (midi_channel) {
+        conf->midi_channel = SDL_atoi(midi_channel);
+        if (conf->midi_channel < 0 || conf->midi_channel > 16)
+            conf->midi_channel = 0;
+    }
+}
+
+void read_debug_config(ini_t *ini, config_params_s *conf) {
+    const char *latency_probe = ini_get(ini, "debug", "latency_probe");
+    const char *input_script = ini_get(ini, "debug", "input_script");
+    const char *verify_repaint = ini_get(ini, "debug", "verify_repaint");
+    const char *trace = ini_get(ini, "debug", "trace");
+    const char *control_socket = ini_get(ini, "debug", "control_socket");
+    const char *protocol_profile = ini_get(ini, "debug", "protocol_profile");
+    const char *flight_recorder = ini_get(ini, "debug", "flight_recorder");
+    const char *flight_recorder_kb = ini_get(ini, "debug", "flight_recorder_kb");
+    const char *watchdog_ms = ini_get(ini, "debug", "watchdog_ms");
+    const char *watchdog_action = ini_get(ini, "debug", "watchdog_action");
+    const char *log_level = ini_get(ini, "debug", "log_level");
+
+    if (latency_probe != NULL) {
+        conf->latency_probe = strcmpci(latency_probe, "true") == 0;
+    }
+
+    if (input_script != NULL && strcmpci(input_script, "none") != 0) {
+        conf->input_script = SDL_strdup(input_script);
+    }
+
+    if (verify_repaint != NULL) {
+        conf->verify_repaint = strcmpci(verify_repaint, "true") == 0;
+    }
+
+    if (trace != NULL && strcmpci(trace, "none") != 0) {
+        conf->trace_path = SDL_strdup(trace);
+    }
+
+    if (control_socket != NULL && strcmpci(control_socket, "none") != 0) {
+        conf->control_socket = SDL_strdup(control_socket);
+    }
+
+    if (protocol_profile != NULL) {
+        conf->protocol_profile = strcmpci(protocol_profile, "true") == 0;
+    }
+
+    if (flight_recorder != NULL) {
+        conf->flight_recorder =
+                strcmpci(flight_recorder, "none") == 0 ? NULL : SDL_strdup(flight_recorder);
+    }
+
+    if (flight_recorder_kb != NULL) {
+        conf->flight_recorder_kb = SDL_atoi(flight_recorder_kb);
+    }
+
+    if (watchdog_ms != NULL) {
+        conf->watchdog_ms = SDL_atoi(watchdog_ms);
+    }
+
+    if (watchdog_action != NULL) {
+        conf->watchdog_action = strcmpci(watchdog_action, "resync") == 0      ? "resync"
+                                : strcmpci(watchdog_action, "reconnect") == 0 ? "reconnect"
+                                                                              : "log";
+    }
+
+    if (log_level != NULL) {
+        conf->log_level = log_level_from_name(log_level);
+    }
+}
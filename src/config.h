@@ -12,10 +12,25 @@ typedef struct config_params_s {
     int init_use_gpu;
     int idle_ms;
     int wait_for_device;
+    int fast_reconnect;
+    int screensaver_fps;
+    int screensaver_static_s;
+    int show_hud;
     int wait_packets;
     int audio_enabled;
     int audio_buffer_size;
     const char *audio_device_name;
+    int audio_gain;
+    int audio_limiter;
+    int audio_downmix;
+    int audio_silence_hold_ms;
+
+    int thread_render_priority;
+    int thread_render_affinity;
+    int thread_usb_priority;
+    int thread_usb_affinity;
+    int thread_audio_priority;
+    int thread_audio_affinity;
 
     int key_up;
     int key_left;
@@ -31,6 +46,36 @@ typedef struct config_params_s {
     int key_edit_alt;
     int key_delete;
     int key_reset;
+    int key_capture;
+    int key_hud;
+
+    const char *evdev_device;
+    int button_up;
+    int button_left;
+    int button_down;
+    int button_right;
+    int button_select;
+    int button_start;
+    int button_opt;
+    int button_edit;
+    int button_reset;
+    int button_quit;
+    int button_hud;
+
+    const char *midi_device;
+    int midi_channel;
+
+    int latency_probe;
+    const char *input_script;
+    int verify_repaint;
+    const char *trace_path;
+    const char *control_socket;
+    int protocol_profile;
+    const char *flight_recorder;
+    int flight_recorder_kb;
+    int watchdog_ms;
+    const char *watchdog_action;
+    int log_level;
 
 } config_params_s;
 
@@ -45,4 +90,12 @@ void read_graphics_config(ini_t *config, config_params_s *conf);
 
 void read_key_config(ini_t *config, config_params_s *conf);
 
+void read_thread_config(ini_t *config, config_params_s *conf);
+
+void read_gamepad_config(ini_t *config, config_params_s *conf);
+
+void read_midi_config(ini_t *config, config_params_s *conf);
+
+void read_debug_config(ini_t *config, config_params_s *conf);
+
 #endif
@@ -0,0 +1,231 @@
+#include "control.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "audio.h"
+#include "command_queue.h"
+#include "input.h"
+#include "stats.h"
+#include "trace.h"
+#include "usb.h"
+#include "SDL2_compat.h"
+
+#define POLL_TIMEOUT_MS 200
+#define LINE_SIZE 256
+#define REPLY_SIZE 8192
+
+static int listen_fd = -1;
+static int do_exit = 0;
+static SDL_Thread *control_thread = NULL;
+static char socket_path[108];
+static uint32_t ticks_start = 0;
+
+// Only the control thread builds replies
+static char reply[REPLY_SIZE];
+static int reply_len = 0;
+static int reply_json = 0;
+static int reply_fields = 0;
+
+static void append(const char *format, ...) {
+    if (reply_len >= REPLY_SIZE) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(reply + reply_len, REPLY_SIZE - reply_len, format, args);
+    va_end(args);
+    if (n > 0) {
+        reply_len = reply_len + n < REPLY_SIZE ? reply_len + n : REPLY_SIZE - 1;
+    }
+}
+
+static void put(const char *key, uint64_t value) {
+    if (reply_json) {
+        append("%s\"%s\":%llu", reply_fields++ ? "," : "{", key, (unsigned long long) value);
+    } else {
+        append("%s=%llu\n", key, (unsigned long long) value);
+    }
+}
+
+static void format_stats(int json) {
+    reply_json = json;
+    reply_fields = 0;
+
+    put("uptime_ms", SDL_GetTicks() - ticks_start);
+    uint32_t values[STAT_COUNT];
+    for (int i = 0; i < STAT_COUNT; i++) {
+        values[i] = __atomic_load_n(&stats[i], __ATOMIC_RELAXED);
+        put(stats_name(i), values[i]);
+    }
+    put("frame_us_avg",
+        values[STAT_FRAMES] > 0 ? values[STAT_FRAME_US_TOTAL] / values[STAT_FRAMES] : 0);
+    put("queue_overflows", command_queue_overflows());
+
+    // Counters kept by their own modules since start, reset_counters leaves them
+#ifdef USE_LIBUSB
+    usb_out_stats_s out;
+    usb_get_out_stats(&out);
+    put("usb_in_bytes", usb_in_bytes());
+    put("usb_out_messages", out.queued);
+    put("usb_out_transfers", out.submitted);
+    put("usb_out_completed", out.completed);
+    put("usb_out_errors", out.errors);
+    put("usb_out_dropped", out.dropped);
+    put("usb_out_bytes", out.bytes);
+
+    audio_stats_s audio;
+    audio_get_stats(&audio);
+    put("audio_fill_percent", audio.fill_percent);
+    put("audio_underruns", audio.underruns);
+    put("audio_overruns", audio.overruns);
+#endif
+
+    if (json) {
+        append(reply_fields ? "}\n" : "{}\n");
+    }
+}
+
+static void run_line(char *line) {
+    char *save = NULL;
+    const char *command = strtok_r(line, " \t\r\n", &save);
+    const char *arg = strtok_r(NULL, " \t\r\n", &save);
+
+    if (command == NULL || SDL_strcmp(command, "help") == 0) {
+        append("stats [json]\nreset_display\nreset_counters\ndump_trace <path>\n");
+    } else if (SDL_strcmp(command, "stats") == 0) {
+        format_stats(arg != NULL && SDL_strcmp(arg, "json") == 0);
+    } else if (SDL_strcmp(command, "reset_display") == 0) {
+        // Same as the reset key, the main loop does the redraw
+        input_send_external(special, msg_reset_display, 0, 1, SDL_GetTicks());
+        input_send_external(special, msg_reset_display, 0, 0, SDL_GetTicks());
+        append("ok\n");
+    } else if (SDL_strcmp(command, "reset_counters") == 0) {
+        stats_reset();
+        append("ok\n");
+    } else if (SDL_strcmp(command, "dump_trace") == 0) {
+        if (arg == NULL) {
+            append("error: dump_trace needs a path\n");
+            return;
+        }
+        int events = trace_dump(arg);
+        if (events < 0) {
+            append("error: no trace recorded\n");
+        } else {
+            append("ok events=%d\n", events);
+        }
+    } else {
+        append("error: unknown command '%s'\n", command);
+    }
+}
+
+static void serve(int client) {
+    // A client that never finishes its line must not hold up the next one
+    struct timeval timeout = {1, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    char line[LINE_SIZE];
+    int len = 0;
+    while (len < LINE_SIZE - 1) {
+        ssize_t n = recv(client, line + len, LINE_SIZE - 1 - len, 0);
+        if (n <= 0) {
+            break;
+        }
+        len += (int) n;
+        if (memchr(line, '\n', len) != NULL) {
+            break;
+        }
+    }
+    line[len] = '\0';
+
+    reply_len = 0;
+    run_line(line);
+
+    for (int sent = 0; sent < reply_len;) {
+        ssize_t n = send(client, reply + sent, reply_len - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            break;
+        }
+        sent += (int) n;
+    }
+}
+
+static int control_loop(void *data) {
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = {.fd = listen_fd, .events = POLLIN};
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+        int client = accept(listen_fd, NULL, NULL);
+        if (client < 0) {
+            continue;
+        }
+        serve(client);
+        close(client);
+    }
+    return 0;
+}
+
+int control_init(config_params_s *conf) {
+    if (conf->control_socket == NULL) {
+        return 0;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(conf->control_socket) >= sizeof(addr.sun_path)) {
+        SDL_Log("Control socket: path %s is too long\n", conf->control_socket);
+        return 0;
+    }
+    snprintf(socket_path, sizeof(socket_path), "%s", conf->control_socket);
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+
+    // A socket left behind by an earlier run is replaced, anything else is not
+    struct stat st;
+    if (stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, 4) != 0) {
+        SDL_Log("Control socket: cannot listen on %s (%s)\n", socket_path, strerror(errno));
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            listen_fd = -1;
+        }
+        return 0;
+    }
+
+    ticks_start = SDL_GetTicks();
+    do_exit = 0;
+    control_thread = SDL_CreateThread(&control_loop, NULL);
+    if (control_thread == NULL) {
+        close(listen_fd);
+        listen_fd = -1;
+        unlink(socket_path);
+        return 0;
+    }
+
+    SDL_Log("Control socket: listening on %s\n", socket_path);
+    return 1;
+}
+
+void control_destroy() {
+    if (control_thread == NULL) {
+        return;
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(control_thread, NULL);
+    control_thread = NULL;
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(socket_path);
+}
@@ -0,0 +1,22 @@
+#ifndef M8C_CONTROL_H
+#define M8C_CONTROL_H
+
+#include "config.h"
+
+/* Serves counters and a few commands on the UNIX socket conf->control_socket,
+   from its own thread. A client sends one line and gets the reply until the
+   connection closes, e.g. `echo stats | nc -U /tmp/m8c.sock`:
+
+     stats                  counters as key=value lines
+     stats json             the same as one JSON object
+     reset_display          redraw the M8 screen
+     reset_counters         zero the counters of stats.h
+     dump_trace <path>      write the trace recorded so far, see trace.h
+     help
+
+   Commands answer "ok" or "error: <reason>". */
+int control_init(config_params_s *conf);
+
+void control_destroy();
+
+#endif //M8C_CONTROL_H
@@ -0,0 +1,197 @@
+#include "flight_recorder.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SDL2_compat.h"
+
+#define MIN_SIZE_KB 64
+#define EVENT_SIZE 128
+
+// Share of the file per channel, in percent
+static const int channel_share[FLIGHT_CHANNELS] = {
+        [FLIGHT_DISPLAY] = 80,
+        [FLIGHT_OUT] = 5,
+        [FLIGHT_AUDIO] = 10,
+        [FLIGHT_EVENT] = 5,
+};
+
+static uint8_t *map = NULL;
+static size_t map_size = 0;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Keep the recording that was there when m8c started, it may be the one that matters
+static void keep_previous(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    uint32_t magic = 0;
+    ssize_t n = read(fd, &magic, sizeof(magic));
+    close(fd);
+    if (n == sizeof(magic) && magic == FLIGHT_MAGIC) {
+        char prev[512];
+        snprintf(prev, sizeof(prev), "%s.prev", path);
+        rename(path, prev);
+    }
+}
+
+int flight_recorder_init(const char *path, int size_kb) {
+    if (path == NULL) {
+        return 0;
+    }
+    if (size_kb < MIN_SIZE_KB) {
+        size_kb = MIN_SIZE_KB;
+    }
+    keep_previous(path);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        SDL_Log("Flight recorder: cannot create %s (%s)\n", path, strerror(errno));
+        return 0;
+    }
+    map_size = (size_t) size_kb * 1024;
+    // Real blocks, not a sparse file, so a record never waits for the
+    // filesystem to allocate one on the card. posix_fallocate() writes the
+    // blocks itself where the filesystem cannot reserve them.
+    int rc = posix_fallocate(fd, 0, (off_t) map_size);
+    if (rc != 0) {
+        SDL_Log("Flight recorder: cannot allocate %s (%s)\n", path, strerror(rc));
+        close(fd);
+        return 0;
+    }
+    uint8_t *m = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    // The mapping stays valid without the descriptor
+    close(fd);
+    if (m == MAP_FAILED) {
+        SDL_Log("Flight recorder: cannot map %s (%s)\n", path, strerror(errno));
+        return 0;
+    }
+    // Take the write faults for every page now rather than in the USB and
+    // audio callbacks
+    memset(m, 0, map_size);
+
+    flight_header_s *header = (flight_header_s *) m;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    header->version = FLIGHT_VERSION;
+    header->start_us = now_us();
+    header->start_unix_us = (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+
+    uint32_t offset = (sizeof(flight_header_s) + 7) & ~7u;
+    uint32_t space = (uint32_t) map_size - offset;
+    for (int i = 0; i < FLIGHT_CHANNELS; i++) {
+        flight_channel_s *ch = &header->channels[i];
+        ch->offset = offset;
+        ch->size = (uint32_t) ((uint64_t) space * channel_share[i] / 100) & ~7u;
+        offset += ch->size;
+    }
+    __atomic_store_n(&header->magic, FLIGHT_MAGIC, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&map, m, __ATOMIC_RELEASE);
+    SDL_Log("Flight recorder: %d kB ring in %s\n", size_kb, path);
+    return 1;
+}
+
+void flight_recorder_close() {
+    uint8_t *m = __atomic_exchange_n(&map, NULL, __ATOMIC_ACQ_REL);
+    if (m == NULL) {
+        return;
+    }
+    // Writers that already hold a lock finish first
+    flight_header_s *header = (flight_header_s *) m;
+    for (int i = 0; i < FLIGHT_CHANNELS; i++) {
+        while (__atomic_load_n(&header->channels[i].lock, __ATOMIC_ACQUIRE)) {
+            SDL_Delay(1);
+        }
+    }
+    munmap(m, map_size);
+}
+
+/* Frees need bytes at head by dropping the oldest records. The header is
+   updated as it goes, so a crash at any point leaves a decodable ring. */
+static uint32_t make_room(flight_channel_s *ch, const uint8_t *ring, uint32_t need) {
+    uint32_t head = ch->head;
+    uint32_t tail = ch->tail;
+    uint32_t wrap_end = ch->wrap_end;
+
+    for (;;) {
+        if (wrap_end == 0) {
+            // [tail, head), tail is 0 here
+            if (head + need <= ch->size) {
+                break;
+            }
+            wrap_end = head;
+            head = 0;
+            __atomic_store_n(&ch->wrap_end, wrap_end, __ATOMIC_RELEASE);
+            __atomic_store_n(&ch->head, head, __ATOMIC_RELEASE);
+        } else {
+            // [tail, wrap_end) then [0, head)
+            if (head + need <= tail) {
+                break;
+            }
+            const flight_record_s *r = (const flight_record_s *) (ring + tail);
+            tail += FLIGHT_RECORD_SIZE(r->length);
+            if (tail >= wrap_end) {
+                tail = 0;
+                wrap_end = 0;
+                __atomic_store_n(&ch->wrap_end, 0, __ATOMIC_RELEASE);
+            }
+            __atomic_store_n(&ch->tail, tail, __ATOMIC_RELEASE);
+        }
+    }
+    return head;
+}
+
+void flight_record(flight_channel_t channel, const void *data, uint32_t length) {
+    uint8_t *m = __atomic_load_n(&map, __ATOMIC_ACQUIRE);
+    if (m == NULL) {
+        return;
+    }
+    flight_channel_s *ch = &((flight_header_s *) m)->channels[channel];
+    uint32_t need = FLIGHT_RECORD_SIZE(length);
+    if (need > ch->size / 4 ||
+        __atomic_exchange_n(&ch->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+        __atomic_add_fetch(&ch->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint8_t *ring = m + ch->offset;
+    uint32_t head = make_room(ch, ring, need);
+    flight_record_s *r = (flight_record_s *) (ring + head);
+    r->ts_us = now_us();
+    r->length = length;
+    r->seq = ch->seq++;
+    memcpy(r + 1, data, length);
+    __atomic_store_n(&ch->head, head + need, __ATOMIC_RELEASE);
+
+    __atomic_store_n(&ch->lock, 0, __ATOMIC_RELEASE);
+}
+
+void flight_record_event(const char *format, ...) {
+    if (__atomic_load_n(&map, __ATOMIC_ACQUIRE) == NULL) {
+        return;
+    }
+    char text[EVENT_SIZE];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (n < 0) {
+        return;
+    }
+    flight_record(FLIGHT_EVENT, text, n < EVENT_SIZE ? (uint32_t) n : EVENT_SIZE - 1);
+}
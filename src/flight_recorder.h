@@ -0,0 +1,70 @@
+#ifndef M8C_FLIGHT_RECORDER_H
+#define M8C_FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+/* Keeps the last few seconds of traffic in a memory mapped ring file, for a
+   post-mortem of glitches that cannot be reproduced. Writing a record is a
+   memcpy into the mapping, no system calls, and the page cache writes the
+   file out even when m8c crashes. `m8c-flight` decodes it.
+
+   The file holds one ring per channel. A record is a flight_record_s and its
+   payload, padded to 8 bytes. Records never wrap around the end of a ring:
+   when one does not fit, the space up to wrap_end is left to the older
+   records and writing continues at the start. Valid records are then
+   [tail, wrap_end) followed by [0, head), or just [tail, head) when
+   wrap_end is 0. */
+
+#define FLIGHT_MAGIC 0x4C46384D // "M8FL"
+#define FLIGHT_VERSION 1
+
+typedef enum {
+    FLIGHT_DISPLAY, // raw bytes read from the M8, SLIP encoded
+    FLIGHT_OUT,     // messages written to the M8
+    FLIGHT_AUDIO,   // flight_audio_sample_s for every audio output callback
+    FLIGHT_EVENT,   // errors and connection changes, as text
+    FLIGHT_CHANNELS
+} flight_channel_t;
+
+typedef struct {
+    uint64_t ts_us; // CLOCK_MONOTONIC
+    uint32_t length;
+    uint32_t seq;   // per channel
+} flight_record_s;
+
+typedef struct {
+    uint32_t offset; // of the ring in the file
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t wrap_end;
+    uint32_t lock;
+    uint32_t seq;
+    uint32_t dropped; // records lost to a concurrent writer or too large
+} flight_channel_s;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_us;      // CLOCK_MONOTONIC when recording started
+    int64_t start_unix_us;  // wall clock at the same moment, to match up with logs
+    flight_channel_s channels[FLIGHT_CHANNELS];
+} flight_header_s;
+
+typedef struct {
+    uint8_t fill_percent;
+    uint8_t underrun;
+} flight_audio_sample_s;
+
+#define FLIGHT_RECORD_SIZE(length) ((uint32_t) sizeof(flight_record_s) + (((length) + 7) & ~7u))
+
+/* Maps a ring file of size_kb at path. A recording left there by the previous
+   run is first renamed to path.prev, it may be the one that matters. */
+int flight_recorder_init(const char *path, int size_kb);
+void flight_recorder_close();
+
+// Safe from any thread, a record is dropped rather than waited for
+void flight_record(flight_channel_t channel, const void *data, uint32_t length);
+void flight_record_event(const char *format, ...);
+
+#endif //M8C_FLIGHT_RECORDER_H
@@ -9,13 +9,25 @@ static SDL_Color line_color;
 const char *text_m8c = "M8C";
 const char *text_disconnected = "DEVICE DISCONNECTED";
 
-static const float center_x = (float) target_width / 2;
-static const float center_y = (float) target_height / 2;
-
-struct SDL_Point {
-    float x;
-    float y;
-};
+static const int center_x = target_width / 2;
+static const int center_y = target_height / 2;
+
+// Angles are in 1/SINE_STEPS of a turn, sines are Q15
+#define SINE_STEPS 1024
+#define SINE_MASK (SINE_STEPS - 1)
+#define SINE_BITS 15
+
+// Node coordinates are Q12, the cube size is Q8 pixels
+#define NODE_BITS 12
+#define SIZE_BITS 8
+
+// One turn every 6 s around the vertical axis and every 9 s around the
+// horizontal one, the size pulses by 8% over 6 s
+#define TURN_X_MS 6000
+#define TURN_Y_MS 9000
+#define PULSE_MS 6000
+#define CUBE_SIZE 50
+#define PULSE_PERCENT 8
 
 static const float default_nodes[8][3] = {
         {-1, -1, -1},
@@ -40,49 +52,70 @@ static int edges[12][2] = {{0, 1},
                            {2, 6},
                            {3, 7}};
 
-static float nodes[8][3];
+static int16_t sine[SINE_STEPS];
 
-static void scale(float factor0, float factor1, float factor2) {
-    for (int i = 0; i < 8; i++) {
-        nodes[i][0] *= factor0;
-        nodes[i][1] *= factor1;
-        nodes[i][2] *= factor2;
-    }
-}
+// The cube standing on one corner, everything else is rotated from this
+static int32_t base_nodes[8][3];
 
-static void rotate_cube(float angle_x, float angle_y) {
-    float sin_x = sinf(angle_x);
-    float cos_x = cosf(angle_x);
-    float sin_y = sinf(angle_y);
-    float cos_y = cosf(angle_y);
-    for (int i = 0; i < 8; i++) {
-        float x = nodes[i][0];
-        float y = nodes[i][1];
-        float z = nodes[i][2];
+static uint32_t ticks_start;
+
+// Area covered by the previous frame, erased before drawing the next
+static SDL_Rect last_box;
 
-        nodes[i][0] = x * cos_x - z * sin_x;
-        nodes[i][2] = z * cos_x + x * sin_x;
+static inline int32_t sin_q15(uint32_t angle) {
+    return sine[angle & SINE_MASK];
+}
 
-        z = nodes[i][2];
+static inline int32_t cos_q15(uint32_t angle) {
+    return sine[(angle + SINE_STEPS / 4) & SINE_MASK];
+}
 
-        nodes[i][1] = y * cos_y - z * sin_y;
-        nodes[i][2] = z * cos_y + y * sin_y;
+static void union_rect(SDL_Rect *a, const SDL_Rect *b) {
+    if (b->w == 0 || b->h == 0) {
+        return;
+    }
+    if (a->w == 0 || a->h == 0) {
+        *a = *b;
+        return;
     }
+    int x1 = a->x < b->x ? a->x : b->x;
+    int y1 = a->y < b->y ? a->y : b->y;
+    int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    *a = (SDL_Rect) {x1, y1, x2 - x1, y2 - y1};
 }
 
 void fx_cube_init(SDL_Surface *dst, SDL_Color foreground_color) {
 
     line_color = foreground_color;
 
-    inprint(dst, text_disconnected, 150, 228, 0xFFFFFF, 0x000000);
-    inprint(dst, text_m8c, 2, 2, 0xFFFFFF, 0x000000);
+    // Floating point is only used here, once
+    for (int i = 0; i < SINE_STEPS; i++) {
+        sine[i] = (int16_t) lrintf(sinf(2 * M_PI * i / SINE_STEPS) * ((1 << SINE_BITS) - 1));
+    }
 
-    // Initialize default nodes
-    SDL_memcpy(nodes, default_nodes, sizeof(default_nodes));
+    float sin_x = sinf(M_PI / 4), cos_x = cosf(M_PI / 4);
+    float sin_y = sinf(atanf(sqrtf(2))), cos_y = cosf(atanf(sqrtf(2)));
+    for (int i = 0; i < 8; i++) {
+        float x = default_nodes[i][0];
+        float y = default_nodes[i][1];
+        float z = default_nodes[i][2];
+        float x1 = x * cos_x - z * sin_x;
+        float z1 = z * cos_x + x * sin_x;
+        float y1 = y * cos_y - z1 * sin_y;
+        float z2 = z1 * cos_y + y * sin_y;
+        base_nodes[i][0] = lrintf(x1 * (1 << NODE_BITS));
+        base_nodes[i][1] = lrintf(y1 * (1 << NODE_BITS));
+        base_nodes[i][2] = lrintf(z2 * (1 << NODE_BITS));
+    }
 
-    scale(50, 50, 50);
-    rotate_cube(M_PI / 4, atanf(sqrtf(2)));
+    // The text is outside the area the cube can reach, so it is drawn once
+    SDL_FillRect(dst, NULL, 0x0);
+    inprint(dst, text_disconnected, 150, 228, 0xFFFFFF, 0x000000);
+    inprint(dst, text_m8c, 2, 2, 0xFFFFFF, 0x000000);
 
+    ticks_start = SDL_GetTicks();
+    last_box = (SDL_Rect) {0, 0, 0, 0};
 }
 
 void fx_cube_destroy() {
@@ -90,38 +123,56 @@ void fx_cube_destroy() {
 //    SDL_DestroyTexture(texture_text);
 }
 
-void fx_cube_update(SDL_Surface *dst) {
+void fx_cube_update(SDL_Surface *dst, SDL_Rect *updated) {
 
-    struct SDL_Point points[24];
-    int points_counter = 0;
+    int16_t points[8][2];
 
+    uint32_t t = SDL_GetTicks() - ticks_start;
+    uint32_t angle_x = (uint32_t) ((uint64_t) t * SINE_STEPS / TURN_X_MS);
+    uint32_t angle_y = (uint32_t) ((uint64_t) t * SINE_STEPS / TURN_Y_MS);
+    uint32_t pulse = (uint32_t) ((uint64_t) t * SINE_STEPS / PULSE_MS);
 
-    int seconds = SDL_GetTicks() / 1000;
-    float scalefactor = 1.0f + (sinf(seconds) * 0.01);
+    int32_t sin_x = sin_q15(angle_x), cos_x = cos_q15(angle_x);
+    int32_t sin_y = sin_q15(angle_y), cos_y = cos_q15(angle_y);
+    int32_t size = (CUBE_SIZE << SIZE_BITS) +
+                   ((CUBE_SIZE * PULSE_PERCENT / 100 << SIZE_BITS) * sin_q15(pulse) >> SINE_BITS);
 
-    scale(scalefactor, scalefactor, scalefactor);
-    rotate_cube(M_PI / 180, M_PI / 270);
+    SDL_Rect box = {0, 0, 0, 0};
+    int min_x = target_width, min_y = target_height, max_x = 0, max_y = 0;
 
-    SDL_FillRect(dst, NULL, 0x0);
+    for (int i = 0; i < 8; i++) {
+        int32_t x = base_nodes[i][0];
+        int32_t y = base_nodes[i][1];
+        int32_t z = base_nodes[i][2];
 
-    for (int i = 0; i < 12; i++) {
-        float *p1 = nodes[edges[i][0]];
-        float *p2 = nodes[edges[i][1]];
-        points[points_counter++] =
-                (struct SDL_Point) {p1[0] + center_x, nodes[edges[i][0]][1] + center_y};
-        points[points_counter++] = (struct SDL_Point) {p2[0] + center_x, p2[1] + center_y};
-
-        lineRGBA(dst,
-                 (short) (p1[0] + center_x),
-                 (short) (nodes[edges[i][0]][1] + center_y),
-                 (short) (p2[0] + center_x),
-                 (short) (p2[1] + center_y),
-                      line_color.r, line_color.g, line_color.b, line_color.unused);
-    }
+        int32_t x1 = (x * cos_x - z * sin_x) >> SINE_BITS;
+        int32_t z1 = (z * cos_x + x * sin_x) >> SINE_BITS;
+        int32_t y1 = (y * cos_y - z1 * sin_y) >> SINE_BITS;
 
+        points[i][0] = (int16_t) (center_x + ((x1 * size) >> (NODE_BITS + SIZE_BITS)));
+        points[i][1] = (int16_t) (center_y + ((y1 * size) >> (NODE_BITS + SIZE_BITS)));
 
+        if (points[i][0] < min_x) min_x = points[i][0];
+        if (points[i][0] > max_x) max_x = points[i][0];
+        if (points[i][1] < min_y) min_y = points[i][1];
+        if (points[i][1] > max_y) max_y = points[i][1];
+    }
+    box = (SDL_Rect) {min_x, min_y, max_x - min_x + 1, max_y - min_y + 1};
 
-    inprint(dst, text_disconnected, 150, 228, 0xFFFFFF, 0x000000);
-    inprint(dst, text_m8c, 2, 2, 0xFFFFFF, 0x000000);
+    // Erase the previous cube only, the rest of the canvas is left alone
+    if (last_box.w > 0) {
+        SDL_Rect erase = last_box;
+        SDL_FillRect(dst, &erase, 0x0);
+    }
+
+    for (int i = 0; i < 12; i++) {
+        int16_t *p1 = points[edges[i][0]];
+        int16_t *p2 = points[edges[i][1]];
+        lineRGBA(dst, p1[0], p1[1], p2[0], p2[1],
+                 line_color.r, line_color.g, line_color.b, line_color.unused);
+    }
 
+    *updated = last_box;
+    union_rect(updated, &box);
+    last_box = box;
 }
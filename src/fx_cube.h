@@ -3,6 +3,7 @@
 
 void fx_cube_init(SDL_Surface *dst,SDL_Color foreground_color);
 void fx_cube_destroy();
-void fx_cube_update(SDL_Surface *dst);
+// Draws the next frame, updated receives the part of dst that changed
+void fx_cube_update(SDL_Surface *dst, SDL_Rect *updated);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+
+#include "hud.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+#include "audio.h"
+#include "command_queue.h"
+#include "usb.h"
+#include "SDL2_compat.h"
+
+#define HUD_UPDATE_MS 1000
+
+static int enabled = 0;
+static uint32_t ticks_update = 0;
+
+// Since the last update
+static uint32_t presents = 0;
+static uint32_t commands = 0;
+static int max_waiting = 0;
+
+// Since start
+static uint32_t invalid_total = 0;
+
+static uint32_t usb_bytes_update = 0;
+static uint64_t cpu_us_update = 0;
+
+// CPU time of the calling thread, the main loop is the only caller
+static uint64_t thread_cpu_us() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage) != 0) {
+        return 0;
+    }
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Both come from the libusb side, host builds of the renderer have neither
+static uint32_t usb_bytes() {
+#ifdef USE_LIBUSB
+    return usb_in_bytes();
+#else
+    return 0;
+#endif
+}
+
+static void get_audio_stats(audio_stats_s *stats) {
+#ifdef USE_LIBUSB
+    audio_get_stats(stats);
+#else
+    *stats = (audio_stats_s) {0, 0, 0};
+#endif
+}
+
+void hud_init(int enable) {
+    hud_set_enabled(enable);
+}
+
+int hud_enabled() {
+    return enabled;
+}
+
+void hud_set_enabled(int enable) {
+    enabled = enable != 0;
+    // The first update comes right away and starts the counting over
+    ticks_update = 0;
+}
+
+void hud_commands(int processed, int waiting, int invalid) {
+    commands += processed;
+    invalid_total += invalid;
+    if (waiting > max_waiting) {
+        max_waiting = waiting;
+    }
+}
+
+void hud_present() {
+    presents++;
+}
+
+int hud_update(char text[HUD_LINES][HUD_LINE_CHARS + 1]) {
+    uint32_t now = SDL_GetTicks();
+    if (ticks_update != 0 && now - ticks_update < HUD_UPDATE_MS) {
+        return 0;
+    }
+
+    uint32_t bytes = usb_bytes();
+    uint64_t cpu_us = thread_cpu_us();
+    if (ticks_update == 0) {
+        snprintf(text[0], HUD_LINE_CHARS + 1, "FPS -- CMD --");
+        snprintf(text[1], HUD_LINE_CHARS + 1, "Q - DROP - BAD -");
+        snprintf(text[2], HUD_LINE_CHARS + 1, "AUD --");
+        snprintf(text[3], HUD_LINE_CHARS + 1, "USB -- CPU --");
+    } else {
+        float seconds = (now - ticks_update) / 1000.0f;
+        audio_stats_s audio;
+        get_audio_stats(&audio);
+
+        // Rates per second, the deepest queue drain of the second, totals for the errors
+        snprintf(text[0], HUD_LINE_CHARS + 1, "FPS %.1f CMD %.0f", presents / seconds,
+                 commands / seconds);
+        snprintf(text[1], HUD_LINE_CHARS + 1, "Q %d DROP %u BAD %u", max_waiting,
+                 command_queue_overflows(), invalid_total);
+        snprintf(text[2], HUD_LINE_CHARS + 1, "AUD %u%% U%u O%u", audio.fill_percent,
+                 audio.underruns, audio.overruns);
+        snprintf(text[3], HUD_LINE_CHARS + 1, "USB %.1fk CPU %.0f%%",
+                 (bytes - usb_bytes_update) / seconds / 1000.0f,
+                 (cpu_us - cpu_us_update) / (seconds * 10000.0f));
+    }
+
+    ticks_update = now;
+    usb_bytes_update = bytes;
+    cpu_us_update = cpu_us;
+    presents = 0;
+    commands = 0;
+    max_waiting = 0;
+    return 1;
+}
@@ -0,0 +1,26 @@
+#ifndef M8C_HUD_H
+#define M8C_HUD_H
+
+#include <stdint.h>
+
+#define HUD_LINES 4
+#define HUD_LINE_CHARS 18
+
+/* Performance figures shown on top of the M8 screen. The text is refreshed
+   once a second from counters the main loop and the renderer feed in, and
+   drawn by render_screen() straight onto the screen surface, so the canvas
+   and the retained screen model never see it. */
+void hud_init(int enabled);
+int hud_enabled();
+void hud_set_enabled(int enabled);
+
+// Called by the main loop after each drain of the command queue
+void hud_commands(int processed, int waiting, int invalid);
+
+// Called by the renderer for every frame it presents
+void hud_present();
+
+// Formats new text when a second has passed, returns 1 if it did
+int hud_update(char text[HUD_LINES][HUD_LINE_CHARS + 1]);
+
+#endif //M8C_HUD_H
@@ -13,6 +13,8 @@ static Uint16 selected_font_w, selected_font_h;
 static unsigned char *selected_font_bits =0;
 static SDL_Surface *font = 0;
 static SDL_Color pal[1];
+// Color pal[0] was last set to, in 0x00RRGGBB format
+static uint32_t previous_fgcolor;
 
 void incolor1(SDL_Color *color) {
     pal[0].r = color->r;
@@ -85,6 +87,7 @@ void prepare_inline_font(unsigned char *bits, int font_width, int font_height) {
             255, 255, 255, 255
     };
     incolor1(&color);
+    previous_fgcolor = 0xFFFFFF;
 
     int size = selected_font_w * selected_font_h / 8;
     for (int i = 0; i < size; ++i) {
@@ -144,8 +147,6 @@ void inprint(
     SDL_Rect d_rect;
     SDL_Rect bg_rect;
 
-    static uint32_t previous_fgcolor;
-
     d_rect.x = x;
     d_rect.y = y;
     s_rect.w = selected_font_w / CHARACTERS_PER_ROW;
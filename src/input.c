@@ -1,31 +1,32 @@
 // Copyright 2021 Jonne Kokkonen
 // Released under the MIT licence, https://opensource.org/licenses/MIT
 
+#include <SDL.h>
 #include <SDL_events.h>
 
 #include "config.h"
 #include "input.h"
 #include "render.h"
 
-// Bits for M8 input messages
-enum keycodes {
-    key_left = 1 << 7,
-    key_up = 1 << 6,
-    key_down = 1 << 5,
-    key_select = 1 << 4,
-    key_start = 1 << 3,
-    key_right = 1 << 2,
-    key_opt = 1 << 1,
-    key_edit = 1
-};
-
 uint8_t keyjazz_enabled = 0;
 uint8_t keyjazz_base_octave = 2;
 uint8_t keyjazz_velocity = 0x64;
 
 static uint8_t keycode = 0; // value of the pressed key
+static uint32_t keycode_timestamp = 0; // SDL ticks of the last change
+static uint8_t keycode_reported = 0; // state main last got, pending or returned
+static uint32_t last_pump_ticks = 0; // when SDL last read events from the OS
+
+// M8 key bits and special messages indexed by SDL keysym
+static uint8_t key_table[SDLK_LAST];
+static uint8_t special_table[SDLK_LAST];
 
-input_msg_s key = {normal, 0};
+// Keyjazz and special messages drained in one go, handed out one at a time
+#define PENDING_SIZE 32
+static input_msg_s pending[PENDING_SIZE];
+static int pending_read = 0;
+static int pending_count = 0;
+static int keycode_due = 0; // normal key state not yet returned since the last drain
 
 uint8_t toggle_input_keyjazz() {
     keyjazz_enabled = !keyjazz_enabled;
@@ -170,162 +171,226 @@ static input_msg_s handle_keyjazz(SDL_Event *event, uint8_t keyvalue) {
     return key;
 }
 
-static input_msg_s handle_normal_keys(SDL_Event *event, config_params_s *conf,
-                                      uint8_t keyvalue) {
+// Build the keysym lookup tables from the configured keys
+void input_init(config_params_s *conf) {
+    SDL_memset(key_table, 0, sizeof(key_table));
+    SDL_memset(special_table, 0, sizeof(special_table));
+
+    const struct {
+        int sym;
+        uint8_t value;
+    } mapping[] = {
+            {conf->key_up,         key_up},
+            {conf->key_left,       key_left},
+            {conf->key_down,       key_down},
+            {conf->key_right,      key_right},
+            {conf->key_select,     key_select},
+            {conf->key_select_alt, key_select},
+            {conf->key_start,      key_start},
+            {conf->key_start_alt,  key_start},
+            {conf->key_opt,        key_opt},
+            {conf->key_opt_alt,    key_opt},
+            {conf->key_edit,       key_edit},
+            {conf->key_edit_alt,   key_edit},
+            {conf->key_delete,     key_opt | key_edit},
+    };
+
+    // When a key is bound twice the first binding wins, so fill backwards
+    for (int i = (int) (sizeof(mapping) / sizeof(mapping[0])) - 1; i >= 0; i--) {
+        if (mapping[i].sym > 0 && mapping[i].sym < SDLK_LAST) {
+            key_table[mapping[i].sym] = mapping[i].value;
+        }
+    }
+
+    // Special keys only apply if the key isn't already a controller key
+    if (conf->key_capture > 0 && conf->key_capture < SDLK_LAST && !key_table[conf->key_capture]) {
+        special_table[conf->key_capture] = msg_toggle_capture;
+    }
+    if (conf->key_reset > 0 && conf->key_reset < SDLK_LAST && !key_table[conf->key_reset]) {
+        special_table[conf->key_reset] = msg_reset_display;
+    }
+    if (conf->key_hud > 0 && conf->key_hud < SDLK_LAST && !key_table[conf->key_hud]) {
+        special_table[conf->key_hud] = msg_toggle_hud;
+    }
+}
+
+static input_msg_s handle_normal_keys(SDL_Event *event, uint8_t keyvalue) {
     input_msg_s key = {normal, keyvalue};
+    SDLKey sym = event->key.keysym.sym;
 
-    if (event->key.keysym.sym == conf->key_up) {
-        key.value = key_up;
-    } else if (event->key.keysym.sym == conf->key_left) {
-        key.value = key_left;
-    } else if (event->key.keysym.sym == conf->key_down) {
-        key.value = key_down;
-    } else if (event->key.keysym.sym == conf->key_right) {
-        key.value = key_right;
-    } else if (event->key.keysym.sym == conf->key_select ||
-               event->key.keysym.sym == conf->key_select_alt) {
-        key.value = key_select;
-    } else if (event->key.keysym.sym == conf->key_start ||
-               event->key.keysym.sym == conf->key_start_alt) {
-        key.value = key_start;
-    } else if (event->key.keysym.sym == conf->key_opt ||
-               event->key.keysym.sym == conf->key_opt_alt) {
-        key.value = key_opt;
-    } else if (event->key.keysym.sym == conf->key_edit ||
-               event->key.keysym.sym == conf->key_edit_alt) {
-        key.value = key_edit;
-    } else if (event->key.keysym.sym == conf->key_delete) {
-        key.value = key_opt | key_edit;
-    } else if (event->key.keysym.sym == conf->key_reset) {
-        key = (input_msg_s) {special, msg_reset_display};
-    } else {
+    if (sym <= 0 || sym >= SDLK_LAST) {
         key.value = 0;
+    } else if (special_table[sym]) {
+        key = (input_msg_s) {special, special_table[sym]};
+    } else {
+        key.value = key_table[sym];
     }
     return key;
 }
 
-// Handles SDL input events
-void handle_sdl_events(config_params_s *conf) {
+static void push_pending(input_msg_s msg) {
+    if (pending_count < PENDING_SIZE) {
+        pending[(pending_read + pending_count) % PENDING_SIZE] = msg;
+        pending_count++;
+    } else if (msg.type == special && msg.value == msg_quit) {
+        // Quit must get through, it takes the place of the newest message
+        pending[(pending_read + pending_count - 1) % PENDING_SIZE] = msg;
+    }
+}
 
-    static int prev_key_analog = 0;
+// Handles a single SDL event
+static void handle_sdl_event(SDL_Event *event, uint32_t timestamp) {
 
-    SDL_Event event;
-    key = (input_msg_s) {normal, 0};
-    // Read joysticks
-//    int key_analog = handle_game_controller_buttons(conf);
-//    if (prev_key_analog != key_analog) {
-//        keycode = key_analog;
-//        prev_key_analog = key_analog;
-//    }
-
-//    // Read special case game controller buttons quit and reset
-//    for (int gc = 0; gc < num_joysticks; gc++) {
-//        if (SDL_JoystickGetButton(game_controllers[gc], conf->gamepad_quit) &&
-//            (SDL_JoystickGetButton(game_controllers[gc], conf->gamepad_select) ||
-//                    SDL_JoystickGetAxis(game_controllers[gc], conf->gamepad_analog_axis_select)))
-//            key = (input_msg_s) {special, msg_quit};
-//        else if (SDL_JoystickGetButton(game_controllers[gc], conf->gamepad_reset) &&
-//                 (SDL_JoystickGetButton(game_controllers[gc], conf->gamepad_select) ||
-//                         SDL_JoystickGetAxis(game_controllers[gc], conf->gamepad_analog_axis_select)))
-//            key = (input_msg_s) {special, msg_reset_display};
-//    }
-
-    SDL_PollEvent(&event);
-
-
-    switch (event.type) {
+    input_msg_s key = {normal, 0};
+    uint8_t pressed = event->type == SDL_KEYDOWN || event->type == SDL_JOYBUTTONDOWN ||
+                      event->type == SDL_JOYAXISMOTION;
+
+    switch (event->type) {
+
+            // Input from other sources, see input_send_external()
+        case SDL_USEREVENT:
+            key.type = (input_type_t) ((event->user.code >> 16) & 0xFF);
+            key.value = event->user.code & 0xFF;
+            key.value2 = (event->user.code >> 8) & 0xFF;
+            pressed = event->user.data1 != NULL;
+            key.eventType = pressed ? SDL_KEYDOWN : SDL_KEYUP;
+            timestamp = (uint32_t) (uintptr_t) event->user.data2;
+            break;
 
             // Handle SDL quit events (for example, window close)
         case SDL_QUIT:
             key = (input_msg_s) {special, msg_quit};
             break;
 
-//        case SDL_WINDOWEVENT:
-//            if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
-//                static uint32_t ticks_window_resized = 0;
-//                if (SDL_GetTicks() - ticks_window_resized > 500) {
-//                    SDL_Log("Resizing window...");
-//                    key = (input_msg_s) {special, msg_reset_display};
-//                    ticks_window_resized = SDL_GetTicks();
-//                }
-//            }
-//            break;
-
             // Keyboard events. Special events are handled within SDL_KEYDOWN.
         case SDL_KEYDOWN:
 
             // ALT+ENTER toggles fullscreen
-            if (event.key.keysym.sym == SDLK_RETURN &&
-                (event.key.keysym.mod & KMOD_ALT) > 0) {
+            if (event->key.keysym.sym == SDLK_RETURN &&
+                (event->key.keysym.mod & KMOD_ALT) > 0) {
                 toggle_fullscreen();
-                break;
+                return;
             }
 
             // ALT+F4 quits program
-            if (event.key.keysym.sym == SDLK_F4 &&
-                (event.key.keysym.mod & KMOD_ALT) > 0) {
+            if (event->key.keysym.sym == SDLK_F4 &&
+                (event->key.keysym.mod & KMOD_ALT) > 0) {
                 key = (input_msg_s) {special, msg_quit};
                 break;
             }
 
             // ESC = toggle keyjazz
-            if (event.key.keysym.sym == SDLK_ESCAPE) {
+            if (event->key.keysym.sym == SDLK_ESCAPE) {
                 display_keyjazz_overlay(toggle_input_keyjazz(), keyjazz_base_octave, keyjazz_velocity);
             }
 
             // Normal keyboard inputs
         case SDL_KEYUP:
-            key = handle_normal_keys(&event, conf, 0);
+            key = handle_normal_keys(event, 0);
 
             if (keyjazz_enabled)
-                key = handle_keyjazz(&event, key.value);
+                key = handle_keyjazz(event, key.value);
             break;
 
         default:
-            break;
+            return;
     }
 
+    key.timestamp = timestamp;
+
     switch (key.type) {
         case normal:
-            if (event.type == SDL_KEYDOWN || event.type == SDL_JOYBUTTONDOWN || event.type == SDL_JOYAXISMOTION) {
+            // Changes in one iteration collapse into a single controller
+            // message, unless a button goes back to where it was since main
+            // last saw it. A tap within one drain is then queued in between.
+            if (key.value & (keycode ^ keycode_reported)) {
+                push_pending((input_msg_s) {normal, keycode, 0, 0, keycode_timestamp});
+                keycode_reported = keycode;
+            }
+            if (pressed) {
                 keycode |= key.value;
             } else {
                 keycode &= ~key.value;
             }
+            if (key.value != 0) {
+                keycode_timestamp = timestamp;
+            }
             break;
         case keyjazz:
             // Do not allow pressing multiple keys with keyjazz
         case special:
-            if (event.type == SDL_KEYDOWN || event.type == SDL_JOYBUTTONDOWN || event.type == SDL_JOYAXISMOTION) {
-                keycode = key.value;
-            } else {
-                keycode = 0;
-            }
+            keycode = pressed ? key.value : 0;
+            keycode_reported = keycode;
+            keycode_timestamp = timestamp;
+            push_pending(key);
             break;
         default:
             break;
     }
+}
+
+// Drains all pending SDL events
+void handle_sdl_events() {
+    // SDL 1.2 events carry no time and are only read from the OS here, so an
+    // event may have waited since the previous drain. It is stamped with the
+    // earliest time it can have arrived, so a stalled loop shows up in the
+    // input to USB latency instead of being hidden.
+    uint32_t now = SDL_GetTicks();
+    uint32_t arrived = last_pump_ticks != 0 ? last_pump_ticks : now;
+    last_pump_ticks = now;
 
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        handle_sdl_event(&event, arrived);
+    }
 }
 
-// Returns the currently pressed keys to main
-input_msg_s get_input_msg(config_params_s *conf) {
+int input_send_external(input_type_t type, uint8_t value, uint8_t value2, int pressed,
+                        uint32_t timestamp) {
+    // SDL's event queue is thread safe, so external sources simply join the
+    // keyboard events and go through the same handling
+    SDL_Event event;
+    SDL_memset(&event, 0, sizeof(event));
+    event.type = SDL_USEREVENT;
+    event.user.code = (type << 16) | (value2 << 8) | value;
+    event.user.data1 = pressed ? (void *) 1 : NULL;
+    event.user.data2 = (void *) (uintptr_t) timestamp;
+    return SDL_PushEvent(&event) == 0;
+}
 
-    key = (input_msg_s) {normal, 0};
+int input_pending() {
+    return pending_count + keycode_due;
+}
 
-    // Query for SDL events
-    handle_sdl_events(conf);
+// Returns the currently pressed keys to main. Keyjazz notes and special
+// messages are queued and returned one per call, followed by the coalesced
+// controller state, see input_pending().
+input_msg_s get_input_msg(config_params_s *conf) {
 
-    if (!keyjazz_enabled && keycode == (key_start | key_select | key_opt | key_edit)) {
-        key = (input_msg_s) {special, msg_reset_display};
+    if (pending_count == 0 && !keycode_due) {
+        // Query for SDL events
+        handle_sdl_events();
+        keycode_due = 1;
+
+        // The reset combination replaces the controller state as long as it is held
+        if (!keyjazz_enabled && keycode == (key_start | key_select | key_opt | key_edit)) {
+            push_pending((input_msg_s) {special, msg_reset_display, 0, 0, keycode_timestamp});
+            keycode_due = 0;
+            keycode_reported = keycode;
+        }
     }
 
-    if (key.type == normal) {
-        /* Normal input keys go through some event-based manipulation in
-           handle_sdl_events(), the value is stored in keycode variable */
-        return (input_msg_s) {key.type, keycode};
-    } else {
+    if (pending_count > 0) {
         // Special event keys already have the correct keycode baked in
+        input_msg_s key = pending[pending_read];
+        pending_read = (pending_read + 1) % PENDING_SIZE;
+        pending_count--;
         return key;
     }
+
+    /* Normal input keys go through some event-based manipulation in
+       handle_sdl_event(), the value is stored in keycode variable */
+    keycode_due = 0;
+    keycode_reported = keycode;
+    return (input_msg_s) {normal, keycode, 0, 0, keycode_timestamp};
 }
@@ -25,9 +25,23 @@ typedef enum input_type_t {
     special
 } input_type_t;
 
+// Bits for M8 input messages
+enum keycodes {
+    key_left = 1 << 7,
+    key_up = 1 << 6,
+    key_down = 1 << 5,
+    key_select = 1 << 4,
+    key_start = 1 << 3,
+    key_right = 1 << 2,
+    key_opt = 1 << 1,
+    key_edit = 1
+};
+
 typedef enum special_messages_t {
     msg_quit = 1,
-    msg_reset_display = 2
+    msg_reset_display = 2,
+    msg_toggle_capture = 3,
+    msg_toggle_hud = 4
 } special_messages_t;
 
 typedef struct input_msg_s {
@@ -35,9 +49,20 @@ typedef struct input_msg_s {
     uint8_t value;
     uint8_t value2;
     uint32_t eventType;
+    uint32_t timestamp; // SDL ticks when the event was read
 } input_msg_s;
 
 
+void input_init(config_params_s *conf);
 input_msg_s get_input_msg(config_params_s *conf);
 
+/* Feed a button, keyjazz or special message from another thread. For normal
+   messages value holds the M8 key bits that are pressed or released.
+   timestamp is in SDL ticks. Returns 1 if the event was queued. */
+int input_send_external(input_type_t type, uint8_t value, uint8_t value2, int pressed,
+                        uint32_t timestamp);
+
+// Number of messages get_input_msg() will return before reading new events
+int input_pending();
+
 #endif
@@ -0,0 +1,255 @@
+#include "input_evdev.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "SDL2_compat.h"
+
+#define MAX_EVENT_DEVICES 32
+#define POLL_TIMEOUT_MS 100
+
+// M8 key bits and special messages indexed by evdev key code
+static uint8_t button_table[KEY_CNT];
+static uint8_t special_table[KEY_CNT];
+
+// Bits currently held by the hat axes, so a release knows what to clear
+static uint8_t hat_x = 0;
+static uint8_t hat_y = 0;
+
+static int fd = -1;
+static int replay = 0;
+static int monotonic_times = 0; // live event times are on CLOCK_MONOTONIC
+static int do_exit = 0;
+static SDL_Thread *evdev_thread = NULL;
+
+static void map_button(int code, uint8_t value) {
+    // First binding wins, like the keyboard
+    if (code > 0 && code < KEY_CNT && !button_table[code] && !special_table[code]) {
+        button_table[code] = value;
+    }
+}
+
+static void map_special(int code, uint8_t msg) {
+    if (code > 0 && code < KEY_CNT && !button_table[code] && !special_table[code]) {
+        special_table[code] = msg;
+    }
+}
+
+static void build_tables(config_params_s *conf) {
+    SDL_memset(button_table, 0, sizeof(button_table));
+    SDL_memset(special_table, 0, sizeof(special_table));
+
+    map_button(conf->button_up, key_up);
+    map_button(conf->button_left, key_left);
+    map_button(conf->button_down, key_down);
+    map_button(conf->button_right, key_right);
+    map_button(conf->button_select, key_select);
+    map_button(conf->button_start, key_start);
+    map_button(conf->button_opt, key_opt);
+    map_button(conf->button_edit, key_edit);
+    map_special(conf->button_reset, msg_reset_display);
+    map_special(conf->button_quit, msg_quit);
+    map_special(conf->button_hud, msg_toggle_hud);
+}
+
+static int has_key(int device_fd, int code) {
+    uint8_t bits[KEY_CNT / 8 + 1];
+    SDL_memset(bits, 0, sizeof(bits));
+    if (code <= 0 || code >= KEY_CNT ||
+        ioctl(device_fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) < 0) {
+        return 0;
+    }
+    return (bits[code / 8] >> (code % 8)) & 1;
+}
+
+// Pick the first event device that reports the configured edit and start buttons
+static int open_auto(config_params_s *conf, char *path, size_t path_size) {
+    for (int i = 0; i < MAX_EVENT_DEVICES; i++) {
+        snprintf(path, path_size, "/dev/input/event%d", i);
+        int device_fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (device_fd < 0) {
+            continue;
+        }
+        if (has_key(device_fd, conf->button_edit) && has_key(device_fd, conf->button_start)) {
+            return device_fd;
+        }
+        close(device_fd);
+    }
+    return -1;
+}
+
+static void handle_event(const struct input_event *ev, uint32_t timestamp) {
+    if (ev->type == EV_KEY && ev->code < KEY_CNT) {
+        // Ignore autorepeat, the M8 handles held buttons itself
+        if (ev->value == 2) {
+            return;
+        }
+        int pressed = ev->value != 0;
+        if (button_table[ev->code]) {
+            input_send_external(normal, button_table[ev->code], 0, pressed, timestamp);
+        } else if (special_table[ev->code]) {
+            input_send_external(special, special_table[ev->code], 0, pressed, timestamp);
+        }
+    } else if (ev->type == EV_ABS && (ev->code == ABS_HAT0X || ev->code == ABS_HAT0Y)) {
+        // D-pads that report as a hat switch
+        uint8_t *held = ev->code == ABS_HAT0X ? &hat_x : &hat_y;
+        uint8_t next = 0;
+        if (ev->value < 0) {
+            next = ev->code == ABS_HAT0X ? key_left : key_up;
+        } else if (ev->value > 0) {
+            next = ev->code == ABS_HAT0X ? key_right : key_down;
+        }
+        if (*held && *held != next) {
+            input_send_external(normal, *held, 0, 0, timestamp);
+        }
+        if (next && *held != next) {
+            input_send_external(normal, next, 0, 1, timestamp);
+        }
+        *held = next;
+    }
+}
+
+static uint64_t event_time_us(const struct input_event *ev) {
+    return (uint64_t) ev->time.tv_sec * 1000000 + ev->time.tv_usec;
+}
+
+// SDL ticks of a live event, from the kernel's CLOCK_MONOTONIC stamp
+static uint32_t live_event_ticks(const struct input_event *ev) {
+    if (!monotonic_times) {
+        return SDL_GetTicks();
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now_us = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    uint64_t t = event_time_us(ev);
+    uint32_t age_ms = now_us > t ? (uint32_t) ((now_us - t) / 1000) : 0;
+    return SDL_GetTicks() - age_ms;
+}
+
+static int evdev_loop(void *data) {
+    struct input_event events[64];
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+
+    // Replay: wall clock of the first event, to reproduce the recorded timing
+    uint64_t first_event_us = 0;
+    uint32_t replay_start_ticks = 0;
+
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        if (!replay) {
+            int rc = poll(&pfd, 1, POLL_TIMEOUT_MS);
+            if (rc <= 0) {
+                continue;
+            }
+        }
+
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            SDL_Log("evdev: read failed (%s), stopping input thread\n", strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            if (replay) {
+                SDL_Log("evdev: end of recorded input\n");
+                break;
+            }
+            continue;
+        }
+
+        int count = (int) (n / sizeof(struct input_event));
+        for (int i = 0; i < count && !__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE); i++) {
+            uint32_t timestamp;
+            if (replay) {
+                uint64_t t = event_time_us(&events[i]);
+                if (first_event_us == 0) {
+                    first_event_us = t;
+                    replay_start_ticks = SDL_GetTicks();
+                }
+                uint32_t due = replay_start_ticks + (uint32_t) ((t - first_event_us) / 1000);
+                // In short steps, a long gap in the recording must not hold up
+                // shutdown
+                int32_t wait;
+                while ((wait = (int32_t) (due - SDL_GetTicks())) > 0 &&
+                       !__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+                    SDL_Delay(wait > 100 ? 100 : wait);
+                }
+                // When the recording says it happened, so a late replay shows
+                // up as latency
+                timestamp = due;
+            } else {
+                timestamp = live_event_ticks(&events[i]);
+            }
+            handle_event(&events[i], timestamp);
+        }
+    }
+    return 0;
+}
+
+int evdev_init(config_params_s *conf) {
+    if (conf->evdev_device == NULL || SDL_strcmp(conf->evdev_device, "none") == 0) {
+        return 0;
+    }
+
+    build_tables(conf);
+
+    char path[256];
+    if (SDL_strcmp(conf->evdev_device, "auto") == 0) {
+        fd = open_auto(conf, path, sizeof(path));
+    } else {
+        snprintf(path, sizeof(path), "%s", conf->evdev_device);
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+    }
+
+    if (fd < 0) {
+        SDL_Log("evdev: could not open input device %s\n", conf->evdev_device);
+        return 0;
+    }
+
+    // A regular file is a recording, it is played back with its own timing
+    struct stat st;
+    replay = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (replay) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    } else {
+        // Event times default to the wall clock, which can jump
+        int clock = CLOCK_MONOTONIC;
+        monotonic_times = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+        if (!monotonic_times) {
+            SDL_Log("evdev: event times not on CLOCK_MONOTONIC, using read times\n");
+        }
+    }
+
+    do_exit = 0;
+    evdev_thread = SDL_CreateThread(&evdev_loop, NULL);
+    if (evdev_thread == NULL) {
+        close(fd);
+        fd = -1;
+        return 0;
+    }
+
+    SDL_Log("evdev: reading input from %s%s\n", path, replay ? " (recording)" : "");
+    return 1;
+}
+
+void evdev_destroy() {
+    if (evdev_thread == NULL) {
+        return;
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(evdev_thread, NULL);
+    evdev_thread = NULL;
+    close(fd);
+    fd = -1;
+}
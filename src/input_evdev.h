@@ -0,0 +1,14 @@
+#ifndef M8C_INPUT_EVDEV_H
+#define M8C_INPUT_EVDEV_H
+
+#include "config.h"
+
+/* Reads buttons straight from a Linux input device on its own thread and
+   feeds them into the normal input handling. conf->evdev_device is either a
+   device node, "auto" to pick the first device with the configured buttons,
+   or a file with a recorded event stream that is replayed in real time. */
+int evdev_init(config_params_s *conf);
+
+void evdev_destroy();
+
+#endif //M8C_INPUT_EVDEV_H
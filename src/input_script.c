@@ -0,0 +1,247 @@
+#include "input_script.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "SDL2_compat.h"
+
+#define POLL_TIMEOUT_MS 100
+#define LINE_SIZE 128
+#define DEFAULT_TAP_MS 50
+#define DEFAULT_VELOCITY 100
+
+static int fd = -1;
+static int is_fifo = 0;
+static int do_exit = 0;
+static SDL_Thread *script_thread = NULL;
+static char script_path[256];
+
+// Absolute time the next command is due, advanced by every wait
+static struct timespec due;
+
+static const struct {
+    const char *name;
+    uint8_t value;
+} buttons[] = {
+        {"up", key_up},
+        {"down", key_down},
+        {"left", key_left},
+        {"right", key_right},
+        {"select", key_select},
+        {"start", key_start},
+        {"opt", key_opt},
+        {"edit", key_edit},
+};
+
+static uint8_t button_value(const char *name) {
+    for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+        if (SDL_strcmp(name, buttons[i].name) == 0) {
+            return buttons[i].value;
+        }
+    }
+    return 0;
+}
+
+static void advance_due(int ms) {
+    due.tv_sec += ms / 1000;
+    due.tv_nsec += (long) (ms % 1000) * 1000000;
+    if (due.tv_nsec >= 1000000000) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000;
+    }
+}
+
+// Sleep until the due time in short steps so shutdown is not held up
+static void wait_ms(int ms) {
+    advance_due(ms);
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t left_ns = (int64_t) (due.tv_sec - now.tv_sec) * 1000000000 +
+                          (due.tv_nsec - now.tv_nsec);
+        if (left_ns <= 0) {
+            return;
+        }
+        if (left_ns > 100000000) {
+            SDL_Delay(100);
+        } else {
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        }
+    }
+}
+
+static void send_button(uint8_t value, int pressed) {
+    input_send_external(normal, value, 0, pressed, SDL_GetTicks());
+}
+
+static void run_line(char *line, int line_number) {
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+        *comment = '\0';
+    }
+
+    char command[16];
+    char arg1[16] = {0};
+    int arg2 = -1;
+    int fields = sscanf(line, "%15s %15s %d", command, arg1, &arg2);
+    if (fields < 1) {
+        return;
+    }
+
+    if (SDL_strcmp(command, "press") == 0 || SDL_strcmp(command, "release") == 0 ||
+        SDL_strcmp(command, "tap") == 0) {
+        uint8_t value = button_value(arg1);
+        if (value == 0) {
+            SDL_Log("Input script %s:%d: unknown button '%s'\n", script_path, line_number, arg1);
+            return;
+        }
+        if (command[0] == 'r') {
+            send_button(value, 0);
+        } else {
+            send_button(value, 1);
+            if (command[0] == 't') {
+                wait_ms(arg2 >= 0 ? arg2 : DEFAULT_TAP_MS);
+                send_button(value, 0);
+            }
+        }
+    } else if (SDL_strcmp(command, "note") == 0 && fields >= 2) {
+        int note = atoi(arg1);
+        int velocity = arg2 >= 0 ? arg2 : DEFAULT_VELOCITY;
+        input_send_external(keyjazz, note & 0x7F, velocity & 0x7F, 1, SDL_GetTicks());
+    } else if (SDL_strcmp(command, "noteoff") == 0 && fields >= 2) {
+        input_send_external(keyjazz, atoi(arg1) & 0x7F, 0, 0, SDL_GetTicks());
+    } else if (SDL_strcmp(command, "wait") == 0 && fields >= 2) {
+        wait_ms(atoi(arg1));
+    } else if (SDL_strcmp(command, "reset") == 0) {
+        input_send_external(special, msg_reset_display, 0, 1, SDL_GetTicks());
+        input_send_external(special, msg_reset_display, 0, 0, SDL_GetTicks());
+    } else if (SDL_strcmp(command, "quit") == 0) {
+        input_send_external(special, msg_quit, 0, 1, SDL_GetTicks());
+    } else {
+        SDL_Log("Input script %s:%d: cannot parse '%s'\n", script_path, line_number, line);
+    }
+}
+
+static int open_script() {
+    fd = open(script_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    is_fifo = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    return 1;
+}
+
+static int script_loop(void *data) {
+    char line[LINE_SIZE];
+    int line_len = 0;
+    int line_number = 0;
+    char buffer[512];
+
+    clock_gettime(CLOCK_MONOTONIC, &due);
+
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            SDL_Log("Input script: read failed (%s)\n", strerror(errno));
+            break;
+        }
+        if (n == 0) {
+            if (is_fifo) {
+                // Wait for the next writer
+                close(fd);
+                if (!open_script()) {
+                    break;
+                }
+                continue;
+            }
+            if (line_len > 0) {
+                // Last line without a newline
+                line[line_len] = '\0';
+                run_line(line, ++line_number);
+            }
+            break;
+        }
+
+        for (ssize_t i = 0; i < n && !__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE); i++) {
+            if (buffer[i] != '\n' && line_len < LINE_SIZE - 1) {
+                line[line_len++] = buffer[i];
+                continue;
+            }
+            if (buffer[i] != '\n') {
+                // Overlong line, the rest of it is dropped
+                continue;
+            }
+            line[line_len] = '\0';
+            line_len = 0;
+            line_number++;
+
+            // Commands arriving over a FIFO are timed from when they arrive
+            if (is_fifo) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (now.tv_sec > due.tv_sec ||
+                    (now.tv_sec == due.tv_sec && now.tv_nsec > due.tv_nsec)) {
+                    due = now;
+                }
+            }
+            run_line(line, line_number);
+        }
+    }
+
+    SDL_Log("Input script %s finished after %d lines\n", script_path, line_number);
+    return 0;
+}
+
+int input_script_init(config_params_s *conf) {
+    if (conf->input_script == NULL) {
+        return 0;
+    }
+
+    snprintf(script_path, sizeof(script_path), "%s", conf->input_script);
+    if (!open_script()) {
+        SDL_Log("Input script: could not open %s\n", script_path);
+        return 0;
+    }
+
+    do_exit = 0;
+    script_thread = SDL_CreateThread(&script_loop, NULL);
+    if (script_thread == NULL) {
+        close(fd);
+        fd = -1;
+        return 0;
+    }
+
+    SDL_Log("Input script: reading %s\n", script_path);
+    return 1;
+}
+
+void input_script_destroy() {
+    if (script_thread == NULL) {
+        return;
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(script_thread, NULL);
+    script_thread = NULL;
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef M8C_INPUT_SCRIPT_H
+#define M8C_INPUT_SCRIPT_H
+
+#include "config.h"
+
+/* Runs input scripts from conf->input_script on their own thread. A regular
+   file is played once, a FIFO is read line by line as commands arrive so a
+   test harness can keep writing to it. One command per line, # comments:
+
+     press <button>          hold a button (up down left right select start opt edit)
+     release <button>
+     tap <button> [ms]       press, hold for ms (default 50) and release
+     note <note> [velocity]  keyjazz note on, velocity defaults to 100
+     noteoff <note>
+     wait <ms>               waits add up from the start, so timing does not drift
+     reset                   redraw the M8 screen
+     quit
+
+   Everything is injected through input_send_external() and reaches the M8
+   the same way as keyboard input. */
+int input_script_init(config_params_s *conf);
+
+void input_script_destroy();
+
+#endif //M8C_INPUT_SCRIPT_H
@@ -0,0 +1,157 @@
+#include "latency_probe.h"
+
+#include <SDL.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "SDL2_compat.h"
+
+// Samples kept per stage, older ones are overwritten
+#define MAX_SAMPLES 1024
+
+// Report after this many complete measurements
+#define REPORT_EVERY 100
+
+// Give up on a press that did not change the screen
+#define PROBE_TIMEOUT_US 500000
+
+typedef enum {
+    STAGE_INPUT_USB,
+    STAGE_USB_DRAW,
+    STAGE_DRAW_PRESENT,
+    STAGE_TOTAL,
+    STAGE_MAX
+} probe_stage_t;
+
+static const char *stage_names[STAGE_MAX] = {"input->usb", "usb->draw", "draw->present",
+                                             "total"};
+
+typedef enum {
+    PROBE_IDLE,
+    PROBE_QUEUED,   // waiting for the write to be submitted
+    PROBE_SENT,     // waiting for the M8 to draw
+    PROBE_DRAWN     // waiting for the flip
+} probe_state_t;
+
+typedef struct {
+    uint32_t samples[MAX_SAMPLES];
+    uint32_t count;
+} stage_samples_s;
+
+static int enabled = 0;
+static probe_state_t state = PROBE_IDLE;
+static uint64_t input_us, sent_us, drawn_us;
+static stage_samples_s stages[STAGE_MAX];
+static uint32_t measured = 0;
+static uint32_t timeouts = 0;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void add_sample(probe_stage_t stage, uint64_t us) {
+    stage_samples_s *s = &stages[stage];
+    s->samples[s->count % MAX_SAMPLES] = (uint32_t) us;
+    s->count++;
+}
+
+void latency_probe_init(int enable) {
+    enabled = enable;
+    state = PROBE_IDLE;
+    measured = 0;
+    timeouts = 0;
+    SDL_memset(stages, 0, sizeof(stages));
+    if (enabled) {
+        SDL_Log("Latency probe enabled\n");
+    }
+}
+
+void latency_probe_input(uint32_t event_ticks) {
+    if (!enabled) {
+        return;
+    }
+    uint64_t now = now_us();
+    if (state != PROBE_IDLE && now - input_us < PROBE_TIMEOUT_US) {
+        return;
+    }
+    if (state != PROBE_IDLE) {
+        timeouts++;
+    }
+
+    // Input events carry SDL ticks, so the first stage has millisecond resolution
+    uint32_t age_ms = SDL_GetTicks() - event_ticks;
+    input_us = now - (uint64_t) age_ms * 1000;
+    state = PROBE_QUEUED;
+}
+
+void latency_probe_usb_sent() {
+    if (state != PROBE_QUEUED) {
+        return;
+    }
+    sent_us = now_us();
+    state = PROBE_SENT;
+}
+
+int latency_probe_waiting() {
+    return state == PROBE_SENT;
+}
+
+void latency_probe_draw() {
+    if (state != PROBE_SENT) {
+        return;
+    }
+    drawn_us = now_us();
+    if (drawn_us - input_us > PROBE_TIMEOUT_US) {
+        timeouts++;
+        state = PROBE_IDLE;
+        return;
+    }
+    state = PROBE_DRAWN;
+}
+
+void latency_probe_present() {
+    if (state != PROBE_DRAWN) {
+        return;
+    }
+    uint64_t presented_us = now_us();
+    add_sample(STAGE_INPUT_USB, sent_us - input_us);
+    add_sample(STAGE_USB_DRAW, drawn_us - sent_us);
+    add_sample(STAGE_DRAW_PRESENT, presented_us - drawn_us);
+    add_sample(STAGE_TOTAL, presented_us - input_us);
+    state = PROBE_IDLE;
+
+    if (++measured % REPORT_EVERY == 0) {
+        latency_probe_report();
+    }
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *) a;
+    uint32_t y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const uint32_t *sorted, uint32_t n, int p) {
+    uint32_t i = (uint32_t) ((uint64_t) (n - 1) * p / 100);
+    return sorted[i];
+}
+
+void latency_probe_report() {
+    if (!enabled || measured == 0) {
+        return;
+    }
+
+    static uint32_t sorted[MAX_SAMPLES];
+    SDL_Log("Latency probe: %u presses measured, %u without a screen change\n", measured,
+            timeouts);
+    for (int i = 0; i < STAGE_MAX; i++) {
+        uint32_t n = stages[i].count < MAX_SAMPLES ? stages[i].count : MAX_SAMPLES;
+        SDL_memcpy(sorted, stages[i].samples, n * sizeof(uint32_t));
+        qsort(sorted, n, sizeof(uint32_t), compare_u32);
+        SDL_Log("  %-14s p50 %6u us  p90 %6u us  p99 %6u us  max %6u us\n", stage_names[i],
+                percentile(sorted, n, 50), percentile(sorted, n, 90), percentile(sorted, n, 99),
+                sorted[n - 1]);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef M8C_LATENCY_PROBE_H
+#define M8C_LATENCY_PROBE_H
+
+#include <stdint.h>
+
+/* Measures how long a button press takes to show up on the panel, split into
+   three stages:
+     input -> USB      event read until the 'C' message is submitted
+     USB -> draw       submitted until the first text or rectangle command
+                       that changes pixels on the canvas
+     draw -> present   that command until SDL_Flip() returns
+   One press is followed at a time, all hooks run on the main thread. */
+void latency_probe_init(int enabled);
+
+// A controller message for an input read at event_ticks (SDL ticks) was queued
+void latency_probe_input(uint32_t event_ticks);
+
+// The queued messages were submitted to the M8
+void latency_probe_usb_sent();
+
+// Whether the probe waits for a draw, only then is the canvas compared
+int latency_probe_waiting();
+
+// A command that changed pixels on the canvas was processed
+void latency_probe_draw();
+
+// The screen was flipped
+void latency_probe_present();
+
+// Log percentiles for every stage
+void latency_probe_report();
+
+#endif //M8C_LATENCY_PROBE_H
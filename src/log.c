@@ -0,0 +1,739 @@
+#include "log.h"
+
+#include <SDL.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "stats.h"
+#include "SDL2_compat.h"
+
+#define LOG_MAX_THREADS 16
+
+// Per thread, a power of two
+#define RING_SIZE 16384
+
+// A record with its arguments, longer ones are cut short
+#define RECORD_MAX 512
+
+#define LINE_SIZE 1024
+#define OUT_SIZE 8192
+#define WRITER_POLL_MS 20
+
+#define RATE_SLOTS 32
+#define RATE_WINDOW_US 1000000
+
+// In log_record_s.level: only a count of suppressed messages, the format is not expanded
+#define LEVEL_SUMMARY 0x80
+
+typedef struct {
+    uint16_t size;       // of the whole record, a multiple of 8, 0 skips to the ring start
+    uint8_t level;
+    uint8_t category;
+    uint32_t suppressed; // earlier messages with this format held back by the rate limit
+    uint64_t ts_us;
+    const char *format;
+} log_record_s;
+
+/* Owned by the logging thread, except that the writer takes the suppressed
+   count of a window that is over. */
+typedef struct {
+    const char *format;
+    uint64_t window_us;
+    uint32_t count;
+    uint32_t suppressed;
+    uint8_t level;
+    uint8_t category;
+} rate_slot_s;
+
+typedef enum {
+    RING_FREE,
+    RING_OWNED,
+    RING_RETIRED // its thread exited, free again once drained
+} ring_state_t;
+
+typedef struct {
+    uint8_t data[RING_SIZE] __attribute__((aligned(8)));
+    uint32_t head;    // written by the owning thread
+    uint32_t tail;    // written by the writer
+    uint32_t dropped; // messages that found the ring full
+    int pushing;      // the owning thread is between its writer check and push
+    rate_slot_s rate[RATE_SLOTS];
+} log_ring_s;
+
+// A conversion of the format, as far as capturing its argument needs it
+typedef struct {
+    const char *start; // the '%'
+    const char *end;   // after the conversion character
+    int width_star;
+    int precision_star;
+    char length;       // 'H' for hh, 'q' for ll, else the modifier or 0
+    char conv;         // 0 when the format ends inside the conversion
+} spec_s;
+
+static const char *level_names[LOG_LEVELS] = {"debug", "info", "error", "critical"};
+static const char *level_tags[LOG_LEVELS] = {"DEBUG ", "", "ERROR ", "CRITICAL "};
+static const char *category_names[] = {"", "", "error", "system", "video", "input"};
+
+static log_ring_s *rings[LOG_MAX_THREADS];
+static int ring_states[LOG_MAX_THREADS];
+static uint32_t orphan_dropped = 0; // from threads that found no ring
+static __thread log_ring_s *local_ring = NULL;
+static __thread int local_full = 0;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static int min_level = LOG_INFO;
+static int writer_running = 0;
+static int do_exit = 0;
+static SDL_Thread *writer_thread = NULL;
+
+// Only the writer uses these
+static char out[OUT_SIZE];
+static int out_len = 0;
+static uint32_t dropped_reported = 0;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void retire_ring(void *ring) {
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        if (rings[i] == ring) {
+            __atomic_store_n(&ring_states[i], RING_RETIRED, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+static void create_ring_key() {
+    pthread_key_create(&ring_key, retire_ring);
+}
+
+static log_ring_s *thread_ring() {
+    if (local_ring != NULL || local_full) {
+        return local_ring;
+    }
+    pthread_once(&ring_key_once, create_ring_key);
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        int expected = RING_FREE;
+        if (!__atomic_compare_exchange_n(&ring_states[i], &expected, RING_OWNED, 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        log_ring_s *ring = rings[i];
+        if (ring == NULL) {
+            ring = calloc(1, sizeof(log_ring_s));
+            if (ring == NULL) {
+                __atomic_store_n(&ring_states[i], RING_FREE, __ATOMIC_RELEASE);
+                break;
+            }
+            __atomic_store_n(&rings[i], ring, __ATOMIC_RELEASE);
+        }
+        // Left by the thread that had it before
+        memset(ring->rate, 0, sizeof(ring->rate));
+        pthread_setspecific(ring_key, ring);
+        local_ring = ring;
+        return ring;
+    }
+    local_full = 1;
+    return NULL;
+}
+
+static int push(log_ring_s *ring, const uint8_t *record, uint32_t size);
+
+// Hands the writer what a slot held back before another format takes it
+static void push_summary(log_ring_s *ring, const rate_slot_s *slot, uint32_t suppressed,
+                         uint64_t now) {
+    log_record_s r = {sizeof(log_record_s), slot->level | LEVEL_SUMMARY, slot->category,
+                      suppressed, now, slot->format};
+    if (!push(ring, (const uint8_t *) &r, r.size)) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Whether a message with this format gets through, and how many before it
+   did not since it last did. */
+static int rate_allow(log_ring_s *ring, log_level_t level, int category, const char *format,
+                      uint64_t now, uint32_t *suppressed) {
+    rate_slot_s *slot = &ring->rate[((uintptr_t) format >> 3) % RATE_SLOTS];
+    if (slot->format != format || now - slot->window_us >= RATE_WINDOW_US) {
+        // The writer may have taken it already
+        uint32_t pending = __atomic_exchange_n(&slot->suppressed, 0, __ATOMIC_ACQ_REL);
+        *suppressed = 0;
+        if (slot->format == format) {
+            *suppressed = pending;
+        } else if (pending > 0) {
+            push_summary(ring, slot, pending, now);
+        }
+        slot->level = level;
+        slot->category = (uint8_t) category;
+        slot->count = 1;
+        __atomic_store_n(&slot->window_us, now, __ATOMIC_RELEASE);
+        __atomic_store_n(&slot->format, format, __ATOMIC_RELEASE);
+        return 1;
+    }
+    if (slot->count >= LOG_BURST) {
+        __atomic_add_fetch(&slot->suppressed, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    slot->count++;
+    *suppressed = 0;
+    return 1;
+}
+
+static const char *parse_spec(const char *p, spec_s *s) {
+    s->start = p++;
+    s->width_star = 0;
+    s->precision_star = 0;
+    s->length = 0;
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        p++;
+    }
+    if (*p == '*') {
+        s->width_star = 1;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9') {
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->precision_star = 1;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    if (*p == 'h' || *p == 'l') {
+        s->length = *p++;
+        if (*p == s->length) {
+            s->length = s->length == 'h' ? 'H' : 'q';
+            p++;
+        }
+    } else if (*p == 'j' || *p == 'z' || *p == 't' || *p == 'L') {
+        s->length = *p++;
+    }
+    s->conv = *p;
+    s->end = *p != '\0' ? p + 1 : p;
+    return s->end;
+}
+
+static int64_t signed_arg(char length, va_list *args) {
+    switch (length) {
+        case 'H': return (signed char) va_arg(*args, int);
+        case 'h': return (short) va_arg(*args, int);
+        case 'l': return va_arg(*args, long);
+        case 'q': return va_arg(*args, long long);
+        case 'j': return va_arg(*args, intmax_t);
+        case 'z': return va_arg(*args, ssize_t);
+        case 't': return va_arg(*args, ptrdiff_t);
+        default: return va_arg(*args, int);
+    }
+}
+
+static uint64_t unsigned_arg(char length, va_list *args) {
+    switch (length) {
+        case 'H': return (unsigned char) va_arg(*args, unsigned int);
+        case 'h': return (unsigned short) va_arg(*args, unsigned int);
+        case 'l': return va_arg(*args, unsigned long);
+        case 'q': return va_arg(*args, unsigned long long);
+        case 'j': return va_arg(*args, uintmax_t);
+        case 'z': return va_arg(*args, size_t);
+        case 't': return (uint64_t) va_arg(*args, ptrdiff_t);
+        default: return va_arg(*args, unsigned int);
+    }
+}
+
+/* Copies the arguments the format uses, each one as 8 bytes or a string as
+   its length and bytes. Returns the bytes written, stops when out is full. */
+static uint32_t capture(const char *format, va_list *args, uint8_t *buf, uint32_t space) {
+    uint32_t n = 0;
+    spec_s s;
+    for (const char *p = format; *p != '\0';) {
+        if (*p++ != '%') {
+            continue;
+        }
+        p = parse_spec(p - 1, &s);
+        if (s.conv == '%') {
+            continue;
+        }
+        if (s.conv == '\0') {
+            break;
+        }
+        int precision = -1;
+        int stars[2] = {s.width_star, s.precision_star};
+        for (int i = 0; i < 2; i++) {
+            if (stars[i]) {
+                int64_t v = va_arg(*args, int);
+                if (i == 1) {
+                    precision = (int) v;
+                }
+                if (n + 8 > space) {
+                    return n;
+                }
+                memcpy(buf + n, &v, 8);
+                n += 8;
+            }
+        }
+
+        if (s.conv == 's') {
+            const char *str = va_arg(*args, const char *);
+            if (str == NULL) {
+                str = "(null)";
+            }
+            size_t max = precision >= 0 && precision < LOG_MAX_STRING ? precision : LOG_MAX_STRING;
+            uint16_t len = (uint16_t) strnlen(str, max);
+            if (n + 2 + len > space) {
+                len = n + 2 < space ? space - n - 2 : 0;
+                if (len == 0) {
+                    return n;
+                }
+            }
+            memcpy(buf + n, &len, 2);
+            memcpy(buf + n + 2, str, len);
+            n += 2 + len;
+            continue;
+        }
+
+        uint64_t v;
+        switch (s.conv) {
+            case 'd':
+            case 'i':
+            case 'c':
+                v = (uint64_t) signed_arg(s.length, args);
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                v = unsigned_arg(s.length, args);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                double d = s.length == 'L' ? (double) va_arg(*args, long double)
+                                           : va_arg(*args, double);
+                memcpy(&v, &d, 8);
+                break;
+            }
+            case 'p':
+            case 'n':
+                v = (uintptr_t) va_arg(*args, void *);
+                break;
+            default:
+                // Not a conversion we know the argument of, nothing after it is safe
+                return n;
+        }
+        if (n + 8 > space) {
+            return n;
+        }
+        memcpy(buf + n, &v, 8);
+        n += 8;
+    }
+    return n;
+}
+
+static int push(log_ring_s *ring, const uint8_t *record, uint32_t size) {
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t pos = head % RING_SIZE;
+    uint32_t skip = RING_SIZE - pos < size ? RING_SIZE - pos : 0;
+    if (RING_SIZE - (head - tail) < skip + size) {
+        return 0;
+    }
+    if (skip > 0) {
+        ((log_record_s *) (ring->data + pos))->size = 0;
+        head += skip;
+        pos = 0;
+    }
+    memcpy(ring->data + pos, record, size);
+    __atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Level, category and time in front of every line, to line up with the flight recorder
+static int prefix(char *line, uint64_t ts_us, int level, int category) {
+    const char *name =
+            category > 0 && category < (int) (sizeof(category_names) / sizeof(category_names[0]))
+            ? category_names[category] : "";
+    return snprintf(line, LINE_SIZE, "%llu.%03u %s%s%s", (unsigned long long) (ts_us / 1000000),
+                    (unsigned int) (ts_us / 1000 % 1000), level_tags[level], name,
+                    name[0] != '\0' ? ": " : "");
+}
+
+static void print_line(char *line, int len, uint32_t suppressed, FILE *f) {
+    if (len >= LINE_SIZE) {
+        len = LINE_SIZE - 1;
+    }
+    // Messages come with and without a newline, each gets exactly one
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        len--;
+    }
+    if (suppressed > 0) {
+        len += snprintf(line + len, LINE_SIZE - len, " (%u more suppressed)", suppressed);
+        if (len >= LINE_SIZE) {
+            len = LINE_SIZE - 1;
+        }
+    }
+    line[len++] = '\n';
+
+    if (f != NULL) {
+        fwrite(line, 1, len, f);
+        return;
+    }
+    if (out_len + len > OUT_SIZE) {
+        fwrite(out, 1, out_len, stdout);
+        out_len = 0;
+    }
+    memcpy(out + out_len, line, len);
+    out_len += len;
+}
+
+// The format as it is, for a count of messages that were never captured
+static int format_summary(uint64_t ts_us, int level, int category, const char *format,
+                          uint32_t suppressed, char *line) {
+    int len = prefix(line, ts_us, level, category);
+    len += snprintf(line + len, LINE_SIZE - len, "%u more suppressed: %s", suppressed, format);
+    return len;
+}
+
+// The writer's side of capture()
+static int format_record(const log_record_s *r, char *line) {
+    const uint8_t *arg = (const uint8_t *) (r + 1);
+    const uint8_t *arg_end = (const uint8_t *) r + r->size;
+    int len = prefix(line, r->ts_us, r->level, r->category);
+    spec_s s;
+
+    for (const char *p = r->format; *p != '\0' && len < LINE_SIZE - 1;) {
+        if (*p != '%') {
+            line[len++] = *p++;
+            continue;
+        }
+        p = parse_spec(p, &s);
+        if (s.conv == '%') {
+            line[len++] = '%';
+            continue;
+        }
+        if (s.conv == '\0') {
+            break;
+        }
+
+        // The conversion again with the star values filled in and ll for integers
+        char spec[48];
+        int spec_len = 0;
+        int missing = 0;
+        for (const char *q = s.start; q < s.end - 1 && spec_len < 32; q++) {
+            if (*q == '*') {
+                int64_t v = 0;
+                if (arg + 8 <= arg_end) {
+                    memcpy(&v, arg, 8);
+                    arg += 8;
+                } else {
+                    missing = 1;
+                }
+                spec_len += snprintf(spec + spec_len, sizeof(spec) - spec_len, "%d", (int) v);
+            } else if (strchr("hljztL", *q) == NULL) {
+                spec[spec_len++] = *q;
+            }
+        }
+        if (strchr("diouxX", s.conv) != NULL) {
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+        }
+        spec[spec_len++] = s.conv;
+        spec[spec_len] = '\0';
+
+        int room = LINE_SIZE - len;
+        int n = 0;
+        if (s.conv == 's') {
+            uint16_t str_len;
+            if (missing || arg + 2 > arg_end) {
+                missing = 1;
+            } else {
+                memcpy(&str_len, arg, 2);
+                char str[LOG_MAX_STRING + 1];
+                if (str_len > LOG_MAX_STRING || arg + 2 + str_len > arg_end) {
+                    str_len = 0;
+                }
+                memcpy(str, arg + 2, str_len);
+                str[str_len] = '\0';
+                arg += 2 + str_len;
+                n = snprintf(line + len, room, spec, str);
+            }
+        } else if (s.conv == 'n') {
+            arg += 8;
+        } else if (missing || arg + 8 > arg_end || strchr("diouxXcfFeEgGaAp", s.conv) == NULL) {
+            missing = 1;
+        } else {
+            uint64_t v;
+            memcpy(&v, arg, 8);
+            arg += 8;
+            if (s.conv == 'p') {
+                n = snprintf(line + len, room, spec, (void *) (uintptr_t) v);
+            } else if (s.conv == 'c') {
+                n = snprintf(line + len, room, spec, (int) v);
+            } else if (strchr("diouxX", s.conv) != NULL) {
+                n = snprintf(line + len, room, spec, (long long) v);
+            } else {
+                double d;
+                memcpy(&d, &v, 8);
+                n = snprintf(line + len, room, spec, d);
+            }
+        }
+        if (missing) {
+            // The record was cut short
+            n = snprintf(line + len, room, "...");
+            len += n < room ? n : room - 1;
+            break;
+        }
+        len += n < room ? n : room - 1;
+    }
+    line[len < LINE_SIZE ? len : LINE_SIZE - 1] = '\0';
+    return len;
+}
+
+// The ring whose next record is the oldest, so threads interleave in time order
+static log_ring_s *oldest_ring() {
+    log_ring_s *oldest = NULL;
+    uint64_t oldest_ts = 0;
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring_s *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL) {
+            continue;
+        }
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        while (ring->tail != head) {
+            uint32_t pos = ring->tail % RING_SIZE;
+            const log_record_s *r = (const log_record_s *) (ring->data + pos);
+            if (r->size == 0) {
+                __atomic_store_n(&ring->tail, ring->tail + RING_SIZE - pos, __ATOMIC_RELEASE);
+                continue;
+            }
+            if (oldest == NULL || r->ts_us < oldest_ts) {
+                oldest = ring;
+                oldest_ts = r->ts_us;
+            }
+            break;
+        }
+    }
+    return oldest;
+}
+
+/* Bursts that ended: no later message of the same format will report what
+   they held back. A thread that exited has no later messages at all. */
+static void report_suppressed(log_ring_s *ring, uint64_t now, int all) {
+    char line[LINE_SIZE];
+    for (int i = 0; i < RATE_SLOTS; i++) {
+        rate_slot_s *slot = &ring->rate[i];
+        const char *format = __atomic_load_n(&slot->format, __ATOMIC_ACQUIRE);
+        uint64_t window_us = __atomic_load_n(&slot->window_us, __ATOMIC_ACQUIRE);
+        if (format == NULL || __atomic_load_n(&slot->suppressed, __ATOMIC_RELAXED) == 0 ||
+            (!all && now - window_us < RATE_WINDOW_US)) {
+            continue;
+        }
+        int level = __atomic_load_n(&slot->level, __ATOMIC_RELAXED);
+        int category = __atomic_load_n(&slot->category, __ATOMIC_RELAXED);
+        uint32_t suppressed = __atomic_exchange_n(&slot->suppressed, 0, __ATOMIC_ACQ_REL);
+        // The thread started a new window of the same format meanwhile, it
+        // reports the count with its next message
+        if (__atomic_load_n(&slot->format, __ATOMIC_ACQUIRE) == format &&
+            __atomic_load_n(&slot->window_us, __ATOMIC_ACQUIRE) != window_us) {
+            __atomic_add_fetch(&slot->suppressed, suppressed, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (suppressed > 0) {
+            int len = format_summary(now, level, category, format, suppressed, line);
+            print_line(line, len, 0, NULL);
+        }
+    }
+}
+
+static void drain() {
+    char line[LINE_SIZE];
+    log_ring_s *ring;
+    while ((ring = oldest_ring()) != NULL) {
+        const log_record_s *r = (const log_record_s *) (ring->data + ring->tail % RING_SIZE);
+        if (r->level & LEVEL_SUMMARY) {
+            int len = format_summary(r->ts_us, r->level & ~LEVEL_SUMMARY, r->category, r->format,
+                                     r->suppressed, line);
+            print_line(line, len, 0, NULL);
+        } else {
+            int len = format_record(r, line);
+            print_line(line, len, r->suppressed, NULL);
+        }
+        __atomic_store_n(&ring->tail, ring->tail + r->size, __ATOMIC_RELEASE);
+    }
+
+    uint32_t dropped = __atomic_load_n(&orphan_dropped, __ATOMIC_RELAXED);
+    uint64_t now = now_us();
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring_s *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        int state = __atomic_load_n(&ring_states[i], __ATOMIC_ACQUIRE);
+        if (ring == NULL || state == RING_FREE) {
+            continue;
+        }
+        dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        report_suppressed(ring, now, state == RING_RETIRED);
+        // A ring of a thread that exited can go to the next one once empty
+        if (state == RING_RETIRED &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+            __atomic_store_n(&ring_states[i], RING_FREE, __ATOMIC_RELEASE);
+        }
+    }
+    if (dropped != dropped_reported) {
+        int len = prefix(line, now_us(), LOG_ERROR, 0);
+        len += snprintf(line + len, LINE_SIZE - len, "%u log messages dropped, ring full",
+                        dropped - dropped_reported);
+        print_line(line, len, 0, NULL);
+        stats_add(STAT_LOG_DROPPED, dropped - dropped_reported);
+        dropped_reported = dropped;
+    }
+
+    if (out_len > 0) {
+        fwrite(out, 1, out_len, stdout);
+        out_len = 0;
+        fflush(stdout);
+    }
+}
+
+static int writer_loop(void *data) {
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        drain();
+        SDL_Delay(WRITER_POLL_MS);
+    }
+    drain();
+    return 0;
+}
+
+// Before log_init() and after log_shutdown(), and in the host tools
+static void print_now(log_level_t level, int category, const char *format, va_list args) {
+    char line[LINE_SIZE];
+    int len = prefix(line, now_us(), level, category);
+    len += vsnprintf(line + len, LINE_SIZE - len, format, args);
+    print_line(line, len, 0, stdout);
+    fflush(stdout);
+}
+
+static void push_message(log_ring_s *ring, log_level_t level, int category, const char *format,
+                         va_list args) {
+    uint64_t now = now_us();
+    uint32_t suppressed = 0;
+    if (!rate_allow(ring, level, category, format, now, &suppressed)) {
+        return;
+    }
+
+    uint8_t record[RECORD_MAX] __attribute__((aligned(8)));
+    log_record_s *r = (log_record_s *) record;
+    va_list copy;
+    va_copy(copy, args);
+    uint32_t size = sizeof(log_record_s) +
+                    capture(format, &copy, record + sizeof(log_record_s),
+                            RECORD_MAX - sizeof(log_record_s));
+    va_end(copy);
+    r->size = (uint16_t) ((size + 7) & ~7u);
+    r->level = level;
+    r->category = (uint8_t) category;
+    r->suppressed = suppressed;
+    r->ts_us = now;
+    r->format = format;
+
+    if (!push(ring, record, r->size)) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void log_writev(log_level_t level, int category, const char *format, va_list args) {
+    if ((int) level < __atomic_load_n(&min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        print_now(level, category, format, args);
+        return;
+    }
+
+    log_ring_s *ring = thread_ring();
+    if (ring == NULL) {
+        __atomic_add_fetch(&orphan_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    /* Checked again once the ring is marked busy. log_shutdown() clears
+       writer_running before it waits for busy rings, so either it waits for
+       this push or the message is printed here. */
+    __atomic_store_n(&ring->pushing, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&writer_running, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&ring->pushing, 0, __ATOMIC_RELEASE);
+        print_now(level, category, format, args);
+        return;
+    }
+    push_message(ring, level, category, format, args);
+    __atomic_store_n(&ring->pushing, 0, __ATOMIC_RELEASE);
+}
+
+void log_write(log_level_t level, int category, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_writev(level, category, format, args);
+    va_end(args);
+}
+
+void log_init() {
+    if (writer_thread != NULL) {
+        return;
+    }
+    do_exit = 0;
+    writer_thread = SDL_CreateThread(&writer_loop, NULL);
+    if (writer_thread != NULL) {
+        __atomic_store_n(&writer_running, 1, __ATOMIC_RELEASE);
+    }
+}
+
+void log_shutdown() {
+    if (writer_thread == NULL) {
+        return;
+    }
+    // New messages are printed right away, the writer prints the rest
+    __atomic_store_n(&writer_running, 0, __ATOMIC_SEQ_CST);
+    // including those still being pushed by threads that saw it running
+    for (int i = 0; i < LOG_MAX_THREADS; i++) {
+        log_ring_s *ring = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+        while (ring != NULL && __atomic_load_n(&ring->pushing, __ATOMIC_SEQ_CST)) {
+            SDL_Delay(1);
+        }
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(writer_thread, NULL);
+    writer_thread = NULL;
+    drain();
+}
+
+void log_set_level(log_level_t level) {
+    __atomic_store_n(&min_level, level, __ATOMIC_RELAXED);
+}
+
+log_level_t log_level_from_name(const char *name) {
+    for (int i = 0; i < LOG_LEVELS; i++) {
+        if (strcasecmp(name, level_names[i]) == 0) {
+            return i;
+        }
+    }
+    return LOG_INFO;
+}
+
+const char *log_level_name(log_level_t level) {
+    return level < LOG_LEVELS ? level_names[level] : "info";
+}
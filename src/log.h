@@ -0,0 +1,52 @@
+#ifndef M8C_LOG_H
+#define M8C_LOG_H
+
+#include <stdarg.h>
+
+/* Logging that never waits for the SD card. A message is not formatted
+   where it is logged: the format pointer and a binary copy of its arguments
+   go into a ring owned by the calling thread, without locks or system calls,
+   and a writer thread formats and prints them. A message that finds its
+   ring full is dropped and counted.
+
+   The format has to be a string literal, only its address is kept. %s
+   arguments are copied, at most LOG_MAX_STRING bytes of each.
+
+   The same message from one thread is printed at most LOG_BURST times a
+   second, the rest are counted and reported with the next one that gets
+   through, or by the writer once the second is over. Debug messages only
+   exist in builds with DEBUG_MSG, see SDL2_compat.h.
+
+   Until log_init() and after log_shutdown() messages are printed right
+   away, which is what the host tools get. log_shutdown() waits for messages
+   that are still being pushed and prints them before it returns. */
+
+typedef enum {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_ERROR,
+    LOG_CRITICAL,
+    LOG_LEVELS
+} log_level_t;
+
+#define LOG_MAX_STRING 128
+#define LOG_BURST 20
+
+void log_init();
+
+// Prints what is still queued and returns to printing right away
+void log_shutdown();
+
+// Messages below level are discarded where they are logged
+void log_set_level(log_level_t level);
+
+// level from a name, debug info error or critical, LOG_INFO if unknown
+log_level_t log_level_from_name(const char *name);
+const char *log_level_name(log_level_t level);
+
+// category is one of the SDL_LOG_CATEGORY_* values
+void log_write(log_level_t level, int category, const char *format, ...)
+        __attribute__((format(printf, 3, 4)));
+void log_writev(log_level_t level, int category, const char *format, va_list args);
+
+#endif //M8C_LOG_H
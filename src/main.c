@@ -6,16 +6,35 @@
 
 #include <SDL.h>
 #include <signal.h>
+#include <sys/resource.h>
 #include <libusb.h>
 
 #include "SDL2_inprint.h"
 #include "audio.h"
+#include "audio_capture.h"
+#include "audio_dsp.h"
 #include "command.h"
+#include "command_queue.h"
 #include "config.h"
+#include "control.h"
+#include "flight_recorder.h"
+#include "hud.h"
 #include "input.h"
+#include "input_evdev.h"
+#include "input_script.h"
+#include "latency_probe.h"
+#include "log.h"
+#include "midi.h"
+#include "protocol_profile.h"
 #include "render.h"
+#include "screen_model.h"
 #include "serial.h"
 #include "slip.h"
+#include "stats.h"
+#include "threads.h"
+#include "trace.h"
+#include "usb.h"
+#include "watchdog.h"
 #include "SDL2_compat.h"
 
 #define SDL_zero(x) SDL_memset(&(x), 0, sizeof((x)))
@@ -24,51 +43,104 @@ enum state {
     QUIT, WAIT_FOR_DEVICE, RUN
 };
 
+// Failed reads in a row before the connection is considered lost
+#define MAX_READ_ERRORS 8
+
+// With fast_reconnect, the last frame stays up this long before the
+// screensaver takes over
+#define RECONNECT_GRACE_MS 2000
+
+// Invalid draw commands in a row before the M8 is asked for a full redraw
+#define DESYNC_FAILURES 8
+
+// How often the idle CPU use is logged while waiting for the M8
+#define IDLE_REPORT_MS 60000
+
+// Delay between polls once the screensaver has stopped moving
+#define STATIC_POLL_MS 50
+
+static uint64_t process_cpu_ms() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
 enum state run = WAIT_FOR_DEVICE;
-uint8_t need_display_reset = 0;
+uint8_t need_display_reset = 0; // the SLIP framing was lost, set on the USB thread
+static uint32_t slip_invalid = 0; // packets the decoder rejected, taken by the main loop
 
 static slip_handler_s slip;
-static uint16_t zerobyte_packets = 0; // used to detect device disconnection
+static int read_errors = 0; // consecutive failed reads, see callback()
 static uint8_t *serial_buf = 0;
 static int port_inited = 0;
 static config_params_s conf;
 
-const int command_size = 4096;
-int writeCursor = 0;
-int readCursor = 0;
-uint8_t **command;
-uint32_t *command_sizes;
-
-void close_serial_port() { disconnect(); }
-
-int pullCommand(uint8_t *data, uint32_t size) {
+// Set while recovering from a lost connection, to time the first new frame
+static uint32_t ticks_connection_lost = 0;
+static uint32_t ticks_reconnected = 0;
 
-    uint8_t *recv_buf = malloc(size * sizeof(uint8_t));
-    memcpy(recv_buf, data, size);
-    free(command[writeCursor % command_size]);
-    command[writeCursor % command_size] = recv_buf;
+// With fast_reconnect only the USB side of audio is stopped, the output stays open
+static void drop_connection() {
+    if (conf.audio_enabled == 1) {
+        if (conf.fast_reconnect) {
+            audio_disconnect();
+        } else {
+            audio_destroy();
+        }
+    }
+    disconnect();
+}
 
-    command_sizes[writeCursor % command_size] = size;
-    writeCursor++;
-    return 1;
+static void connection_established() {
+    read_errors = 0;
+    usb_connect_result(1);
+    stats_add(STAT_CONNECTS, 1);
+    flight_record_event("connected");
+    if (ticks_connection_lost != 0) {
+        ticks_reconnected = SDL_GetTicks();
+    }
 }
 
-int popCommand(uint8_t **data, uint32_t *size) {
-    int compare = writeCursor - readCursor;
-    if (compare == 0) return 0;
-    *data = command[readCursor % command_size];
-    *size = command_sizes[readCursor % command_size];
-    readCursor++;
-    return compare;
+void close_serial_port() {
+    disconnect();
+    usb_shutdown();
 }
 
 void callback(struct libusb_transfer *xfr) {
-
-    if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
-        if (libusb_submit_transfer(xfr) < 0) {
-            SDL_Log("error re-submitting URB\n");
-        }
-        return;
+    TRACE_BEGIN(trace_read);
+
+    switch (xfr->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+            read_errors = 0;
+            stats_add(STAT_USB_READS, 1);
+            break;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+            // The M8 had nothing to send, any partial data is still handled
+            break;
+        case LIBUSB_TRANSFER_CANCELLED:
+            usb_read_finished(xfr);
+            return;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+            usb_report_lost("read failed, device gone");
+            usb_read_finished(xfr);
+            return;
+        default:
+            stats_add(STAT_USB_READ_ERRORS, 1);
+            // Retry a few times, then hand over to the connection manager
+            // instead of resubmitting a failing transfer forever
+            if (++read_errors > MAX_READ_ERRORS) {
+                usb_report_lost("repeated read errors");
+                usb_read_finished(xfr);
+                return;
+            }
+            if (libusb_submit_transfer(xfr) < 0) {
+                usb_report_lost("could not resubmit read");
+                usb_read_finished(xfr);
+            }
+            return;
     }
 
     int bytes_read = xfr->actual_length;
@@ -77,45 +149,33 @@ void callback(struct libusb_transfer *xfr) {
                         (int) bytes_read);
         run = QUIT;
     } else if (bytes_read > 0) {
-        zerobyte_packets = 0;
+        usb_report_data(bytes_read);
+        flight_record(FLIGHT_DISPLAY, xfr->buffer, bytes_read);
         serial_buf = xfr->buffer;
         uint8_t *cur = serial_buf;
         const uint8_t *end = serial_buf + bytes_read;
+        TRACE_BEGIN(trace_slip);
         while (cur < end) {
             // process the incoming bytes into commands and draw them
             int n = slip_read_byte(&slip, *(cur++));
             if (n != SLIP_NO_ERROR) {
+                stats_add(STAT_SLIP_ERRORS, 1);
+                flight_record_event("SLIP error %d", n);
                 if (n == SLIP_ERROR_INVALID_PACKET) {
-                    need_display_reset = 1;
+                    __atomic_add_fetch(&slip_invalid, 1, __ATOMIC_RELAXED);
                 } else {
                     SDL_LogError(SDL_LOG_CATEGORY_ERROR, "SLIP error %d\n", n);
+                    __atomic_store_n(&need_display_reset, 1, __ATOMIC_RELEASE);
                 }
             }
         }
-    } else {
-        // zero byte packet, increment counter
-        zerobyte_packets++;
-        if (zerobyte_packets > conf.wait_packets) {
-            zerobyte_packets = 0;
-
-            // try opening the serial port to check if it's alive
-            if (!check_serial_port()) {
-                port_inited = 0;
-                run = WAIT_FOR_DEVICE;
-                close_serial_port();
-                if (conf.audio_enabled == 1) {
-                    audio_destroy();
-                }
-                /* we'll make one more loop to see if the device is still there
-                 * but just sending zero bytes. if it doesn't get detected when
-                 * resetting the port, it will disconnect */
-            }
-        }
+        TRACE_END(TRACE_SLIP_DECODE, trace_slip, bytes_read);
     }
     if (libusb_submit_transfer(xfr) < 0) {
-        SDL_Log("error re-submitting URB\n");
-//        SDL_free(xfr->buffer);
+        usb_report_lost("could not resubmit read");
+        usb_read_finished(xfr);
     }
+    TRACE_END(TRACE_USB_READ, trace_read, xfr->actual_length);
 }
 
 // Handles CTRL+C / SIGINT
@@ -125,8 +185,7 @@ void intHandler(int dummy) { run = QUIT; }
 
 int main(int argc, char *argv[]) {
 
-    command = malloc(sizeof(uint8_t *) * command_size);
-    command_sizes = malloc(sizeof(uint32_t *) * command_size);
+    command_queue_init();
 
     char *preferred_device = NULL;
     if (argc == 3 && strcmp(argv[1], "--dev") == 0) {
@@ -140,6 +199,22 @@ int main(int argc, char *argv[]) {
 
     // TODO: take cli parameter to override default configfile location
     read_config(&conf);
+    // From here on nothing waits for log.txt to be written
+    log_set_level(conf.log_level);
+    log_init();
+    trace_init(conf.trace_path);
+    flight_recorder_init(conf.flight_recorder, conf.flight_recorder_kb);
+
+    // Scheduling for the USB and audio threads is applied when they start
+    threads_init(&conf);
+
+    input_init(&conf);
+    latency_probe_init(conf.latency_probe);
+    hud_init(conf.show_hud);
+    protocol_profile_init(conf.protocol_profile);
+
+    audio_dsp_init(conf.audio_gain, conf.audio_limiter, conf.audio_downmix);
+    audio_set_silence_hold(conf.audio_silence_hold_ms);
 
     // allocate memory for serial buffer
     serial_buf = SDL_malloc(serial_read_size);
@@ -171,6 +246,7 @@ int main(int argc, char *argv[]) {
     if (conf.wait_for_device == 0) {
         if (init_serial(1, preferred_device) == 0) {
             SDL_free(serial_buf);
+            log_shutdown();
             return -1;
         }
     }
@@ -178,24 +254,45 @@ int main(int argc, char *argv[]) {
     // initialize all SDL systems
     if (initialize_sdl(conf.init_fullscreen, conf.init_use_gpu) == -1)
         run = QUIT;
+    screen_model_init(conf.verify_repaint);
+
+    // Gamepad events are delivered through the SDL event queue
+    evdev_init(&conf);
+    midi_init(&conf);
+    input_script_init(&conf);
+    control_init(&conf);
+    watchdog_init(&conf);
+
+    // Only now, so the helper threads above do not inherit it
+    threads_apply(THREAD_ROLE_RENDER);
 
     // main loop begin
     do {
         // try to init serial port
         port_inited = init_serial(1, preferred_device);
         // if port init was successful, try to enable and reset display
-        if (port_inited == 1 && enable_and_reset_display(0) == 1) {
+        if (port_inited == 1 && enable_and_reset_display(0) > 0) {
             // if audio routing is enabled, try to initialize audio devices
             if (conf.audio_enabled == 1) {
                 audio_init(conf.audio_buffer_size, conf.audio_device_name);
-                // if audio is enabled, reset the display for second time to avoid glitches
-                reset_display();
+                // if audio is enabled, reset the display for second time to avoid glitches.
+                // Reopening only the interface is quick enough to skip it.
+                if (!(conf.fast_reconnect && ticks_connection_lost != 0)) {
+                    reset_display();
+                }
             }
+            connection_established();
             run = RUN;
             async_read(serial_buf, serial_read_size, callback);
         } else {
             SDL_LogCritical(SDL_LOG_CATEGORY_ERROR,
                             "Device not detected on begin loop.");
+            if (port_inited == 1) {
+                // Opened but not answering, start over on the next attempt
+                disconnect();
+                port_inited = 0;
+            }
+            usb_connect_result(0);
             if (conf.wait_for_device == 1) {
                 run = WAIT_FOR_DEVICE;
             } else {
@@ -205,31 +302,72 @@ int main(int argc, char *argv[]) {
 
         // wait until device is connected
         if (conf.wait_for_device == 1) {
-            static uint32_t ticks_poll_device = 0;
             static uint32_t ticks_update_screen = 0;
-
-            if (port_inited == 0) {
+            int screensaver_active = 0;
+            int screensaver_static = 0;
+            uint32_t ticks_screensaver_start = 0;
+            uint32_t frames_drawn = 0;
+            uint32_t ticks_idle_report = SDL_GetTicks();
+            uint64_t cpu_idle_report = process_cpu_ms();
+            uint32_t frame_ms = 1000 / conf.screensaver_fps;
+
+            // After a dropout the last frame is kept for a moment, a loose
+            // cable usually comes back before the screensaver is needed
+            int keep_frame = conf.fast_reconnect && ticks_connection_lost != 0;
+            if (port_inited == 0 && !keep_frame) {
                 screensaver_init();
+                screensaver_active = 1;
+                ticks_screensaver_start = SDL_GetTicks();
             }
 
             while (run == WAIT_FOR_DEVICE) {
+                watchdog_beat(WATCHDOG_RENDER);
                 // get current input
-                input_msg_s input = get_input_msg(&conf);
-                if (input.type == special && input.value == msg_quit) {
-                    SDL_LogCritical(SDL_LOG_CATEGORY_ERROR, "Input message QUIT.");
-                    run = QUIT;
+                do {
+                    input_msg_s input = get_input_msg(&conf);
+                    if (input.type == special && input.value == msg_quit) {
+                        SDL_LogCritical(SDL_LOG_CATEGORY_ERROR, "Input message QUIT.");
+                        run = QUIT;
+                    }
+                } while (input_pending() > 0);
+
+                if (!screensaver_active &&
+                    SDL_GetTicks() - ticks_connection_lost > RECONNECT_GRACE_MS) {
+                    screensaver_init();
+                    screensaver_active = 1;
+                    ticks_screensaver_start = SDL_GetTicks();
                 }
 
-                if (SDL_GetTicks() - ticks_update_screen > 16) {
+                // Nobody is watching a cube that has spun for a minute, leave
+                // the last frame up and stop spending CPU on it
+                if (screensaver_active && !screensaver_static && conf.screensaver_static_s > 0 &&
+                    SDL_GetTicks() - ticks_screensaver_start >
+                        (uint32_t) conf.screensaver_static_s * 1000) {
+                    screensaver_static = 1;
+                }
+
+                if (screensaver_active && !screensaver_static &&
+                    SDL_GetTicks() - ticks_update_screen >= frame_ms) {
                     ticks_update_screen = SDL_GetTicks();
                     screensaver_draw();
                     render_screen();
+                    frames_drawn++;
+                }
+
+                if (SDL_GetTicks() - ticks_idle_report >= IDLE_REPORT_MS) {
+                    uint64_t cpu = process_cpu_ms();
+                    SDL_Log("Waiting for device: %u ms CPU and %u screensaver frames in the last %u s",
+                            (unsigned int) (cpu - cpu_idle_report), frames_drawn,
+                            (SDL_GetTicks() - ticks_idle_report) / 1000);
+                    ticks_idle_report = SDL_GetTicks();
+                    cpu_idle_report = cpu;
+                    frames_drawn = 0;
                 }
 
-                // Poll for M8 device every second
-                if (port_inited == 0 && (SDL_GetTicks() - ticks_poll_device > 1000)) {
-                    ticks_poll_device = SDL_GetTicks();
-                    if (run == WAIT_FOR_DEVICE && init_serial(0, preferred_device) == 1) {
+                // Open the M8 as soon as it is plugged in, or poll for it with
+                // backoff when hotplug is not available
+                if (port_inited == 0 && run == WAIT_FOR_DEVICE && usb_connect_due()) {
+                    if (init_serial(0, preferred_device) == 1) {
 
                         if (conf.audio_enabled == 1) {
                             if (audio_init(conf.audio_buffer_size, conf.audio_device_name) == 0) {
@@ -240,19 +378,26 @@ int main(int argc, char *argv[]) {
 
                         int result = enable_and_reset_display();
                         // Device was found; enable display and proceed to the main loop
-                        if (result == 1) {
+                        if (result > 0) {
+                            connection_established();
                             run = RUN;
                             port_inited = 1;
-                            screensaver_destroy();
+                            if (screensaver_active) {
+                                screensaver_destroy();
+                            }
                             async_read(serial_buf, serial_read_size, callback);
                         } else {
-                            SDL_LogCritical(SDL_LOG_CATEGORY_ERROR, "Device not detected.");
-                            run = QUIT;
-                            screensaver_destroy();
+                            SDL_LogCritical(SDL_LOG_CATEGORY_ERROR,
+                                            "Device not responding, retrying.");
+                            drop_connection();
+                            usb_connect_result(0);
                         }
+                    } else {
+                        usb_connect_result(0);
                     }
                 }
-                SDL_Delay(conf.idle_ms);
+                SDL_Delay(screensaver_static && conf.idle_ms < STATIC_POLL_MS ? STATIC_POLL_MS
+                                                                                : conf.idle_ms);
             }
         } else {
             // classic startup behaviour, exit if device is not found
@@ -263,6 +408,7 @@ int main(int argc, char *argv[]) {
                 close_renderer();
                 kill_inline_font();
                 SDL_free(serial_buf);
+                log_shutdown();
                 SDL_Quit();
                 return -1;
             }
@@ -270,55 +416,133 @@ int main(int argc, char *argv[]) {
 
         // main loop
         while (run == RUN) {
+            watchdog_beat(WATCHDOG_RENDER);
+
+            // The M8 was unplugged or stopped responding
+            if (usb_device_lost()) {
+                stats_add(STAT_CONNECTIONS_LOST, 1);
+                ticks_connection_lost = SDL_GetTicks();
+                ticks_reconnected = 0;
+                drop_connection();
+                usb_lost_handled();
+                port_inited = 0;
+                run = conf.wait_for_device == 1 ? WAIT_FOR_DEVICE : QUIT;
+                break;
+            }
 
-            // get current inputs
-            input_msg_s input = get_input_msg(&conf);
-            switch (input.type) {
-                case normal:
-                    if (input.value != prev_input) {
-                        prev_input = input.value;
-                        send_msg_controller(input.value);
-                    }
-                    break;
-                case keyjazz:
-                    if (input.value != 0) {
-                        if (input.eventType == SDL_KEYDOWN && input.value != prev_input) {
-                            send_msg_keyjazz(input.value, input.value2);
-                            prev_note = input.value;
-                        } else if (input.eventType == SDL_KEYUP && input.value == prev_note) {
-                            send_msg_keyjazz(0xFF, 0);
+            // get current inputs, all events read this iteration are handled
+            // before drawing
+            do {
+                input_msg_s input = get_input_msg(&conf);
+                switch (input.type) {
+                    case normal:
+                        if (input.value != prev_input) {
+                            prev_input = input.value;
+                            send_msg_controller(input.value);
+                            latency_probe_input(input.timestamp);
                         }
-                    }
-                    prev_input = input.value;
-                    break;
-                case special:
-                    if (input.value != prev_input) {
-                        prev_input = input.value;
-                        switch (input.value) {
-                            case msg_quit:
-                                SDL_Log("Received msg_quit from input device.");
-                                run = 0;
-                                break;
-                            case msg_reset_display:
-                                reset_display();
-                                break;
-                            default:
-                                break;
+                        break;
+                    case keyjazz:
+                        if (input.value != 0) {
+                            if (input.eventType == SDL_KEYDOWN && input.value != prev_input) {
+                                send_msg_keyjazz(input.value, input.value2);
+                                prev_note = input.value;
+                            } else if (input.eventType == SDL_KEYUP && input.value == prev_note) {
+                                send_msg_keyjazz(0xFF, 0);
+                            }
                         }
+                        prev_input = input.value;
                         break;
-                    }
-            }
+                    case special:
+                        if (input.value != prev_input) {
+                            prev_input = input.value;
+                            switch (input.value) {
+                                case msg_quit:
+                                    SDL_Log("Received msg_quit from input device.");
+                                    run = 0;
+                                    break;
+                                case msg_reset_display:
+                                    reset_display();
+                                    break;
+                                case msg_toggle_capture:
+                                    if (conf.audio_enabled == 1) {
+                                        audio_capture_toggle();
+                                    }
+                                    break;
+                                case msg_toggle_hud:
+                                    toggle_hud();
+                                    break;
+                                default:
+                                    break;
+                            }
+                            break;
+                        }
+                }
+            } while (input_pending() > 0);
 
+            // Everything queued by the inputs above goes out as one write
+            send_queued_messages();
 
             uint8_t * com;
             uint32_t size;
             int draws = 0;
-            while (popCommand(&com, &size) > 0) {
-                process_command(com, size);
+            int waiting, queue_depth = 0, invalid = 0;
+            static int desync_failures = 0;
+            static int desync_reset_sent = 0;
+            uint32_t rejected = __atomic_exchange_n(&slip_invalid, 0, __ATOMIC_ACQ_REL);
+            if (rejected > 0) {
+                SDL_Log("%u invalid packets from the M8\n", rejected);
+                screen_model_invalidate("invalid packet");
+                desync_failures += rejected;
+            }
+            TRACE_BEGIN(trace_process);
+            while ((waiting = popCommand(&com, &size)) > 0) {
+                if (draws == 0) {
+                    queue_depth = waiting;
+                    TRACE_COUNTER(TRACE_QUEUE_DEPTH, waiting);
+                }
+                watchdog_note_command(com, size);
+                if (!process_command(com, size)) {
+                    flight_record_event("invalid command 0x%02x, %u bytes", com[0], size);
+                    SDL_Log("Invalid command 0x%02x, %u bytes\n", com[0], size);
+                    screen_model_invalidate("invalid command");
+                    desync_failures++;
+                    invalid++;
+                } else {
+                    desync_failures = 0;
+                    desync_reset_sent = 0;
+                }
                 draws++;
             }
+            if (draws > 0) {
+                TRACE_END(TRACE_PROCESS_COMMANDS, trace_process, draws);
+                hud_commands(draws, queue_depth, invalid);
+            }
+
+            // A stray bad packet costs at most the cells it would have drawn.
+            // Only a run of them or lost framing asks the M8 for a full
+            // redraw, and only once until valid commands arrive again.
+            int framing_lost = __atomic_exchange_n(&need_display_reset, 0, __ATOMIC_ACQ_REL);
+            if (!desync_reset_sent && (framing_lost || desync_failures >= DESYNC_FAILURES)) {
+                if (framing_lost) {
+                    screen_model_invalidate("SLIP framing lost");
+                }
+                SDL_Log("Display out of sync, requesting a redraw");
+                reset_display();
+                desync_reset_sent = 1;
+                desync_failures = 0;
+            }
             if (draws>0) {
                 render_screen();
+
+                if (ticks_reconnected != 0) {
+                    uint32_t now = SDL_GetTicks();
+                    SDL_Log("First frame %u ms after the connection dropped, %u ms after "
+                            "reconnecting\n", now - ticks_connection_lost,
+                            now - ticks_reconnected);
+                    ticks_connection_lost = 0;
+                    ticks_reconnected = 0;
+                }
             }
 
             SDL_Delay(conf.idle_ms);
@@ -328,13 +552,29 @@ int main(int argc, char *argv[]) {
 
     // exit, clean up
     SDL_Log("Shutting down\n");
+    evdev_destroy();
+    midi_destroy();
+    input_script_destroy();
+    watchdog_destroy();
+    control_destroy();
+    latency_probe_report();
+    protocol_profile_report();
     if (conf.audio_enabled == 1) {
         audio_destroy();
     }
+    audio_capture_destroy();
     close_renderer();
     close_serial_port();
+    trace_shutdown();
+    flight_recorder_close();
+    if (command_queue_overflows() > 0) {
+        SDL_Log("%u draw commands were dropped, the queue was full\n",
+                command_queue_overflows());
+    }
+    command_queue_destroy();
     SDL_free(serial_buf);
     kill_inline_font();
+    log_shutdown();
     SDL_Quit();
     return 0;
 }
@@ -0,0 +1,259 @@
+#include "midi.h"
+
+#include <SDL.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "threads.h"
+#include "SDL2_compat.h"
+#ifdef USE_LIBUSB
+#include "usb.h"
+#endif
+
+#define POLL_TIMEOUT_MS 100
+#define NO_NOTE 0xFF
+
+static int fd = -1;
+static int is_fifo = 0;
+static int do_exit = 0;
+static SDL_Thread *midi_thread = NULL;
+static char device_path[256];
+
+// 0 receives all channels, 1-16 only that one
+static int channel_filter = 0;
+
+// Parser state, running status is kept across reads
+static uint8_t status = 0;
+static uint8_t data[2];
+static int data_count = 0;
+
+// The M8 plays one keyjazz note at a time
+static uint8_t sounding_note = NO_NOTE;
+
+static uint32_t notes_on = 0;
+static uint32_t notes_off = 0;
+static uint32_t send_failures = 0;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void send_note(uint8_t note, uint8_t velocity, int on, uint64_t received_us) {
+#ifdef USE_LIBUSB
+    if (send_keyjazz_direct(on ? note : NO_NOTE, on ? velocity : 0, received_us) < 0) {
+        send_failures++;
+    }
+#else
+    // Without a direct path, go through the main loop like the keyboard
+    input_send_external(keyjazz, note, velocity, on, SDL_GetTicks());
+#endif
+}
+
+static void note_on(uint8_t note, uint8_t velocity, uint64_t received_us) {
+    sounding_note = note;
+    notes_on++;
+    send_note(note, velocity, 1, received_us);
+}
+
+static void note_off(uint8_t note, uint64_t received_us) {
+    // Releasing an older note must not cut off the one that replaced it
+    if (note != sounding_note) {
+        return;
+    }
+    sounding_note = NO_NOTE;
+    notes_off++;
+    send_note(note, 0, 0, received_us);
+}
+
+static int message_length(uint8_t status_byte) {
+    switch (status_byte & 0xF0) {
+        case 0xC0:
+        case 0xD0:
+            return 1;
+        case 0xF0:
+            // System common messages, MTC quarter frame and song select have
+            // one data byte, song position two, the rest none
+            if (status_byte == 0xF1 || status_byte == 0xF3) return 1;
+            if (status_byte == 0xF2) return 2;
+            return 0;
+        default:
+            return 2;
+    }
+}
+
+static void parse_byte(uint8_t byte, uint64_t received_us) {
+    if (byte >= 0xF8) {
+        // Realtime messages can appear anywhere and do not touch running status
+        return;
+    }
+
+    if (byte & 0x80) {
+        status = byte;
+        data_count = 0;
+        if (byte >= 0xF0) {
+            // System messages cancel running status, sysex data is skipped
+            // until the next status byte
+            if (message_length(byte) == 0) {
+                status = 0;
+            }
+        }
+        return;
+    }
+
+    if (status == 0 || status == 0xF0) {
+        return;
+    }
+
+    data[data_count++] = byte;
+    if (data_count < message_length(status)) {
+        return;
+    }
+    data_count = 0;
+
+    if (status >= 0xF0) {
+        status = 0;
+        return;
+    }
+
+    int channel = (status & 0x0F) + 1;
+    if (channel_filter != 0 && channel != channel_filter) {
+        return;
+    }
+
+    switch (status & 0xF0) {
+        case 0x90:
+            if (data[1] > 0) {
+                note_on(data[0], data[1], received_us);
+            } else {
+                note_off(data[0], received_us);
+            }
+            break;
+        case 0x80:
+            note_off(data[0], received_us);
+            break;
+        default:
+            break;
+    }
+}
+
+static int open_device() {
+    fd = open(device_path, O_RDONLY | O_NONBLOCK);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    is_fifo = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    return 1;
+}
+
+static int midi_loop(void *unused) {
+    // Notes are as timing critical as the USB traffic they turn into
+    threads_apply(THREAD_ROLE_USB);
+
+    uint8_t buffer[256];
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        uint64_t received_us = now_us();
+
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            SDL_Log("MIDI: read failed (%s), stopping MIDI input\n", strerror(errno));
+            break;
+        }
+
+        if (n == 0) {
+            if (is_fifo) {
+                // The writer went away, reopen to wait for the next one
+                close(fd);
+                if (!open_device()) {
+                    break;
+                }
+                continue;
+            }
+            SDL_Log("MIDI: end of input\n");
+            break;
+        }
+
+        for (ssize_t i = 0; i < n; i++) {
+            parse_byte(buffer[i], received_us);
+        }
+    }
+
+    if (sounding_note != NO_NOTE) {
+        note_off(sounding_note, now_us());
+    }
+    return 0;
+}
+
+int midi_init(config_params_s *conf) {
+    if (conf->midi_device == NULL) {
+        return 0;
+    }
+
+    snprintf(device_path, sizeof(device_path), "%s", conf->midi_device);
+    channel_filter = conf->midi_channel;
+    status = 0;
+    data_count = 0;
+    sounding_note = NO_NOTE;
+
+    if (!open_device()) {
+        SDL_Log("MIDI: could not open %s\n", device_path);
+        return 0;
+    }
+
+    do_exit = 0;
+    midi_thread = SDL_CreateThread(&midi_loop, NULL);
+    if (midi_thread == NULL) {
+        close(fd);
+        fd = -1;
+        return 0;
+    }
+
+    if (channel_filter) {
+        SDL_Log("MIDI: reading notes from %s on channel %d\n", device_path, channel_filter);
+    } else {
+        SDL_Log("MIDI: reading notes from %s on all channels\n", device_path);
+    }
+    return 1;
+}
+
+void midi_destroy() {
+    if (midi_thread == NULL) {
+        return;
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(midi_thread, NULL);
+    midi_thread = NULL;
+    if (fd >= 0) {
+        close(fd);
+        fd = -1;
+    }
+
+    SDL_Log("MIDI: %u notes on, %u notes off, %u sends failed\n", notes_on, notes_off,
+            send_failures);
+#ifdef USE_LIBUSB
+    usb_out_stats_s stats;
+    usb_get_out_stats(&stats);
+    if (stats.direct > 0) {
+        SDL_Log("MIDI: note to wire latency avg %u us max %u us\n",
+                (uint32_t) (stats.direct_latency_us_total / stats.direct),
+                stats.direct_latency_us_max);
+    }
+#endif
+}
@@ -0,0 +1,13 @@
+#ifndef M8C_MIDI_H
+#define M8C_MIDI_H
+
+#include "config.h"
+
+/* Reads MIDI note messages from conf->midi_device on its own thread and
+   plays them on the M8 as keyjazz. The device can be a raw MIDI port such as
+   /dev/snd/midiC1D0, a FIFO or a file with a recorded byte stream. */
+int midi_init(config_params_s *conf);
+
+void midi_destroy();
+
+#endif //M8C_MIDI_H
@@ -0,0 +1,279 @@
+#include "protocol_profile.h"
+
+#include <SDL.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL2_compat.h"
+
+#define PROFILE_WINDOW_MS 10000
+
+// Windows kept for the report, older ones are only in the totals
+#define MAX_WINDOWS 360
+
+// Rectangles drawn since the last present that are checked for being covered
+#define MAX_PENDING_RECTS 512
+
+// Character origins tracked, in M8 coordinates
+#define CELL_MAP_W 320
+#define CELL_MAP_H 256
+
+// Largest glyph, a rectangle this far above or left of a character covers it
+#define MAX_GLYPH 12
+
+typedef enum {
+    TYPE_RECT,
+    TYPE_CHAR,
+    TYPE_WAVEFORM,
+    TYPE_JOYPAD,
+    TYPE_SYSTEM_INFO,
+    TYPE_INVALID,
+    TYPE_COUNT
+} packet_type_t;
+
+static const char *type_names[TYPE_COUNT] = {"rect", "char", "waveform", "joypad",
+                                             "system_info", "invalid"};
+
+typedef struct {
+    uint32_t start_ms;
+    uint32_t length_ms;
+    uint32_t count[TYPE_COUNT];
+    uint32_t bytes[TYPE_COUNT];
+    uint32_t same_chars;
+    uint32_t overwritten_rects;
+    uint32_t same_waveforms;
+    uint32_t same_waveform_bytes;
+    uint32_t presents;
+} window_s;
+
+typedef struct {
+    int x1, y1, x2, y2;
+    uint8_t overwritten;
+} pending_rect_s;
+
+static int enabled = 0;
+static uint32_t ticks_start = 0;
+static window_s current;
+static window_s totals;
+static window_s windows[MAX_WINDOWS];
+static uint32_t window_count = 0;
+
+static pending_rect_s pending[MAX_PENDING_RECTS];
+static int pending_count = 0;
+
+// What each character origin shows: bit 63 set, then char, foreground, background
+static uint64_t *cells = NULL;
+
+static uint8_t last_waveform[4 + 320];
+static uint32_t last_waveform_size = 0;
+
+static uint16_t decode16(const uint8_t *data, int start) {
+    return data[start] | (uint16_t) data[start + 1] << 8;
+}
+
+static void add_window(window_s *to, const window_s *w) {
+    for (int i = 0; i < TYPE_COUNT; i++) {
+        to->count[i] += w->count[i];
+        to->bytes[i] += w->bytes[i];
+    }
+    to->same_chars += w->same_chars;
+    to->overwritten_rects += w->overwritten_rects;
+    to->same_waveforms += w->same_waveforms;
+    to->same_waveform_bytes += w->same_waveform_bytes;
+    to->presents += w->presents;
+    to->length_ms += w->length_ms;
+}
+
+static void close_window(uint32_t now) {
+    current.length_ms = now - current.start_ms;
+    add_window(&totals, &current);
+    windows[window_count % MAX_WINDOWS] = current;
+    window_count++;
+    memset(&current, 0, sizeof(current));
+    current.start_ms = now;
+}
+
+// Characters under an area are no longer known
+static void forget_cells(int x, int y, int w, int h) {
+    int x1 = x - MAX_GLYPH + 1 < 0 ? 0 : x - MAX_GLYPH + 1;
+    int y1 = y - MAX_GLYPH + 1 < 0 ? 0 : y - MAX_GLYPH + 1;
+    int x2 = x + w > CELL_MAP_W ? CELL_MAP_W : x + w;
+    int y2 = y + h > CELL_MAP_H ? CELL_MAP_H : y + h;
+    for (int cy = y1; cy < y2; cy++) {
+        if (x2 > x1) {
+            memset(&cells[cy * CELL_MAP_W + x1], 0, (x2 - x1) * sizeof(uint64_t));
+        }
+    }
+}
+
+static void profile_rect(const uint8_t *data) {
+    int x = decode16(data, 1), y = decode16(data, 3);
+    int w = decode16(data, 5), h = decode16(data, 7);
+    if (w == 0 || h == 0) {
+        return;
+    }
+    pending_rect_s r = {x, y, x + w - 1, y + h - 1, 0};
+
+    for (int i = 0; i < pending_count; i++) {
+        pending_rect_s *p = &pending[i];
+        if (!p->overwritten && p->x1 >= r.x1 && p->y1 >= r.y1 && p->x2 <= r.x2 &&
+            p->y2 <= r.y2) {
+            p->overwritten = 1;
+            current.overwritten_rects++;
+        }
+    }
+    if (pending_count < MAX_PENDING_RECTS) {
+        pending[pending_count++] = r;
+    }
+    forget_cells(x, y, w, h);
+}
+
+static void profile_char(const uint8_t *data) {
+    int x = decode16(data, 2), y = decode16(data, 4);
+    if (x >= CELL_MAP_W || y >= CELL_MAP_H) {
+        return;
+    }
+    uint64_t cell = 1ull << 63 | (uint64_t) data[1] << 48 |
+                    (uint64_t) (data[6] << 16 | data[7] << 8 | data[8]) << 24 |
+                    (uint64_t) (data[9] << 16 | data[10] << 8 | data[11]);
+    if (cells[y * CELL_MAP_W + x] == cell) {
+        current.same_chars++;
+    }
+    cells[y * CELL_MAP_W + x] = cell;
+}
+
+static void profile_waveform(const uint8_t *data, uint32_t size) {
+    if (size == last_waveform_size && memcmp(data, last_waveform, size) == 0) {
+        current.same_waveforms++;
+        current.same_waveform_bytes += size;
+        return;
+    }
+    memcpy(last_waveform, data, size);
+    last_waveform_size = size;
+    // The scope is redrawn over its whole width, clearing what was below
+    uint32_t width = size - 4;
+    forget_cells(CELL_MAP_W - (int) width, 0, (int) width, 21);
+}
+
+void protocol_profile_init(int enable) {
+    if (!enable) {
+        return;
+    }
+    cells = calloc(CELL_MAP_W * CELL_MAP_H, sizeof(uint64_t));
+    if (cells == NULL) {
+        SDL_Log("Protocol profile: out of memory\n");
+        return;
+    }
+    enabled = 1;
+    ticks_start = SDL_GetTicks();
+    current.start_ms = ticks_start;
+    SDL_Log("Protocol profile enabled, windows of %d s, report on exit\n",
+            PROFILE_WINDOW_MS / 1000);
+}
+
+void protocol_profile_packet(const uint8_t *data, uint32_t size) {
+    if (!enabled || size == 0) {
+        return;
+    }
+    uint32_t now = SDL_GetTicks();
+    if (now - current.start_ms >= PROFILE_WINDOW_MS) {
+        close_window(now);
+    }
+
+    packet_type_t type = TYPE_INVALID;
+    switch (data[0]) {
+        case 0xFE:
+            if (size == 12) {
+                type = TYPE_RECT;
+                profile_rect(data);
+            }
+            break;
+        case 0xFD:
+            if (size == 12) {
+                type = TYPE_CHAR;
+                profile_char(data);
+            }
+            break;
+        case 0xFC:
+            if (size >= 4 && size <= 4 + 320) {
+                type = TYPE_WAVEFORM;
+                profile_waveform(data, size);
+            }
+            break;
+        case 0xFB:
+            type = size == 3 ? TYPE_JOYPAD : TYPE_INVALID;
+            break;
+        case 0xFF:
+            type = size == 6 ? TYPE_SYSTEM_INFO : TYPE_INVALID;
+            break;
+        default:
+            break;
+    }
+    current.count[type]++;
+    current.bytes[type] += size;
+}
+
+void protocol_profile_present() {
+    if (!enabled) {
+        return;
+    }
+    current.presents++;
+    pending_count = 0;
+}
+
+static uint32_t total_bytes(const window_s *w) {
+    uint32_t bytes = 0;
+    for (int i = 0; i < TYPE_COUNT; i++) {
+        bytes += w->bytes[i];
+    }
+    return bytes;
+}
+
+static float percent(uint32_t part, uint32_t whole) {
+    return whole > 0 ? part * 100.0f / whole : 0.0f;
+}
+
+void protocol_profile_report() {
+    if (!enabled) {
+        return;
+    }
+    close_window(SDL_GetTicks());
+
+    SDL_Log("Protocol profile: %.1f s in %u windows\n", totals.length_ms / 1000.0f,
+            window_count);
+    SDL_Log("  start_s   rects   chars  waves   kB/s  same_chars  overwritten_rects  "
+            "same_waves  fps\n");
+    uint32_t first = window_count > MAX_WINDOWS ? window_count - MAX_WINDOWS : 0;
+    for (uint32_t i = first; i < window_count; i++) {
+        const window_s *w = &windows[i % MAX_WINDOWS];
+        float seconds = w->length_ms > 0 ? w->length_ms / 1000.0f : 1.0f;
+        SDL_Log("  %7.1f %7u %7u %6u %6.1f %11u %18u %11u %4.1f\n",
+                (w->start_ms - ticks_start) / 1000.0f, w->count[TYPE_RECT], w->count[TYPE_CHAR],
+                w->count[TYPE_WAVEFORM], total_bytes(w) / seconds / 1000.0f, w->same_chars,
+                w->overwritten_rects, w->same_waveforms, w->presents / seconds);
+    }
+
+    uint32_t bytes = total_bytes(&totals);
+    float seconds = totals.length_ms > 0 ? totals.length_ms / 1000.0f : 1.0f;
+    SDL_Log("  %u bytes, %.1f kB/s on average\n", bytes, bytes / seconds / 1000.0f);
+    for (int i = 0; i < TYPE_COUNT; i++) {
+        SDL_Log("  %-12s %9u packets %10u bytes %5.1f%% of bytes\n", type_names[i],
+                totals.count[i], totals.bytes[i], percent(totals.bytes[i], bytes));
+    }
+
+    // Each redundant rect and char is a 12 byte packet
+    SDL_Log("  same chars:        %u of %u (%.1f%%), %u bytes\n", totals.same_chars,
+            totals.count[TYPE_CHAR], percent(totals.same_chars, totals.count[TYPE_CHAR]),
+            totals.same_chars * 12);
+    SDL_Log("  overwritten rects: %u of %u (%.1f%%), %u bytes\n", totals.overwritten_rects,
+            totals.count[TYPE_RECT], percent(totals.overwritten_rects, totals.count[TYPE_RECT]),
+            totals.overwritten_rects * 12);
+    SDL_Log("  same waveforms:    %u of %u (%.1f%%), %u bytes\n", totals.same_waveforms,
+            totals.count[TYPE_WAVEFORM],
+            percent(totals.same_waveforms, totals.count[TYPE_WAVEFORM]),
+            totals.same_waveform_bytes);
+
+    free(cells);
+    cells = NULL;
+    enabled = 0;
+}
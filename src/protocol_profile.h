@@ -0,0 +1,24 @@
+#ifndef M8C_PROTOCOL_PROFILE_H
+#define M8C_PROTOCOL_PROFILE_H
+
+#include <stdint.h>
+
+/* Profiles the commands the M8 sends, to show which redraw optimizations
+   would pay off. Per time window it counts packets and bytes by command type,
+   and the redundant ones:
+     same char          a character identical to what its cell already shows
+     overwritten rect   a rectangle covered by a later one before the present
+     same waveform      a waveform packet identical to the one before it
+   All hooks run on the main thread. */
+void protocol_profile_init(int enabled);
+
+// Every packet handed to process_command()
+void protocol_profile_packet(const uint8_t *data, uint32_t size);
+
+// The screen was presented
+void protocol_profile_present();
+
+// Log every window and the totals
+void protocol_profile_report();
+
+#endif //M8C_PROTOCOL_PROFILE_H
@@ -9,6 +9,12 @@
 #include "SDL2_inprint.h"
 #include "command.h"
 #include "fx_cube.h"
+#include "hud.h"
+#include "latency_probe.h"
+#include "protocol_profile.h"
+#include "screen_model.h"
+#include "stats.h"
+#include "trace.h"
 
 #include "inline_font.h"
 #include "inline_font_large.h"
@@ -24,6 +30,15 @@ static uint32_t ticks_fps;
 static int fps;
 static int large_font_enabled = 0;
 static int screen_offset_y = 0;
+static struct inline_font *current_font = &inline_font_small;
+
+// Overlays are drawn on the canvas but are not part of the M8 screen
+static uint8_t drawing_overlay = 0;
+static uint8_t overlay_visible = 0;
+static SDL_Rect overlay_area;
+// The screensaver owns the canvas, the model still holds the M8 screen under it
+static uint8_t canvas_covered = 0;
+static int covered_large_font = 0;
 
 uint8_t fullscreen = 0;
 
@@ -31,6 +46,20 @@ static uint8_t dirty = 0;
 static SDL_Surface *screen = 0;
 static SDL_Surface *canvas = 0;
 
+// Set when only partial_area of the canvas changed since the last frame
+static uint8_t partial = 0;
+static SDL_Rect partial_area;
+
+// What the previous frame updated, a double buffered screen needs it again
+static uint8_t previous_full = 1;
+static SDL_Rect previous_area;
+
+// The HUD is drawn onto the screen after the canvas, in the bottom left corner
+static SDL_Surface *hud_surface = NULL;
+static SDL_Rect hud_area;
+static struct inline_font *hud_font = NULL;
+static char hud_text[HUD_LINES][HUD_LINE_CHARS + 1];
+
 // Initializes SDL and creates a renderer and required surfaces
 int initialize_sdl(int init_fullscreen, int init_use_gpu) {
     // ticks = SDL_GetTicks();
@@ -65,19 +94,38 @@ int initialize_sdl(int init_fullscreen, int init_use_gpu) {
     canvas = SDL_CreateRGBSurface(0, 320, 240, video_bpp, 0, 0, 0, 0);
 
     // Initialize a texture for the font and read the inline font bitmap
-    struct inline_font *font = &inline_font_small;
-    prepare_inline_font(font->bits, font->width, font->height);
+    current_font = &inline_font_small;
+    prepare_inline_font(current_font->bits, current_font->width, current_font->height);
     dirty = 1;
 
     return 1;
 }
 
+// Grows a to also cover b
+static void union_area(SDL_Rect *a, const SDL_Rect *b) {
+    int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    a->x = a->x < b->x ? a->x : b->x;
+    a->y = a->y < b->y ? a->y : b->y;
+    a->w = x2 - a->x;
+    a->h = y2 - a->y;
+}
+
+static void add_overlay_area(SDL_Rect area) {
+    if (overlay_area.w == 0) {
+        overlay_area = area;
+    } else {
+        union_area(&overlay_area, &area);
+    }
+}
+
 static void change_font(struct inline_font *font) {
     kill_inline_font();
     prepare_inline_font(font->bits, font->width, font->height);
+    current_font = font;
 }
 
-void set_large_mode(int enabled) {
+static void apply_font_mode(int enabled) {
     if (enabled) {
         large_font_enabled = 1;
         screen_offset_y = 40;
@@ -89,7 +137,22 @@ void set_large_mode(int enabled) {
     }
 }
 
+void set_large_mode(int enabled) {
+    // The M8 reports the font with every system info packet
+    if ((enabled != 0) == large_font_enabled) {
+        return;
+    }
+    // Text already on the canvas was drawn with the other font
+    screen_model_invalidate("font mode changed");
+    apply_font_mode(enabled);
+}
+
 void close_renderer() {
+    if (hud_surface != NULL) {
+        SDL_FreeSurface(hud_surface);
+        hud_surface = NULL;
+    }
+    screen_model_destroy();
     kill_inline_font();
 }
 
@@ -104,6 +167,72 @@ void toggle_fullscreen() {
     dirty = 1;
 }
 
+// Largest text cell the latency probe compares, bigger ones count as changed
+#define PROBE_CELL_PIXELS (32 * 32)
+
+static Uint32 canvas_pixel(int x, int y) {
+    Uint8 *p = (Uint8 *) canvas->pixels + y * canvas->pitch + x * canvas->format->BytesPerPixel;
+    switch (canvas->format->BytesPerPixel) {
+        case 1:
+            return *p;
+        case 2:
+            return *(Uint16 *) p;
+        case 3:
+            return p[0] | p[1] << 8 | p[2] << 16;
+        default:
+            return *(Uint32 *) p;
+    }
+}
+
+// area clipped to the canvas, 0 if nothing is left of it
+static int clip_to_canvas(SDL_Rect *area) {
+    int x1 = area->x < 0 ? 0 : area->x;
+    int y1 = area->y < 0 ? 0 : area->y;
+    int x2 = area->x + area->w > canvas->w ? canvas->w : area->x + area->w;
+    int y2 = area->y + area->h > canvas->h ? canvas->h : area->y + area->h;
+    if (x1 >= x2 || y1 >= y2) {
+        return 0;
+    }
+    *area = (SDL_Rect) {x1, y1, x2 - x1, y2 - y1};
+    return 1;
+}
+
+// For the latency probe, whether filling area with pixel changes anything
+static int fill_changes_canvas(SDL_Rect area, Uint32 pixel) {
+    if (!clip_to_canvas(&area)) {
+        return 0;
+    }
+    for (int y = area.y; y < area.y + area.h; y++) {
+        for (int x = area.x; x < area.x + area.w; x++) {
+            if (canvas_pixel(x, y) != pixel) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// For the latency probe, copies area before a draw, or compares it after it
+static int cell_pixels(SDL_Rect area, Uint32 *pixels, int compare) {
+    if (!clip_to_canvas(&area)) {
+        return 0;
+    }
+    if (area.w * area.h > PROBE_CELL_PIXELS) {
+        return 1;
+    }
+    int i = 0;
+    for (int y = area.y; y < area.y + area.h; y++) {
+        for (int x = area.x; x < area.x + area.w; x++, i++) {
+            if (!compare) {
+                pixels[i] = canvas_pixel(x, y);
+            } else if (pixels[i] != canvas_pixel(x, y)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
 int draw_character(struct draw_character_command *command) {
 
     uint32_t fgcolor = (command->foreground.r << 16) |
@@ -117,10 +246,34 @@ int draw_character(struct draw_character_command *command) {
        background. Due to the font bitmaps, a different pixel offset is needed for
        both*/
 
-    inprint(canvas, (char *) &command->c, command->pos.x,
-            command->pos.y + (large_font_enabled ? 2 : 3) - screen_offset_y,
-            fgcolor, (bgcolor == fgcolor) ? -1 : bgcolor);
+    Sint16 x = command->pos.x;
+    Sint16 y = command->pos.y + (large_font_enabled ? 2 : 3) - screen_offset_y;
+    Uint32 inprint_bgcolor = (bgcolor == fgcolor) ? -1 : bgcolor;
+    int cell_w = current_font->width / 16;
+    int cell_h = current_font->height / 8;
+
+    // The probe wants the first draw that changes the screen, the M8 rewrites
+    // a lot of text that is already there
+    static Uint32 probe_before[PROBE_CELL_PIXELS];
+    SDL_Rect cell = {x, y, cell_w, cell_h + 1};
+    int probing = !drawing_overlay && latency_probe_waiting();
+    if (probing) {
+        cell_pixels(cell, probe_before, 0);
+    }
+
+    inprint(canvas, (char *) &command->c, x, y, fgcolor, inprint_bgcolor);
 
+    if (probing && cell_pixels(cell, probe_before, 1)) {
+        latency_probe_draw();
+    }
+
+    if (drawing_overlay) {
+        add_overlay_area((SDL_Rect) {x, y, cell_w, cell_h + 1});
+    } else if (command->c > 0 && command->c <= 0xFF) {
+        screen_model_char((char) command->c, x, y, fgcolor, inprint_bgcolor, cell_w, cell_h);
+    } else {
+        screen_model_invalidate("unexpected character");
+    }
 
     dirty = 1;
 
@@ -157,6 +310,12 @@ void draw_rectangle(struct draw_rectangle_command *command) {
 #endif
     }
 
+    if (!drawing_overlay && latency_probe_waiting() &&
+        fill_changes_canvas(render_rect, SDL_MapRGB(canvas->format, command->color.r,
+                                                    command->color.g, command->color.b))) {
+        latency_probe_draw();
+    }
+
     boxRGBA(
             canvas,
             render_rect.x,
@@ -169,6 +328,14 @@ void draw_rectangle(struct draw_rectangle_command *command) {
             0xFF
     );
 
+    if (drawing_overlay) {
+        add_overlay_area(render_rect);
+    } else {
+        screen_model_box(render_rect.x, render_rect.y, render_rect.x + render_rect.w - 1,
+                         render_rect.y + render_rect.h - 1, command->color.r, command->color.g,
+                         command->color.b, 0xFF);
+    }
+
     dirty = 1;
 }
 
@@ -246,6 +413,9 @@ void draw_waveform(struct draw_oscilloscope_waveform_command *command) {
 
 //        SDL_RenderDrawPoints(rend, waveform_points, command->waveform_size);
 
+        screen_model_waveform(wf_rect.x, wf_rect.x + wf_rect.w, background_color, command->color,
+                              command->waveform, command->waveform_size);
+
         // The packet we just drew was an empty waveform
         if (command->waveform_size == 0) {
             wfm_cleared = 1;
@@ -260,6 +430,7 @@ void draw_waveform(struct draw_oscilloscope_waveform_command *command) {
 void display_keyjazz_overlay(uint8_t show, uint8_t base_octave,
                              uint8_t velocity) {
 
+    drawing_overlay = 1;
     if (show) {
         struct draw_rectangle_command drc;
         drc.color = (struct color) {255, 0, 0};
@@ -288,6 +459,11 @@ void display_keyjazz_overlay(uint8_t show, uint8_t base_octave,
             dcc.pos.x -= 8;
         }
 
+        overlay_visible = 1;
+    } else if (overlay_visible && screen_model_repaint(canvas, &overlay_area)) {
+        // Put back what the M8 had drawn under the overlay
+        overlay_visible = 0;
+        overlay_area.w = 0;
     } else {
         struct draw_rectangle_command drc;
         drc.color = (struct color) {background_color.r, background_color.g,
@@ -298,20 +474,152 @@ void display_keyjazz_overlay(uint8_t show, uint8_t base_octave,
         drc.size.height = 14;
 
         draw_rectangle(&drc);
+        overlay_visible = 0;
+        overlay_area.w = 0;
+    }
+    drawing_overlay = 0;
+
+    dirty = 1;
+}
+
+SDL_Surface *render_canvas() {
+    return canvas;
+}
+
+// Redraws the canvas from the retained screen model, 0 if it is out of sync
+static int repaint_screen() {
+    if (overlay_visible || !screen_model_repaint(canvas, NULL)) {
+        return 0;
     }
+    partial = 0;
+    dirty = 1;
+    return 1;
+}
+
+// Renders the HUD text once, every frame then only blits it
+static void redraw_hud() {
+    int cell_w = current_font->width / 16;
+    int cell_h = current_font->height / 8 + 1;
+    int w = cell_w * HUD_LINE_CHARS + 2;
+    int h = cell_h * HUD_LINES + 2;
+
+    if (hud_surface == NULL || hud_surface->w != w || hud_surface->h != h) {
+        if (hud_surface != NULL) {
+            SDL_FreeSurface(hud_surface);
+        }
+        hud_surface = SDL_CreateRGBSurface(0, w, h, canvas->format->BitsPerPixel, 0, 0, 0, 0);
+        if (hud_surface == NULL) {
+            hud_set_enabled(0);
+            return;
+        }
+    }
+    SDL_FillRect(hud_surface, NULL, SDL_MapRGB(hud_surface->format, 0, 0, 0));
+    for (int i = 0; i < HUD_LINES; i++) {
+        inprint(hud_surface, hud_text[i], 1, (Sint16) (1 + i * cell_h), 0xFFFFFF, 0x000000);
+    }
+    hud_area = (SDL_Rect) {0, (Sint16) (240 - h), (Uint16) w, (Uint16) h};
+    hud_font = current_font;
+}
+
+static void draw_hud(const SDL_Rect *area) {
+    if (!hud_enabled() || hud_surface == NULL) {
+        return;
+    }
+    if (area != NULL && (area->x >= hud_area.x + hud_area.w || hud_area.x >= area->x + area->w ||
+                         area->y >= hud_area.y + hud_area.h || hud_area.y >= area->y + area->h)) {
+        return;
+    }
+    SDL_Rect dst = hud_area;
+    SDL_BlitSurface(hud_surface, NULL, screen, &dst);
+}
 
+void toggle_hud() {
+    hud_set_enabled(!hud_enabled());
+    // A full frame puts back what was under it
+    partial = 0;
     dirty = 1;
 }
 
+static void present_partial() {
+    SDL_Rect area = partial_area;
+
+    if ((screen->flags & SDL_DOUBLEBUF) == SDL_DOUBLEBUF) {
+        // The back buffer still holds the frame before the last one
+        if (previous_full) {
+            area = (SDL_Rect) {0, 0, 320, 240};
+        } else {
+            union_area(&area, &previous_area);
+        }
+        SDL_Rect dst = area;
+        TRACE_BEGIN(trace_blit);
+        SDL_BlitSurface(canvas, &area, screen, &dst);
+        draw_hud(&area);
+        TRACE_END(TRACE_BLIT, trace_blit, area.w * area.h);
+        TRACE_BEGIN(trace_flip);
+        SDL_Flip(screen);
+        TRACE_END(TRACE_FLIP, trace_flip, 0);
+    } else {
+        SDL_Rect dst = area;
+        TRACE_BEGIN(trace_blit);
+        SDL_BlitSurface(canvas, &area, screen, &dst);
+        draw_hud(&area);
+        TRACE_END(TRACE_BLIT, trace_blit, area.w * area.h);
+        TRACE_BEGIN(trace_flip);
+        SDL_UpdateRects(screen, 1, &area);
+        TRACE_END(TRACE_FLIP, trace_flip, 0);
+    }
+
+    previous_area = partial_area;
+    previous_full = 0;
+}
+
 void render_screen() {
+    int hud_only = 0;
+    if (hud_enabled() && (hud_update(hud_text) || hud_font != current_font)) {
+        redraw_hud();
+        // New figures go out even when the M8 has drawn nothing
+        if (!dirty) {
+            partial = 1;
+            partial_area = hud_area;
+            dirty = 1;
+            hud_only = 1;
+        } else if (partial) {
+            union_area(&partial_area, &hud_area);
+        }
+    }
+
     if (dirty) {
+        uint64_t start_us = stats_now_us();
         dirty = 0;
-        // ticks = SDL_GetTicks();
-        SDL_BlitSurface(canvas, NULL, screen, NULL);
-        SDL_UpdateRect(screen, 0, 0, 320, 240);
-        SDL_Flip(screen);
+        if (!overlay_visible && !canvas_covered) {
+            screen_model_verify(canvas);
+        }
+        if (partial) {
+            partial = 0;
+            present_partial();
+        } else {
+            // ticks = SDL_GetTicks();
+            TRACE_BEGIN(trace_blit);
+            SDL_BlitSurface(canvas, NULL, screen, NULL);
+            draw_hud(NULL);
+            TRACE_END(TRACE_BLIT, trace_blit, 320 * 240);
+            TRACE_BEGIN(trace_flip);
+            SDL_UpdateRect(screen, 0, 0, 320, 240);
+            SDL_Flip(screen);
+            TRACE_END(TRACE_FLIP, trace_flip, 1);
+            previous_full = 1;
+        }
+        latency_probe_present();
 
-        fps++;
+        if (!hud_only) {
+            fps++;
+            hud_present();
+            protocol_profile_present();
+        }
+        uint32_t frame_us = (uint32_t) (stats_now_us() - start_us);
+        stats_add(STAT_FRAMES, 1);
+        stats_add(STAT_FRAME_US_TOTAL, frame_us);
+        stats_max(STAT_FRAME_US_MAX, frame_us);
 
         if (SDL_GetTicks() - ticks_fps > 5000) {
             ticks_fps = SDL_GetTicks();
@@ -322,23 +630,51 @@ void render_screen() {
 }
 
 void screensaver_init() {
-    set_large_mode(1);
+    // Keep the model, screensaver_destroy() puts the M8 screen back from it
+    canvas_covered = 1;
+    covered_large_font = large_font_enabled;
+    if (!large_font_enabled) {
+        apply_font_mode(1);
+    }
     fx_cube_init(canvas,(SDL_Color) {255, 255, 255, 255});
+    partial = 0;
+    dirty = 1;
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Screensaver initialized");
 }
 
 void printDebugText(const char *text) {
+    screen_model_invalidate("debug text");
     boxColor(canvas, 2, 230+20, 2+200, 230, 0x000000FF);
     inprint(canvas, text, 2, 230, 0xFFFFFF, 0x000000);
 }
 
 void screensaver_draw() {
-    fx_cube_update(canvas);
+    SDL_Rect updated;
+    fx_cube_update(canvas, &updated);
+    if (updated.w == 0 || updated.h == 0) {
+        return;
+    }
+    // A full redraw that is still pending covers this one as well
+    if (!dirty) {
+        partial = 1;
+        partial_area = updated;
+    } else if (partial) {
+        union_area(&partial_area, &updated);
+    }
     dirty = 1;
 }
 
 void screensaver_destroy() {
     fx_cube_destroy();
-    set_large_mode(0);
+    partial = 0;
+    canvas_covered = 0;
+    if (covered_large_font != large_font_enabled) {
+        apply_font_mode(covered_large_font);
+    }
+    // The last M8 screen shows right away instead of the cube's final frame
+    // until the M8 has sent its redraw
+    if (!repaint_screen()) {
+        screen_model_invalidate("screensaver");
+    }
     SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Screensaver destroyed");
 }
@@ -4,6 +4,8 @@
 #ifndef RENDER_H_
 #define RENDER_H_
 
+#include <SDL.h>
+
 #include "command.h"
 
 int initialize_sdl(int init_fullscreen, int init_use_gpu);
@@ -18,6 +20,12 @@ void render_screen();
 void toggle_fullscreen();
 void display_keyjazz_overlay(uint8_t show, uint8_t base_octave, uint8_t velocity);
 
+// Shows or hides the performance HUD
+void toggle_hud();
+
+// The surface the M8 draws on, before it is presented
+SDL_Surface *render_canvas();
+
 void screensaver_init();
 void printDebugText(const char *text);
 void screensaver_draw();
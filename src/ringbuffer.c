@@ -21,6 +21,14 @@ void ring_buffer_free(RingBuffer *rb) {
     free(rb);
 }
 
+void ring_buffer_clear(RingBuffer *rb) {
+    pthread_mutex_lock(&mutex);
+    rb->head = 0;
+    rb->tail = 0;
+    rb->size = 0;
+    pthread_mutex_unlock(&mutex);
+}
+
 uint32_t ring_buffer_empty(RingBuffer *rb) {
     return (rb->size == 0);
 }
@@ -68,3 +76,86 @@ uint32_t ring_buffer_pop(RingBuffer *rb, uint8_t *data, uint32_t length) {
         return n; // pop successful, returns number of bytes popped
     }
 }
+
+LockFreeRingBuffer *lf_ring_buffer_create(uint32_t size) {
+    uint32_t capacity = 1;
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+    LockFreeRingBuffer *rb = SDL_malloc(sizeof(*rb));
+    rb->buffer = SDL_malloc(capacity);
+    rb->mask = capacity - 1;
+    rb->head = 0;
+    rb->tail = 0;
+    return rb;
+}
+
+void lf_ring_buffer_free(LockFreeRingBuffer *rb) {
+    SDL_free(rb->buffer);
+    SDL_free(rb);
+}
+
+uint32_t lf_ring_buffer_mark(LockFreeRingBuffer *rb) {
+    return rb->tail;
+}
+
+void lf_ring_buffer_discard_to(LockFreeRingBuffer *rb, uint32_t mark) {
+    uint32_t head = rb->head;
+    uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    // Only forward, and never past what was pushed
+    if (mark - head <= tail - head) {
+        __atomic_store_n(&rb->head, mark, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t lf_ring_buffer_used(LockFreeRingBuffer *rb) {
+    uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
+
+uint32_t lf_ring_buffer_push(LockFreeRingBuffer *rb, const uint8_t *data, uint32_t length) {
+    uint32_t tail = rb->tail;
+    uint32_t head = __atomic_load_n(&rb->head, __ATOMIC_ACQUIRE);
+    uint32_t capacity = rb->mask + 1;
+
+    if (capacity - (tail - head) < length) {
+        return 0;
+    }
+
+    uint32_t offset = tail & rb->mask;
+    uint32_t space1 = capacity - offset;
+    if (length <= space1) {
+        SDL_memcpy(rb->buffer + offset, data, length);
+    } else {
+        SDL_memcpy(rb->buffer + offset, data, space1);
+        SDL_memcpy(rb->buffer, data + space1, length - space1);
+    }
+
+    // Publish the data before moving the tail past it
+    __atomic_store_n(&rb->tail, tail + length, __ATOMIC_RELEASE);
+    return length;
+}
+
+uint32_t lf_ring_buffer_pop(LockFreeRingBuffer *rb, uint8_t *data, uint32_t length) {
+    uint32_t head = rb->head;
+    uint32_t tail = __atomic_load_n(&rb->tail, __ATOMIC_ACQUIRE);
+    uint32_t capacity = rb->mask + 1;
+
+    uint32_t n = tail - head;
+    if (n > length) {
+        n = length;
+    }
+
+    uint32_t offset = head & rb->mask;
+    uint32_t space1 = capacity - offset;
+    if (n <= space1) {
+        SDL_memcpy(data, rb->buffer + offset, n);
+    } else {
+        SDL_memcpy(data, rb->buffer + offset, space1);
+        SDL_memcpy(data + space1, rb->buffer, n - space1);
+    }
+
+    __atomic_store_n(&rb->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
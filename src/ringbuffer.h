@@ -19,6 +19,38 @@ uint32_t ring_buffer_pop(RingBuffer *rb, uint8_t *data, uint32_t length);
 
 uint32_t ring_buffer_push(RingBuffer *rb, const uint8_t *data, uint32_t length);
 
+// Drops everything currently in the buffer
+void ring_buffer_clear(RingBuffer *rb);
+
 void ring_buffer_free(RingBuffer *rb);
 
+/* Single producer, single consumer ring without locks. The producer only
+   writes tail and the consumer only writes head, so one thread may push while
+   another pops. Capacity is rounded up to a power of two. */
+typedef struct {
+    uint8_t *buffer;
+    uint32_t mask;
+    uint32_t head;
+    uint32_t tail;
+} LockFreeRingBuffer;
+
+LockFreeRingBuffer *lf_ring_buffer_create(uint32_t size);
+
+// Bytes available for popping
+uint32_t lf_ring_buffer_used(LockFreeRingBuffer *rb);
+
+// Pushes all of data or nothing, returns the number of bytes pushed
+uint32_t lf_ring_buffer_push(LockFreeRingBuffer *rb, const uint8_t *data, uint32_t length);
+
+// Pops up to length bytes, returns the number of bytes popped
+uint32_t lf_ring_buffer_pop(LockFreeRingBuffer *rb, uint8_t *data, uint32_t length);
+
+// The position of the next push, called from the pushing side only
+uint32_t lf_ring_buffer_mark(LockFreeRingBuffer *rb);
+
+// Drops what was pushed before mark, called from the popping side only
+void lf_ring_buffer_discard_to(LockFreeRingBuffer *rb, uint32_t mark);
+
+void lf_ring_buffer_free(LockFreeRingBuffer *rb);
+
 #endif //M8C_RINGBUFFER_H
@@ -0,0 +1,405 @@
+#include "screen_model.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "SDL2_inprint.h"
+#include "SDL_gfxPrimitives.h"
+#include "SDL2_compat.h"
+
+#define CANVAS_W 320
+#define CANVAS_H 240
+
+// A redraw of the M8 screen is around 1500 primitives
+#define MAX_OPS 4096
+
+// Prune once the list has grown this much past what survived the last pass
+#define COMPACT_FACTOR 2
+
+// Log a mismatching frame at most this often
+#define VERIFY_LOG_MS 1000
+
+typedef enum {
+    OP_BOX,
+    OP_CHAR,
+    OP_WAVEFORM
+} op_type_t;
+
+// Inclusive canvas area, clipped
+typedef struct {
+    int16_t x1, y1, x2, y2;
+} area_s;
+
+typedef struct {
+    uint8_t type;
+    uint8_t opaque;  // every pixel of cover is overwritten
+    area_s bounds;   // every pixel the primitive may touch
+    area_s cover;
+    union {
+        struct {
+            Sint16 x1, y1, x2, y2;
+            Uint8 r, g, b, a;
+        } box;
+        struct {
+            Sint16 x, y;
+            Uint32 fgcolor, bgcolor;
+            char c;
+        } chr;
+        struct {
+            Sint16 x1, x2;
+            SDL_Color background;
+            struct color color;
+            uint16_t size;
+            uint8_t *points;
+        } waveform;
+    } u;
+} model_op_s;
+
+static model_op_s ops[MAX_OPS];
+static int op_count = 0;
+static int compact_at = MAX_OPS / 4;
+
+static int valid = 1;
+static int verify_enabled = 0;
+
+// Index + 1 of the last opaque primitive on each pixel, used while pruning
+static uint16_t *owner = NULL;
+
+static SDL_Surface *scratch = NULL;
+static uint32_t frames_verified = 0;
+static uint32_t frames_mismatched = 0;
+static uint32_t ticks_mismatch_logged = 0;
+
+static int clip_area(int x1, int y1, int x2, int y2, area_s *out) {
+    if (x1 > x2) {
+        int t = x1;
+        x1 = x2;
+        x2 = t;
+    }
+    if (y1 > y2) {
+        int t = y1;
+        y1 = y2;
+        y2 = t;
+    }
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x2 > CANVAS_W - 1) x2 = CANVAS_W - 1;
+    if (y2 > CANVAS_H - 1) y2 = CANVAS_H - 1;
+    if (x1 > x2 || y1 > y2) {
+        return 0;
+    }
+    out->x1 = x1;
+    out->y1 = y1;
+    out->x2 = x2;
+    out->y2 = y2;
+    return 1;
+}
+
+static void free_op(model_op_s *op) {
+    if (op->type == OP_WAVEFORM) {
+        free(op->u.waveform.points);
+        op->u.waveform.points = NULL;
+    }
+}
+
+static void clear_ops() {
+    for (int i = 0; i < op_count; i++) {
+        free_op(&ops[i]);
+    }
+    op_count = 0;
+    compact_at = MAX_OPS / 4;
+}
+
+// Drops every primitive whose pixels were all painted over by later opaque ones
+static void compact() {
+    if (owner == NULL) {
+        owner = calloc(CANVAS_W * CANVAS_H, sizeof(uint16_t));
+        if (owner == NULL) {
+            return;
+        }
+    } else {
+        memset(owner, 0, CANVAS_W * CANVAS_H * sizeof(uint16_t));
+    }
+
+    for (int i = 0; i < op_count; i++) {
+        if (!ops[i].opaque) {
+            continue;
+        }
+        const area_s *c = &ops[i].cover;
+        for (int y = c->y1; y <= c->y2; y++) {
+            uint16_t *row = &owner[y * CANVAS_W];
+            for (int x = c->x1; x <= c->x2; x++) {
+                row[x] = (uint16_t) (i + 1);
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int i = 0; i < op_count; i++) {
+        const area_s *b = &ops[i].bounds;
+        int visible = 0;
+        for (int y = b->y1; y <= b->y2 && !visible; y++) {
+            const uint16_t *row = &owner[y * CANVAS_W];
+            for (int x = b->x1; x <= b->x2; x++) {
+                if (row[x] <= i + 1) {
+                    visible = 1;
+                    break;
+                }
+            }
+        }
+        if (visible) {
+            ops[kept++] = ops[i];
+        } else {
+            free_op(&ops[i]);
+        }
+    }
+
+    op_count = kept;
+    compact_at = kept * COMPACT_FACTOR;
+    if (compact_at < MAX_OPS / 4) {
+        compact_at = MAX_OPS / 4;
+    }
+    if (compact_at > MAX_OPS) {
+        compact_at = MAX_OPS;
+    }
+}
+
+static model_op_s *new_op() {
+    if (op_count >= compact_at) {
+        compact();
+    }
+    if (op_count >= MAX_OPS) {
+        screen_model_invalidate("too many primitives");
+        return NULL;
+    }
+    return &ops[op_count++];
+}
+
+static void add_op(const model_op_s *op) {
+    // A full screen clear hides everything drawn so far
+    if (op->opaque && op->cover.x1 == 0 && op->cover.y1 == 0 && op->cover.x2 == CANVAS_W - 1 &&
+        op->cover.y2 == CANVAS_H - 1) {
+        clear_ops();
+        if (!valid) {
+            SDL_LogDebug(SDL_LOG_CATEGORY_VIDEO, "Screen model back in sync");
+        }
+        valid = 1;
+    }
+    if (!valid) {
+        return;
+    }
+    model_op_s *slot = new_op();
+    if (slot != NULL) {
+        *slot = *op;
+    }
+}
+
+void screen_model_init(int verify) {
+    clear_ops();
+    valid = 1;
+    verify_enabled = verify;
+    frames_verified = 0;
+    frames_mismatched = 0;
+}
+
+void screen_model_destroy() {
+    if (verify_enabled) {
+        SDL_Log("Screen model: %u frames verified, %u did not match the canvas",
+                frames_verified, frames_mismatched);
+    }
+    clear_ops();
+    free(owner);
+    owner = NULL;
+    if (scratch != NULL) {
+        SDL_FreeSurface(scratch);
+        scratch = NULL;
+    }
+}
+
+void screen_model_box(Sint16 x1, Sint16 y1, Sint16 x2, Sint16 y2, Uint8 r, Uint8 g, Uint8 b,
+                      Uint8 a) {
+    model_op_s op = {.type = OP_BOX, .opaque = a == 0xFF};
+    if (!clip_area(x1, y1, x2, y2, &op.bounds)) {
+        return;
+    }
+    op.cover = op.bounds;
+    op.u.box.x1 = x1;
+    op.u.box.y1 = y1;
+    op.u.box.x2 = x2;
+    op.u.box.y2 = y2;
+    op.u.box.r = r;
+    op.u.box.g = g;
+    op.u.box.b = b;
+    op.u.box.a = a;
+    add_op(&op);
+}
+
+void screen_model_char(char c, Sint16 x, Sint16 y, Uint32 fgcolor, Uint32 bgcolor, int cell_w,
+                       int cell_h) {
+    model_op_s op = {.type = OP_CHAR};
+
+    // Same geometry as inprint(): the glyph cell, and a background one pixel
+    // narrower that the large font moves down by one
+    int bg_y = y + (cell_h == 11 ? 1 : 0);
+    int y2 = bgcolor != (Uint32) -1 ? bg_y + cell_h - 1 : y + cell_h - 1;
+    if (!clip_area(x, y, x + cell_w - 1, y2, &op.bounds)) {
+        return;
+    }
+    op.opaque = bgcolor != (Uint32) -1 &&
+                clip_area(x, bg_y, x + cell_w - 2, bg_y + cell_h - 1, &op.cover);
+    op.u.chr.x = x;
+    op.u.chr.y = y;
+    op.u.chr.fgcolor = fgcolor;
+    op.u.chr.bgcolor = bgcolor;
+    op.u.chr.c = c;
+    add_op(&op);
+}
+
+void screen_model_waveform(Sint16 x1, Sint16 x2, SDL_Color background, struct color color,
+                           const uint8_t *waveform, int size) {
+    if (!valid) {
+        return;
+    }
+    model_op_s op = {.type = OP_WAVEFORM, .opaque = background.unused == 0xFF};
+    if (!clip_area(x1, 0, x2, 21, &op.bounds)) {
+        return;
+    }
+    op.cover = op.bounds;
+    op.u.waveform.x1 = x1;
+    op.u.waveform.x2 = x2;
+    op.u.waveform.background = background;
+    op.u.waveform.color = color;
+    op.u.waveform.size = size;
+    op.u.waveform.points = NULL;
+    if (size > 0) {
+        op.u.waveform.points = malloc(size);
+        if (op.u.waveform.points == NULL) {
+            screen_model_invalidate("out of memory");
+            return;
+        }
+        memcpy(op.u.waveform.points, waveform, size);
+    }
+    add_op(&op);
+    if (!valid) {
+        free(op.u.waveform.points);
+    }
+}
+
+void screen_model_invalidate(const char *reason) {
+    if (valid) {
+        SDL_LogDebug(SDL_LOG_CATEGORY_VIDEO, "Screen model out of sync: %s", reason);
+    }
+    clear_ops();
+    valid = 0;
+}
+
+int screen_model_valid() {
+    return valid;
+}
+
+static int overlaps(const area_s *a, const SDL_Rect *r) {
+    return a->x1 < r->x + r->w && a->x2 >= r->x && a->y1 < r->y + r->h && a->y2 >= r->y;
+}
+
+static void replay(SDL_Surface *dst, const model_op_s *op) {
+    switch (op->type) {
+        case OP_BOX:
+            boxRGBA(dst, op->u.box.x1, op->u.box.y1, op->u.box.x2, op->u.box.y2, op->u.box.r,
+                    op->u.box.g, op->u.box.b, op->u.box.a);
+            break;
+        case OP_CHAR: {
+            char str[2] = {op->u.chr.c, 0};
+            inprint(dst, str, op->u.chr.x, op->u.chr.y, op->u.chr.fgcolor, op->u.chr.bgcolor);
+            break;
+        }
+        case OP_WAVEFORM: {
+            const SDL_Color *bg = &op->u.waveform.background;
+            boxRGBA(dst, op->u.waveform.x1, 0, op->u.waveform.x2, 21, bg->r, bg->g, bg->b,
+                    bg->unused);
+            for (int i = 0; i < op->u.waveform.size - 1; i++) {
+                lineRGBA(dst, op->u.waveform.x1 + i, op->u.waveform.points[i],
+                         op->u.waveform.x1 + i + 1, op->u.waveform.points[i + 1],
+                         op->u.waveform.color.r, op->u.waveform.color.g, op->u.waveform.color.b,
+                         255);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+int screen_model_repaint(SDL_Surface *dst, const SDL_Rect *area) {
+    if (!valid) {
+        return 0;
+    }
+
+    SDL_Rect full = {0, 0, CANVAS_W, CANVAS_H};
+    SDL_Rect clip = area != NULL ? *area : full;
+    SDL_Rect saved_clip;
+    SDL_GetClipRect(dst, &saved_clip);
+    SDL_SetClipRect(dst, &clip);
+    SDL_GetClipRect(dst, &clip);
+
+    // The canvas starts out zeroed, later content all comes from the list
+    SDL_FillRect(dst, &clip, 0);
+    for (int i = 0; i < op_count; i++) {
+        if (overlaps(&ops[i].bounds, &clip)) {
+            replay(dst, &ops[i]);
+        }
+    }
+
+    SDL_SetClipRect(dst, &saved_clip);
+    return 1;
+}
+
+int screen_model_verify(SDL_Surface *canvas) {
+    if (!verify_enabled || !valid) {
+        return -1;
+    }
+
+    if (scratch == NULL) {
+        scratch = SDL_CreateRGBSurface(0, canvas->w, canvas->h, canvas->format->BitsPerPixel,
+                                       canvas->format->Rmask, canvas->format->Gmask,
+                                       canvas->format->Bmask, canvas->format->Amask);
+        if (scratch == NULL) {
+            verify_enabled = 0;
+            return -1;
+        }
+    }
+    screen_model_repaint(scratch, NULL);
+
+    int bpp = canvas->format->BytesPerPixel;
+    int mismatched = 0;
+    int first_x = -1, first_y = -1;
+    SDL_LockSurface(canvas);
+    SDL_LockSurface(scratch);
+    for (int y = 0; y < canvas->h; y++) {
+        const uint8_t *a = (const uint8_t *) canvas->pixels + y * canvas->pitch;
+        const uint8_t *b = (const uint8_t *) scratch->pixels + y * scratch->pitch;
+        if (memcmp(a, b, canvas->w * bpp) == 0) {
+            continue;
+        }
+        for (int x = 0; x < canvas->w; x++) {
+            if (memcmp(a + x * bpp, b + x * bpp, bpp) != 0) {
+                if (mismatched++ == 0) {
+                    first_x = x;
+                    first_y = y;
+                }
+            }
+        }
+    }
+    SDL_UnlockSurface(scratch);
+    SDL_UnlockSurface(canvas);
+
+    frames_verified++;
+    if (mismatched > 0) {
+        frames_mismatched++;
+        if (SDL_GetTicks() - ticks_mismatch_logged > VERIFY_LOG_MS) {
+            ticks_mismatch_logged = SDL_GetTicks();
+            SDL_Log("Screen model: repaint differs in %d pixels, first at %d,%d (%d primitives)",
+                    mismatched, first_x, first_y, op_count);
+        }
+    }
+    return mismatched;
+}
@@ -0,0 +1,41 @@
+#ifndef M8C_SCREEN_MODEL_H
+#define M8C_SCREEN_MODEL_H
+
+#include <SDL.h>
+
+#include "command.h"
+
+/* Retained copy of what the M8 has drawn on the canvas. Every primitive that
+   render.c puts on the canvas for the M8 is recorded with the exact arguments
+   it was drawn with, and primitives that later draws have completely painted
+   over are pruned, so the model stays about one screen of text cells,
+   rectangles and the last waveform. Replaying it reproduces the canvas pixel
+   for pixel, which lets a region be repaired locally instead of asking the M8
+   for a full redraw with reset_display().
+
+   The model can only follow the M8 while nothing else draws on the canvas.
+   screen_model_invalidate() marks it out of sync, it becomes valid again with
+   the next full screen clear, which starts every redraw the M8 sends. */
+void screen_model_init(int verify);
+void screen_model_destroy();
+
+// Canvas primitives, arguments as passed to SDL_gfx and inprint()
+void screen_model_box(Sint16 x1, Sint16 y1, Sint16 x2, Sint16 y2, Uint8 r, Uint8 g, Uint8 b,
+                      Uint8 a);
+void screen_model_char(char c, Sint16 x, Sint16 y, Uint32 fgcolor, Uint32 bgcolor, int cell_w,
+                       int cell_h);
+void screen_model_waveform(Sint16 x1, Sint16 x2, SDL_Color background, struct color color,
+                           const uint8_t *waveform, int size);
+
+void screen_model_invalidate(const char *reason);
+int screen_model_valid();
+
+// Redraws area of dst (the whole surface when NULL) from the model, 0 if out of sync
+int screen_model_repaint(SDL_Surface *dst, const SDL_Rect *area);
+
+/* Repaints into a scratch surface and compares it with canvas when
+   verification is enabled. Returns the number of differing pixels, or -1 when
+   nothing was compared. */
+int screen_model_verify(SDL_Surface *canvas);
+
+#endif //M8C_SCREEN_MODEL_H
@@ -16,6 +16,7 @@ int init_serial_with_file_descriptor(int file_descriptor);
 int init_serial(int verbose, char *preferred_device);
 int list_devices();
 int check_serial_port();
+// Above 0 when the reset went out or is queued to, 0 on failure
 int reset_display();
 int enable_and_reset_display();
 int disconnect();
@@ -24,5 +25,7 @@ int bulk_async_transfer(int endpoint, uint8_t *serial_buf, int count, unsigned i
 int async_read(uint8_t *serial_buf, int count, void (*f)(struct libusb_transfer*));
 int send_msg_controller(uint8_t input);
 int send_msg_keyjazz(uint8_t note, uint8_t velocity);
+// Submit the messages queued since the last call as one write, never blocks
+int send_queued_messages();
 
 #endif
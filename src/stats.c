@@ -0,0 +1,64 @@
+#include "stats.h"
+
+#include <time.h>
+
+uint32_t stats[STAT_COUNT];
+
+static const char *names[STAT_COUNT] = {
+        [STAT_USB_READS] = "usb_reads",
+        [STAT_USB_READ_ERRORS] = "usb_read_errors",
+        [STAT_SLIP_ERRORS] = "slip_errors",
+        [STAT_CMD_RECT] = "cmd_rect",
+        [STAT_CMD_CHAR] = "cmd_char",
+        [STAT_CMD_WAVEFORM] = "cmd_waveform",
+        [STAT_CMD_JOYPAD] = "cmd_joypad",
+        [STAT_CMD_SYSTEM_INFO] = "cmd_system_info",
+        [STAT_CMD_INVALID] = "cmd_invalid",
+        [STAT_QUEUE_HIGH_WATER] = "queue_high_water",
+        [STAT_FRAMES] = "frames",
+        [STAT_FRAME_US_TOTAL] = "frame_us_total",
+        [STAT_FRAME_US_MAX] = "frame_us_max",
+        [STAT_AUDIO_FILL_0] = "audio_fill_00",
+        [STAT_AUDIO_FILL_0 + 1] = "audio_fill_10",
+        [STAT_AUDIO_FILL_0 + 2] = "audio_fill_20",
+        [STAT_AUDIO_FILL_0 + 3] = "audio_fill_30",
+        [STAT_AUDIO_FILL_0 + 4] = "audio_fill_40",
+        [STAT_AUDIO_FILL_0 + 5] = "audio_fill_50",
+        [STAT_AUDIO_FILL_0 + 6] = "audio_fill_60",
+        [STAT_AUDIO_FILL_0 + 7] = "audio_fill_70",
+        [STAT_AUDIO_FILL_0 + 8] = "audio_fill_80",
+        [STAT_AUDIO_FILL_9] = "audio_fill_90",
+        [STAT_CONNECTS] = "connects",
+        [STAT_CONNECTIONS_LOST] = "connections_lost",
+        [STAT_WATCHDOG_STALLS] = "watchdog_stalls",
+        [STAT_LOG_DROPPED] = "log_dropped",
+};
+
+void stats_max(stat_t stat, uint32_t value) {
+    uint32_t current = __atomic_load_n(&stats[stat], __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(&stats[stat], &current, value, 1, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+    }
+}
+
+void stats_audio_fill(uint32_t percent) {
+    uint32_t bucket = percent / 10;
+    stats_add(STAT_AUDIO_FILL_0 + (bucket > 9 ? 9 : bucket), 1);
+}
+
+void stats_reset() {
+    for (int i = 0; i < STAT_COUNT; i++) {
+        __atomic_store_n(&stats[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+const char *stats_name(stat_t stat) {
+    return stat < STAT_COUNT ? names[stat] : "unknown";
+}
+
+uint64_t stats_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
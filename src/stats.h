@@ -0,0 +1,50 @@
+#ifndef M8C_STATS_H
+#define M8C_STATS_H
+
+#include <stdint.h>
+
+/* Counters read through the control socket. Each one is a relaxed atomic,
+   so counting from any thread costs a single add. They wrap around. */
+typedef enum {
+    STAT_USB_READS,           // read transfers completed
+    STAT_USB_READ_ERRORS,     // read transfers that failed
+    STAT_SLIP_ERRORS,         // bytes the SLIP decoder rejected
+    STAT_CMD_RECT,            // commands processed, by type
+    STAT_CMD_CHAR,
+    STAT_CMD_WAVEFORM,
+    STAT_CMD_JOYPAD,
+    STAT_CMD_SYSTEM_INFO,
+    STAT_CMD_INVALID,         // wrong length or unknown type
+    STAT_QUEUE_HIGH_WATER,    // most packets ever waiting in the command queue
+    STAT_FRAMES,              // frames presented
+    STAT_FRAME_US_TOTAL,      // time spent presenting them
+    STAT_FRAME_US_MAX,
+    STAT_AUDIO_FILL_0,        // audio callbacks by ring buffer fill, in tenths
+    STAT_AUDIO_FILL_9 = STAT_AUDIO_FILL_0 + 9,
+    STAT_CONNECTS,            // times the M8 was opened
+    STAT_CONNECTIONS_LOST,
+    STAT_WATCHDOG_STALLS,     // threads the watchdog found stuck
+    STAT_LOG_DROPPED,         // log messages lost to a full ring
+    STAT_COUNT
+} stat_t;
+
+extern uint32_t stats[STAT_COUNT];
+
+static inline void stats_add(stat_t stat, uint32_t n) {
+    __atomic_add_fetch(&stats[stat], n, __ATOMIC_RELAXED);
+}
+
+// Raises a high-water mark counter to value
+void stats_max(stat_t stat, uint32_t value);
+
+// Counts one audio callback that found the ring buffer this full
+void stats_audio_fill(uint32_t percent);
+
+void stats_reset();
+
+const char *stats_name(stat_t stat);
+
+// CLOCK_MONOTONIC in microseconds, for timing
+uint64_t stats_now_us();
+
+#endif //M8C_STATS_H
@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+
+#include "threads.h"
+#include "SDL2_compat.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+/* Threads inherit the scheduling of the thread that creates them, so 0
+   means what m8c was started with, by nice or taskset for example, even in a
+   thread created after the render thread changed its own. */
+typedef struct {
+    const char *name;
+    int priority; // 0 = as started, 1..99 = SCHED_FIFO priority
+    int affinity; // 0 = as started, otherwise a bitmask of allowed CPUs
+} thread_settings_s;
+
+// The main thread's scheduling when threads_init() ran
+static struct {
+    int policy;
+    struct sched_param param;
+    int nice;
+    cpu_set_t cpus;
+    int cpus_known;
+} started;
+
+static thread_settings_s settings[THREAD_ROLE_MAX] = {
+        [THREAD_ROLE_RENDER] = {"render", 0, 0},
+        [THREAD_ROLE_USB] = {"usb", 0, 0},
+        [THREAD_ROLE_AUDIO] = {"audio", 0, 0},
+        [THREAD_ROLE_BACKGROUND] = {"background", 0, 0},
+};
+
+void threads_init(config_params_s *conf) {
+    started.policy = SCHED_OTHER;
+    pthread_getschedparam(pthread_self(), &started.policy, &started.param);
+    started.nice = getpriority(PRIO_PROCESS, 0);
+    started.cpus_known =
+            pthread_getaffinity_np(pthread_self(), sizeof(started.cpus), &started.cpus) == 0;
+
+    settings[THREAD_ROLE_RENDER].priority = conf->thread_render_priority;
+    settings[THREAD_ROLE_RENDER].affinity = conf->thread_render_affinity;
+    settings[THREAD_ROLE_USB].priority = conf->thread_usb_priority;
+    settings[THREAD_ROLE_USB].affinity = conf->thread_usb_affinity;
+    settings[THREAD_ROLE_AUDIO].priority = conf->thread_audio_priority;
+    settings[THREAD_ROLE_AUDIO].affinity = conf->thread_audio_affinity;
+}
+
+static int apply_priority(const thread_settings_s *s) {
+    if (s->priority <= 0) {
+        // Only undo what another role changed, so nothing needs privileges
+        // unless they were used to make that change
+        int policy = SCHED_OTHER;
+        struct sched_param param = {0};
+        pthread_getschedparam(pthread_self(), &policy, &param);
+        int ok = 1;
+        if (policy != started.policy || param.sched_priority != started.param.sched_priority) {
+            int rc = pthread_setschedparam(pthread_self(), started.policy, &started.param);
+            if (rc != 0) {
+                SDL_Log("Thread %s: could not restore the scheduling policy (%s)\n", s->name,
+                        strerror(rc));
+                ok = 0;
+            }
+        }
+        // The nice value is per thread on Linux
+        if (getpriority(PRIO_PROCESS, 0) != started.nice &&
+            setpriority(PRIO_PROCESS, 0, started.nice) != 0) {
+            SDL_Log("Thread %s: could not restore nice %d (%s)\n", s->name, started.nice,
+                    strerror(errno));
+            ok = 0;
+        }
+        return ok;
+    }
+
+    struct sched_param param;
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+    param.sched_priority = s->priority < min ? min : (s->priority > max ? max : s->priority);
+
+    int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rc == 0) {
+        return 1;
+    }
+
+    // Without CAP_SYS_NICE or an rtprio limit SCHED_FIFO is refused; try to at
+    // least get ahead of the other normal threads before giving up.
+    SDL_Log("Thread %s: SCHED_FIFO %d refused (%s), falling back to SCHED_OTHER\n",
+            s->name, param.sched_priority, strerror(rc));
+    if (setpriority(PRIO_PROCESS, 0, -10) != 0) {
+        SDL_Log("Thread %s: nice -10 refused as well (%s)\n", s->name, strerror(errno));
+    }
+    return 0;
+}
+
+// Online CPUs from sysfs, they need not be numbered without gaps
+static void online_cpus(cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    FILE *f = fopen("/sys/devices/system/cpu/online", "r");
+    int first, last;
+    char sep;
+    if (f != NULL) {
+        while (fscanf(f, "%d", &first) == 1) {
+            last = first;
+            sep = (char) fgetc(f);
+            if (sep == '-' && fscanf(f, "%d", &last) == 1) {
+                sep = (char) fgetc(f);
+            }
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+                CPU_SET(cpu, cpus);
+            }
+            if (sep != ',') {
+                break;
+            }
+        }
+        fclose(f);
+    }
+    if (CPU_COUNT(cpus) == 0) {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+}
+
+static int apply_affinity(const thread_settings_s *s) {
+    // Not the mask of this thread, which may have been pinned by its creator
+    cpu_set_t available;
+    cpu_set_t wanted;
+    online_cpus(&available);
+
+    if (s->affinity == 0) {
+        cpu_set_t current;
+        if (!started.cpus_known ||
+            (pthread_getaffinity_np(pthread_self(), sizeof(current), &current) == 0 &&
+             CPU_EQUAL(&current, &started.cpus))) {
+            return 1;
+        }
+        wanted = started.cpus;
+    } else {
+        CPU_ZERO(&wanted);
+        for (int cpu = 0; cpu < (int) (sizeof(s->affinity) * 8); cpu++) {
+            if ((s->affinity >> cpu) & 1 && CPU_ISSET(cpu, &available)) {
+                CPU_SET(cpu, &wanted);
+            }
+        }
+    }
+
+    if (CPU_COUNT(&wanted) == 0) {
+        SDL_Log("Thread %s: none of the CPUs in affinity mask 0x%X are online\n",
+                s->name, s->affinity);
+        return 0;
+    }
+
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(wanted), &wanted);
+    if (rc != 0) {
+        SDL_Log("Thread %s: setting affinity 0x%X failed (%s)\n", s->name,
+                s->affinity, strerror(rc));
+        return 0;
+    }
+    return 1;
+}
+
+int threads_apply(thread_role_t role) {
+    if (role < 0 || role >= THREAD_ROLE_MAX) {
+        return 0;
+    }
+    const thread_settings_s *s = &settings[role];
+
+    int ok = apply_priority(s);
+    ok &= apply_affinity(s);
+
+    // Report what the kernel actually gave us, not what was asked for
+    int policy = SCHED_OTHER;
+    struct sched_param param = {0};
+    pthread_getschedparam(pthread_self(), &policy, &param);
+
+    unsigned int mask = 0;
+    cpu_set_t cpus;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0) {
+        for (int cpu = 0; cpu < (int) (sizeof(mask) * 8); cpu++) {
+            if (CPU_ISSET(cpu, &cpus)) {
+                mask |= 1u << cpu;
+            }
+        }
+    }
+
+    SDL_Log("Thread %s: %s priority %d, nice %d, cpus 0x%X%s\n", s->name,
+            policy == SCHED_FIFO ? "SCHED_FIFO" : (policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER"),
+            param.sched_priority, getpriority(PRIO_PROCESS, 0), mask, ok ? "" : " (partially applied)");
+
+    return ok;
+}
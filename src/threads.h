@@ -0,0 +1,21 @@
+#ifndef M8C_THREADS_H
+#define M8C_THREADS_H
+
+#include "config.h"
+
+typedef enum thread_role_t {
+    THREAD_ROLE_RENDER,
+    THREAD_ROLE_USB,
+    THREAD_ROLE_AUDIO,
+    THREAD_ROLE_BACKGROUND, // helper threads started late, always as m8c was started
+    THREAD_ROLE_MAX
+} thread_role_t;
+
+// Store the per-role scheduling settings from the config
+void threads_init(config_params_s *conf);
+
+// Apply the scheduling settings of a role to the calling thread and log the
+// result. Returns 1 if everything requested was applied.
+int threads_apply(thread_role_t role);
+
+#endif //M8C_THREADS_H
@@ -0,0 +1,193 @@
+#include "trace.h"
+
+#ifdef M8C_TRACE
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "SDL2_compat.h"
+
+// Threads that can record, more are ignored
+#define TRACE_MAX_THREADS 8
+
+// Events kept per thread, a power of two. 16 bytes each.
+#define TRACE_RING_SIZE 32768
+
+// Oldest events skipped when a full ring is dumped while its thread runs
+#define TRACE_DUMP_MARGIN 256
+
+typedef struct {
+    uint32_t ts_us;
+    uint32_t dur_us;
+    uint32_t arg;
+    uint16_t event;
+    uint8_t phase;
+} trace_record_s;
+
+typedef struct {
+    char name[16];
+    int tid;
+    uint32_t head;  // records written, only the owning thread advances it
+    trace_record_s records[TRACE_RING_SIZE];
+} trace_buffer_s;
+
+static const char *event_names[TRACE_EVENT_COUNT] = {
+        "usb_read", "slip_decode", "usb_send", "queue_depth", "process_commands",
+        "blit", "flip", "audio_usb", "audio_callback"};
+
+int trace_enabled = 0;
+static const char *trace_path = NULL;
+static uint64_t start_us = 0;
+static trace_buffer_s *buffers[TRACE_MAX_THREADS];
+static int buffer_count = 0;
+static __thread trace_buffer_s *local_buffer = NULL;
+static __thread int local_full = 0;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static trace_buffer_s *thread_buffer() {
+    if (local_buffer != NULL || local_full) {
+        return local_buffer;
+    }
+    int index = __atomic_fetch_add(&buffer_count, 1, __ATOMIC_ACQ_REL);
+    if (index >= TRACE_MAX_THREADS) {
+        local_full = 1;
+        return NULL;
+    }
+    trace_buffer_s *buffer = calloc(1, sizeof(trace_buffer_s));
+    if (buffer == NULL) {
+        local_full = 1;
+        return NULL;
+    }
+    buffer->tid = index + 1;
+    snprintf(buffer->name, sizeof(buffer->name), "thread %d", buffer->tid);
+    __atomic_store_n(&buffers[index], buffer, __ATOMIC_RELEASE);
+    local_buffer = buffer;
+    return buffer;
+}
+
+static void record(trace_event_t event, char phase, uint32_t ts, uint32_t dur, uint32_t arg) {
+    trace_buffer_s *buffer = thread_buffer();
+    if (buffer == NULL) {
+        return;
+    }
+    uint32_t head = buffer->head;
+    trace_record_s *r = &buffer->records[head & (TRACE_RING_SIZE - 1)];
+    r->ts_us = ts;
+    r->dur_us = dur;
+    r->arg = arg;
+    r->event = (uint16_t) event;
+    r->phase = (uint8_t) phase;
+    __atomic_store_n(&buffer->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void trace_init(const char *path) {
+    if (path == NULL) {
+        return;
+    }
+    trace_path = path;
+    start_us = now_us();
+    __atomic_store_n(&trace_enabled, 1, __ATOMIC_RELEASE);
+    trace_thread("main");
+    SDL_Log("Tracing the frame pipeline to %s\n", path);
+}
+
+void trace_thread(const char *name) {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_buffer_s *buffer = thread_buffer();
+    if (buffer != NULL) {
+        snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+    }
+}
+
+uint32_t trace_begin() {
+    return (uint32_t) (now_us() - start_us);
+}
+
+void trace_end(trace_event_t event, uint32_t start, uint32_t arg) {
+    uint32_t now = (uint32_t) (now_us() - start_us);
+    record(event, 'X', start, now - start, arg);
+}
+
+void trace_counter(trace_event_t event, uint32_t value) {
+    record(event, 'C', (uint32_t) (now_us() - start_us), 0, value);
+}
+
+int trace_dump(const char *path) {
+    if (start_us == 0) {
+        return -1;
+    }
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        SDL_Log("Cannot write trace to %s\n", path);
+        return -1;
+    }
+
+    int events = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"m8c\"}}");
+
+    int count = __atomic_load_n(&buffer_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count && i < TRACE_MAX_THREADS; i++) {
+        trace_buffer_s *buffer = __atomic_load_n(&buffers[i], __ATOMIC_ACQUIRE);
+        if (buffer == NULL) {
+            continue;
+        }
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":\"%s\"}}", buffer->tid, buffer->name);
+
+        uint32_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+        uint32_t first = 0;
+        if (head > TRACE_RING_SIZE) {
+            first = head - TRACE_RING_SIZE + TRACE_DUMP_MARGIN;
+        }
+        for (uint32_t n = first; n < head; n++) {
+            const trace_record_s *r = &buffer->records[n & (TRACE_RING_SIZE - 1)];
+            if (r->event >= TRACE_EVENT_COUNT) {
+                continue;
+            }
+            if (r->phase == 'C') {
+                fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%u,\"pid\":1,\"tid\":%d,"
+                           "\"args\":{\"value\":%u}}",
+                        event_names[r->event], r->ts_us, buffer->tid, r->arg);
+            } else {
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"m8c\",\"ph\":\"X\",\"ts\":%u,"
+                           "\"dur\":%u,\"pid\":1,\"tid\":%d,\"args\":{\"n\":%u}}",
+                        event_names[r->event], r->ts_us, r->dur_us, buffer->tid, r->arg);
+            }
+            events++;
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    return events;
+}
+
+void trace_shutdown() {
+    if (trace_path == NULL) {
+        return;
+    }
+    __atomic_store_n(&trace_enabled, 0, __ATOMIC_RELEASE);
+    int events = trace_dump(trace_path);
+    if (events >= 0) {
+        SDL_Log("Wrote %d trace events to %s\n", events, trace_path);
+    }
+    int count = __atomic_load_n(&buffer_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count && i < TRACE_MAX_THREADS; i++) {
+        free(buffers[i]);
+        buffers[i] = NULL;
+    }
+    trace_path = NULL;
+}
+
+#endif
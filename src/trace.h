@@ -0,0 +1,67 @@
+#ifndef M8C_TRACE_H
+#define M8C_TRACE_H
+
+#include <stdint.h>
+
+/* Timing of the frame pipeline, written out as Chrome trace-event JSON for
+   Perfetto or chrome://tracing. Every thread records into its own ring of
+   events without locks, the newest events win when a ring is full.
+
+   The trace points compile to nothing unless M8C_TRACE is defined, and cost
+   one flag check while tracing is switched off at runtime. */
+
+typedef enum {
+    TRACE_USB_READ,        // read transfer completion on the USB thread
+    TRACE_SLIP_DECODE,     // bytes of one transfer through the SLIP decoder
+    TRACE_USB_SEND,        // queued input messages submitted to the M8
+    TRACE_QUEUE_DEPTH,     // counter, packets waiting when the main loop drains the queue
+    TRACE_PROCESS_COMMANDS,// one batch of process_command() calls
+    TRACE_BLIT,            // canvas to screen
+    TRACE_FLIP,            // SDL_Flip / SDL_UpdateRects
+    TRACE_AUDIO_USB,       // isochronous audio transfer completion
+    TRACE_AUDIO_CALLBACK,  // SDL audio output callback
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+#ifdef M8C_TRACE
+
+extern int trace_enabled;
+
+// Starts recording when path is set, the trace is written there on shutdown
+void trace_init(const char *path);
+void trace_shutdown();
+
+// Names the calling thread in the trace
+void trace_thread(const char *name);
+
+uint32_t trace_begin();
+void trace_end(trace_event_t event, uint32_t start, uint32_t arg);
+void trace_counter(trace_event_t event, uint32_t value);
+
+// Writes everything recorded so far, returns the number of events or -1
+int trace_dump(const char *path);
+
+#define TRACE_BEGIN(var) uint32_t var = trace_enabled ? trace_begin() : 0
+#define TRACE_END(event, var, arg)                                                            \
+    do {                                                                                      \
+        if (trace_enabled) trace_end(event, var, arg);                                        \
+    } while (0)
+#define TRACE_COUNTER(event, value)                                                           \
+    do {                                                                                      \
+        if (trace_enabled) trace_counter(event, value);                                       \
+    } while (0)
+#define TRACE_THREAD(name) trace_thread(name)
+
+#else
+
+#define trace_init(path) ((void) (path))
+#define trace_shutdown() ((void) 0)
+#define trace_dump(path) ((void) (path), -1)
+#define TRACE_BEGIN(var) ((void) 0)
+#define TRACE_END(event, var, arg) ((void) 0)
+#define TRACE_COUNTER(event, value) ((void) 0)
+#define TRACE_THREAD(name) ((void) 0)
+
+#endif
+
+#endif //M8C_TRACE_H
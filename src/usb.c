@@ -6,11 +6,19 @@
 #ifdef USE_LIBUSB
 
 #include <SDL.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 #include <libusb.h>
 
 #include "usb.h"
+#include "threads.h"
+#include "flight_recorder.h"
+#include "latency_probe.h"
+#include "trace.h"
+#include "watchdog.h"
 #include "SDL2_compat.h"
 
 static int ep_out_addr = 0x03;
@@ -19,24 +27,249 @@ static int ep_in_addr = 0x83;
 #define ACM_CTRL_DTR   0x01
 #define ACM_CTRL_RTS   0x02
 
+#define M8_VID 0x16c0
+#define M8_PID 0x048a
+
 libusb_context *ctx = NULL;
 libusb_device_handle *devh = NULL;
 
+// Held by the MIDI thread's direct sends and while the main thread closes devh
+static pthread_mutex_t devh_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static int do_exit = 0;
+static SDL_Thread *usb_thread = NULL;
+
+// How long the event thread blocks before checking do_exit
+#define EVENT_TIMEOUT_US 100000
+
+/* Connection state. The USB thread only reports what it sees through the
+   atomics below, the main thread owns conn_state and decides when to open and
+   close the device. */
+#define BACKOFF_MIN_MS 100
+#define BACKOFF_MAX_MS 1000
+
+static usb_conn_state_t conn_state = USB_CONN_WAITING;
+static uint32_t retry_ticks = 0;
+static uint32_t backoff_ms = BACKOFF_MIN_MS;
+
+static int hotplug_supported = 0;
+static libusb_hotplug_callback_handle hotplug_handle;
+static int device_present = 0;
+static int device_lost = 0;
+static uint32_t arrived_ticks = 0;
+static uint32_t lost_ticks = 0;
+static uint32_t last_data_ticks = 0;
+static uint32_t in_bytes = 0;
+
+// The read transfer is allocated once and reused for every connection
+static struct libusb_transfer *read_transfer = NULL;
+static int read_active = 0;
+
+// Outgoing messages are collected during a main loop tick and sent as one
+// bulk write from a small pool of preallocated transfers
+#define OUT_POOL_SIZE 8
+#define OUT_BUFFER_SIZE 64
+#define OUT_TIMEOUT_MS 50
+
+typedef struct {
+    struct libusb_transfer *transfer;
+    uint8_t buffer[OUT_BUFFER_SIZE];
+    uint64_t submit_us;
+    uint64_t origin_us; // when the event behind a direct send arrived, 0 otherwise
+    int in_use;
+} out_slot_s;
+
+static out_slot_s out_pool[OUT_POOL_SIZE];
+static uint8_t out_pending[OUT_BUFFER_SIZE];
+static int out_pending_len = 0;
+static usb_out_stats_s out_stats;
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
 int usb_loop(void *data) {
-//  SDL_SetThreadPriority(SDL_THREAD_PRIORITY_TIME_CRITICAL);
-    while (!do_exit) {
-        int rc = libusb_handle_events(ctx);
-        if (rc != LIBUSB_SUCCESS) {
-            SDL_Log("Audio loop error: %s\n", libusb_error_name(rc));
+    threads_apply(THREAD_ROLE_USB);
+    TRACE_THREAD("usb");
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        watchdog_beat(WATCHDOG_USB);
+        struct timeval tv = {0, EVENT_TIMEOUT_US};
+        int rc = libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+        if (rc != LIBUSB_SUCCESS && rc != LIBUSB_ERROR_INTERRUPTED) {
+            SDL_Log("USB event loop error: %s\n", libusb_error_name(rc));
             break;
         }
     }
     return 0;
 }
 
-static SDL_Thread *usb_thread;
+void usb_wait_transfers(int (*pending)(), const char *what) {
+    uint32_t start = SDL_GetTicks();
+    uint32_t reported = start;
+    while (pending() > 0) {
+        // Alongside the event thread, or instead of it if it has stopped
+        struct timeval tv = {0, EVENT_TIMEOUT_US};
+        if (ctx == NULL || libusb_handle_events_timeout_completed(ctx, &tv, NULL) < 0) {
+            SDL_Delay(1);
+        }
+        if (SDL_GetTicks() - reported >= 1000) {
+            reported = SDL_GetTicks();
+            SDL_Log("Still waiting for %d %s after %u ms\n", pending(), what, reported - start);
+        }
+    }
+}
+
+static int LIBUSB_CALL hotplug_callback(libusb_context *context, libusb_device *device,
+                                        libusb_hotplug_event event, void *user_data) {
+    // Only record the event, the device is opened from the main thread
+    if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        __atomic_store_n(&arrived_ticks, SDL_GetTicks(), __ATOMIC_RELAXED);
+        __atomic_store_n(&device_present, 1, __ATOMIC_RELEASE);
+    } else if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT) {
+        __atomic_store_n(&device_present, 0, __ATOMIC_RELEASE);
+        usb_report_lost("device unplugged");
+    }
+    return 0;
+}
+
+static int start_event_thread() {
+    if (usb_thread != NULL) {
+        return 1;
+    }
+    do_exit = 0;
+    usb_thread = SDL_CreateThread(&usb_loop, "USB");
+    return usb_thread != NULL;
+}
+
+// Creates the libusb context and its event thread once for the whole run
+static int usb_context_init() {
+    if (ctx != NULL) {
+        return 1;
+    }
+
+    int r = libusb_init(&ctx);
+    if (r < 0) {
+        SDL_Log("libusb_init failed: %s", libusb_error_name(r));
+        ctx = NULL;
+        return 0;
+    }
+
+    hotplug_supported = libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG);
+    if (hotplug_supported) {
+        r = libusb_hotplug_register_callback(
+                ctx, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+                LIBUSB_HOTPLUG_ENUMERATE, M8_VID, M8_PID, LIBUSB_HOTPLUG_MATCH_ANY,
+                hotplug_callback, NULL, &hotplug_handle);
+        if (r != LIBUSB_SUCCESS) {
+            SDL_Log("Hotplug registration failed: %s", libusb_error_name(r));
+            hotplug_supported = 0;
+        }
+    }
+    SDL_Log("Device detection: %s", hotplug_supported ? "hotplug" : "polling");
+
+    return start_event_thread();
+}
+
+static void out_pool_free();
+
+void usb_shutdown() {
+    if (ctx == NULL) {
+        return;
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    if (hotplug_supported) {
+        libusb_hotplug_deregister_callback(ctx, hotplug_handle);
+    }
+    if (usb_thread != NULL) {
+        SDL_WaitThread(usb_thread, NULL);
+        usb_thread = NULL;
+    }
+    out_pool_free();
+    if (read_transfer != NULL && !read_active) {
+        libusb_free_transfer(read_transfer);
+    }
+    read_transfer = NULL;
+    libusb_exit(ctx);
+    ctx = NULL;
+}
+
+void usb_report_lost(const char *reason) {
+    if (__atomic_exchange_n(&device_lost, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_store_n(&lost_ticks, SDL_GetTicks(), __ATOMIC_RELAXED);
+        SDL_Log("M8 connection lost: %s\n", reason);
+        flight_record_event("connection lost: %s", reason);
+    }
+}
+
+void usb_report_data(uint32_t bytes) {
+    __atomic_store_n(&last_data_ticks, SDL_GetTicks(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&in_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+uint32_t usb_in_bytes() {
+    return __atomic_load_n(&in_bytes, __ATOMIC_RELAXED);
+}
+
+static int out_pool_busy();
+
+void usb_get_state(usb_state_s *state) {
+    state->conn_state = __atomic_load_n(&conn_state, __ATOMIC_RELAXED);
+    state->device_lost = __atomic_load_n(&device_lost, __ATOMIC_ACQUIRE);
+    state->read_active = __atomic_load_n(&read_active, __ATOMIC_ACQUIRE);
+    state->out_in_flight = out_pool_busy();
+    state->ms_since_data = SDL_GetTicks() - __atomic_load_n(&last_data_ticks, __ATOMIC_RELAXED);
+}
+
+int usb_device_lost() {
+    return conn_state == USB_CONN_CONNECTED && __atomic_load_n(&device_lost, __ATOMIC_ACQUIRE);
+}
+
+void usb_lost_handled() {
+    uint32_t now = SDL_GetTicks();
+    uint32_t lost = __atomic_load_n(&lost_ticks, __ATOMIC_RELAXED);
+    SDL_Log("Removal detected %u ms after the last data from the M8, cleaned up in %u ms\n",
+            lost - __atomic_load_n(&last_data_ticks, __ATOMIC_RELAXED), now - lost);
+    conn_state = USB_CONN_WAITING;
+    backoff_ms = BACKOFF_MIN_MS;
+    retry_ticks = now;
+}
+
+usb_conn_state_t usb_conn_state() {
+    return conn_state;
+}
+
+int usb_connect_due() {
+    if (conn_state == USB_CONN_CONNECTED) {
+        return 0;
+    }
+    if ((int32_t) (SDL_GetTicks() - retry_ticks) < 0) {
+        return 0;
+    }
+    // Without hotplug every retry is a poll for the device
+    return !hotplug_supported || __atomic_load_n(&device_present, __ATOMIC_ACQUIRE);
+}
+
+void usb_connect_result(int success) {
+    uint32_t now = SDL_GetTicks();
+    if (success) {
+        if (hotplug_supported) {
+            SDL_Log("M8 connected %u ms after it appeared\n",
+                    now - __atomic_load_n(&arrived_ticks, __ATOMIC_RELAXED));
+        }
+        conn_state = USB_CONN_CONNECTED;
+        backoff_ms = BACKOFF_MIN_MS;
+        __atomic_store_n(&last_data_ticks, now, __ATOMIC_RELAXED);
+        __atomic_store_n(&device_lost, 0, __ATOMIC_RELEASE);
+        return;
+    }
+
+    // Retry with growing delays instead of hammering a device that is not ready
+    conn_state = USB_CONN_BACKOFF;
+    retry_ticks = now + backoff_ms;
+    backoff_ms = backoff_ms * 2 > BACKOFF_MAX_MS ? BACKOFF_MAX_MS : backoff_ms * 2;
+}
 
 static void LIBUSB_CALL xfr_cb_in(struct libusb_transfer *transfer) {
     int *completed = transfer->user_data;
@@ -77,12 +310,10 @@ int bulk_transfer(int endpoint, uint8_t *serial_buf, int count, unsigned int tim
 }
 
 int bulk_async_transfer(int endpoint, uint8_t *serial_buf, int count, unsigned int timeout_ms, void (*f)(struct libusb_transfer*)) {
-    int completed = 0;
-
     struct libusb_transfer *transfer;
     transfer = libusb_alloc_transfer(1);
     libusb_fill_bulk_stream_transfer(transfer, devh, endpoint, 0, serial_buf, count,
-                                     f, &completed, timeout_ms);
+                                     f, NULL, timeout_ms);
     int r = libusb_submit_transfer(transfer);
 
     if (r < 0) {
@@ -94,21 +325,220 @@ int bulk_async_transfer(int endpoint, uint8_t *serial_buf, int count, unsigned i
 }
 
 int async_read(uint8_t *serial_buf, int count, void (*f)(struct libusb_transfer*)) {
-    return bulk_async_transfer(ep_in_addr, serial_buf, count, 300, f);
+    if (read_transfer == NULL) {
+        read_transfer = libusb_alloc_transfer(0);
+        if (read_transfer == NULL) {
+            return LIBUSB_ERROR_NO_MEM;
+        }
+    }
+    libusb_fill_bulk_transfer(read_transfer, devh, ep_in_addr, serial_buf, count, f, NULL,
+                              300);
+    int r = libusb_submit_transfer(read_transfer);
+    if (r < 0) {
+        SDL_Log("Error submitting read: %s", libusb_error_name(r));
+        return r;
+    }
+    __atomic_store_n(&read_active, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void usb_read_finished(struct libusb_transfer *transfer) {
+    __atomic_store_n(&read_active, 0, __ATOMIC_RELEASE);
+}
+
+// Cancels the read started by async_read() and waits for its callback
+static int read_pending() {
+    return __atomic_load_n(&read_active, __ATOMIC_ACQUIRE);
+}
+
+// The read has to call back before the handle under it is closed
+static void cancel_read() {
+    if (!read_pending()) {
+        return;
+    }
+    libusb_cancel_transfer(read_transfer);
+    usb_wait_transfers(read_pending, "read transfer");
 }
 
 int blocking_write(void *buf,
                    int count, unsigned int timeout_ms) {
+    flight_record(FLIGHT_OUT, buf, count);
     return bulk_transfer(ep_out_addr, buf, count, timeout_ms);
 }
 
+static void LIBUSB_CALL out_transfer_cb(struct libusb_transfer *transfer) {
+    out_slot_s *slot = transfer->user_data;
+    uint32_t latency = (uint32_t) (now_us() - slot->submit_us);
+
+    if (transfer->status == LIBUSB_TRANSFER_COMPLETED &&
+        transfer->actual_length == transfer->length) {
+        __atomic_add_fetch(&out_stats.completed, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_add_fetch(&out_stats.errors, 1, __ATOMIC_RELAXED);
+    }
+
+    // Only written here on the USB thread, but read from others and a plain
+    // 64 bit add can tear on 32 bit ARM
+    __atomic_add_fetch(&out_stats.latency_us_total, latency, __ATOMIC_RELAXED);
+    if (latency > out_stats.latency_us_max) {
+        __atomic_store_n(&out_stats.latency_us_max, latency, __ATOMIC_RELAXED);
+    }
+
+    if (slot->origin_us != 0) {
+        uint32_t to_wire = (uint32_t) (now_us() - slot->origin_us);
+        __atomic_add_fetch(&out_stats.direct_latency_us_total, to_wire, __ATOMIC_RELAXED);
+        if (to_wire > out_stats.direct_latency_us_max) {
+            __atomic_store_n(&out_stats.direct_latency_us_max, to_wire, __ATOMIC_RELAXED);
+        }
+    }
+
+    __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+}
+
+// Transfers are allocated on the first connection and kept until shutdown
+static int out_pool_init() {
+    for (int i = 0; i < OUT_POOL_SIZE; i++) {
+        if (out_pool[i].transfer != NULL) {
+            continue;
+        }
+        out_pool[i].transfer = libusb_alloc_transfer(0);
+        if (out_pool[i].transfer == NULL) {
+            SDL_Log("Could not allocate outgoing transfer");
+            return 0;
+        }
+        out_pool[i].in_use = 0;
+    }
+    out_pending_len = 0;
+    return 1;
+}
+
+static int out_pool_busy() {
+    int busy = 0;
+    for (int i = 0; i < OUT_POOL_SIZE; i++) {
+        busy += __atomic_load_n(&out_pool[i].in_use, __ATOMIC_ACQUIRE);
+    }
+    return busy;
+}
+
+// Transfers still in flight complete or time out after OUT_TIMEOUT_MS
+static void out_pool_drain() {
+    usb_wait_transfers(out_pool_busy, "outgoing transfers");
+    out_pending_len = 0;
+}
+
+static void out_pool_free() {
+    out_pool_drain();
+    for (int i = 0; i < OUT_POOL_SIZE; i++) {
+        if (out_pool[i].transfer != NULL && !out_pool[i].in_use) {
+            libusb_free_transfer(out_pool[i].transfer);
+        }
+        out_pool[i].transfer = NULL;
+    }
+    out_pending_len = 0;
+}
+
+int send_queued_messages();
+
+// Add a message to the batch sent by the next send_queued_messages()
+static int queue_msg(const uint8_t *msg, int len) {
+    if (out_pending_len + len > OUT_BUFFER_SIZE) {
+        send_queued_messages();
+        if (out_pending_len + len > OUT_BUFFER_SIZE) {
+            __atomic_add_fetch(&out_stats.dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+    }
+    memcpy(out_pending + out_pending_len, msg, len);
+    out_pending_len += len;
+    __atomic_add_fetch(&out_stats.queued, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static out_slot_s *out_pool_acquire() {
+    for (int i = 0; i < OUT_POOL_SIZE; i++) {
+        if (out_pool[i].transfer != NULL &&
+            __atomic_exchange_n(&out_pool[i].in_use, 1, __ATOMIC_ACQ_REL) == 0) {
+            return &out_pool[i];
+        }
+    }
+    return NULL;
+}
+
+int send_queued_messages() {
+    if (out_pending_len == 0 || devh == NULL) {
+        return 0;
+    }
+
+    TRACE_BEGIN(trace_send);
+    out_slot_s *slot = out_pool_acquire();
+    if (slot == NULL) {
+        // Every transfer is still in flight, keep the batch for the next tick
+        __atomic_add_fetch(&out_stats.pool_exhausted, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    int len = out_pending_len;
+    memcpy(slot->buffer, out_pending, len);
+    out_pending_len = 0;
+    flight_record(FLIGHT_OUT, slot->buffer, len);
+
+    libusb_fill_bulk_transfer(slot->transfer, devh, ep_out_addr, slot->buffer, len,
+                              out_transfer_cb, slot, OUT_TIMEOUT_MS);
+    slot->submit_us = now_us();
+    slot->origin_us = 0;
+
+    int r = libusb_submit_transfer(slot->transfer);
+    if (r < 0) {
+        SDL_Log("Error submitting outgoing transfer: %s", libusb_error_name(r));
+        __atomic_add_fetch(&out_stats.errors, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+        return r;
+    }
+
+    __atomic_add_fetch(&out_stats.submitted, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&out_stats.bytes, len, __ATOMIC_RELAXED);
+    latency_probe_usb_sent();
+    TRACE_END(TRACE_USB_SEND, trace_send, len);
+    return len;
+}
+
+void usb_get_out_stats(usb_out_stats_s *stats) {
+    stats->queued = __atomic_load_n(&out_stats.queued, __ATOMIC_RELAXED);
+    stats->submitted = __atomic_load_n(&out_stats.submitted, __ATOMIC_RELAXED);
+    stats->completed = __atomic_load_n(&out_stats.completed, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&out_stats.errors, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&out_stats.dropped, __ATOMIC_RELAXED);
+    stats->pool_exhausted = __atomic_load_n(&out_stats.pool_exhausted, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&out_stats.bytes, __ATOMIC_RELAXED);
+    stats->latency_us_total = __atomic_load_n(&out_stats.latency_us_total, __ATOMIC_RELAXED);
+    stats->latency_us_max = __atomic_load_n(&out_stats.latency_us_max, __ATOMIC_RELAXED);
+    stats->direct = __atomic_load_n(&out_stats.direct, __ATOMIC_RELAXED);
+    stats->direct_latency_us_total = __atomic_load_n(&out_stats.direct_latency_us_total, __ATOMIC_RELAXED);
+    stats->direct_latency_us_max = __atomic_load_n(&out_stats.direct_latency_us_max, __ATOMIC_RELAXED);
+}
+
+static void log_out_stats() {
+    usb_out_stats_s stats;
+    usb_get_out_stats(&stats);
+    uint32_t done = stats.completed + stats.errors;
+    SDL_Log("Outgoing USB: %u messages in %u writes (%u bytes), %u completed, %u errors, "
+            "%u dropped, pool exhausted %u times, latency avg %u us max %u us\n",
+            stats.queued, stats.submitted, stats.bytes, stats.completed, stats.errors,
+            stats.dropped, stats.pool_exhausted,
+            done > 0 ? (uint32_t) (stats.latency_us_total / done) : 0, stats.latency_us_max);
+    if (stats.direct > 0) {
+        SDL_Log("Direct USB sends: %u, event to wire avg %u us max %u us\n", stats.direct,
+                (uint32_t) (stats.direct_latency_us_total / stats.direct),
+                stats.direct_latency_us_max);
+    }
+}
+
 int serial_read(uint8_t *serial_buf, int count) {
     return bulk_transfer(ep_in_addr, serial_buf, count, 1);
 }
 
 int check_serial_port() {
-    // Reading will fail anyway when the device is not present anymore
-    return 1;
+    return devh != NULL && !__atomic_load_n(&device_lost, __ATOMIC_ACQUIRE);
 }
 
 int init_interface() {
@@ -155,11 +585,24 @@ int init_interface() {
         return 0;
     }
 
-    usb_thread = SDL_CreateThread(&usb_loop, "USB");
+    if (!out_pool_init()) {
+        return 0;
+    }
 
     return 1;
 }
 
+// Undoes a partly successful open so the next attempt starts clean
+static void close_device() {
+    for (int if_num = 0; if_num < 2; if_num++) {
+        libusb_release_interface(devh, if_num);
+    }
+    pthread_mutex_lock(&devh_lock);
+    libusb_close(devh);
+    devh = NULL;
+    pthread_mutex_unlock(&devh_lock);
+}
+
 int init_serial_with_file_descriptor(int file_descriptor) {
     SDL_Log("Initialising serial with file descriptor");
 
@@ -194,7 +637,11 @@ int init_serial_with_file_descriptor(int file_descriptor) {
     }
     SDL_Log("USB device init success");
 
-    return init_interface();
+    if (!start_event_thread() || !init_interface()) {
+        close_device();
+        return 0;
+    }
+    return 1;
 }
 
 int init_serial(int verbose) {
@@ -203,20 +650,24 @@ int init_serial(int verbose) {
         return 1;
     }
 
-    int r;
-    r = libusb_init(&ctx);
-    if (r < 0) {
-        SDL_Log("libusb_init failed: %s", libusb_error_name(r));
+    if (!usb_context_init()) {
         return 0;
     }
-    devh = libusb_open_device_with_vid_pid(ctx, 0x16c0, 0x048a);
+
+    devh = libusb_open_device_with_vid_pid(ctx, M8_VID, M8_PID);
     if (devh == NULL) {
-        SDL_Log("libusb_open_device_with_vid_pid returned invalid handle");
+        if (verbose) {
+            SDL_Log("libusb_open_device_with_vid_pid returned invalid handle");
+        }
         return 0;
     }
     SDL_Log("USB device init success");
 
-    return init_interface();
+    if (!init_interface()) {
+        close_device();
+        return 0;
+    }
+    return 1;
 }
 
 int reset_display() {
@@ -224,10 +675,20 @@ int reset_display() {
 
     SDL_Log("Reset display\n");
 
-    char buf[1] = {'R'};
+    uint8_t buf[1] = {'R'};
 
-    result = blocking_write(buf, 1, 5);
-    if (result != 1) {
+    // Sent right away, but without waiting for the transfer to complete
+    if (queue_msg(buf, 1) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error resetting M8 display, outgoing queue full");
+        return 0;
+    }
+    result = send_queued_messages();
+    if (result == 0 && devh != NULL && out_pending_len > 0) {
+        // Every transfer is busy, the main loop sends the batch on its next tick
+        SDL_Log("M8 display reset deferred, outgoing transfers busy\n");
+        return RESET_DEFERRED;
+    }
+    if (result < 1) {
         SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error resetting M8 display, code %d",
                      result);
         return 0;
@@ -256,62 +717,119 @@ int enable_and_reset_display() {
 int disconnect() {
 
     char buf[1] = {'D'};
-    int result;
+    int result = 1;
+
+    if (devh == NULL) {
+        return 0;
+    }
 
     SDL_Log("Disconnecting M8\n");
 
-    result = blocking_write(buf, 1, 5);
-    if (result != 1) {
-        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error sending disconnect, code %d",
-                     result);
-        return -1;
+    // A device that is already gone cannot be told to stop
+    if (!__atomic_load_n(&device_lost, __ATOMIC_ACQUIRE)) {
+        send_queued_messages();
+        result = blocking_write(buf, 1, 5);
+        if (result != 1) {
+            SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error sending disconnect, code %d",
+                         result);
+            result = -1;
+        }
     }
 
+    cancel_read();
+
+    // No direct sends from here on, the ones in flight finish before the close
+    pthread_mutex_lock(&devh_lock);
+
     int rc;
 
     for (int if_num = 0; if_num < 2; if_num++) {
         rc = libusb_release_interface(devh, if_num);
         if (rc < 0) {
             SDL_Log("Error releasing interface: %s", libusb_error_name(rc));
-            return 0;
         }
     }
 
-    do_exit = 1;
-
-    if (devh != NULL) {
-        libusb_close(devh);
-    }
-
-    SDL_WaitThread(usb_thread, NULL);
+    out_pool_drain();
+    log_out_stats();
 
-    libusb_exit(ctx);
+    // The context, the event thread and the transfers stay up for the next
+    // connection
+    libusb_close(devh);
+    devh = NULL;
+    pthread_mutex_unlock(&devh_lock);
 
-    return 1;
+    return result;
 }
 
 int send_msg_controller(uint8_t input) {
-    char buf[2] = {'C', input};
-    int nbytes = 2;
+    uint8_t buf[2] = {'C', input};
     int result;
-    result = blocking_write(buf, nbytes, 5);
-    if (result != nbytes) {
-        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error sending input, code %d",
+    result = queue_msg(buf, 2);
+    if (result < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error queueing input, code %d",
                      result);
         return -1;
     }
     return 1;
 }
 
+int send_msg_direct(const uint8_t *msg, int len, uint64_t origin_us) {
+    if (len > OUT_BUFFER_SIZE) {
+        return -1;
+    }
+
+    // devh must not be closed between the check and the submit
+    pthread_mutex_lock(&devh_lock);
+    if (devh == NULL || __atomic_load_n(&device_lost, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_unlock(&devh_lock);
+        return -1;
+    }
+
+    out_slot_s *slot = out_pool_acquire();
+    if (slot == NULL) {
+        pthread_mutex_unlock(&devh_lock);
+        __atomic_add_fetch(&out_stats.pool_exhausted, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    memcpy(slot->buffer, msg, len);
+    flight_record(FLIGHT_OUT, msg, len);
+    libusb_fill_bulk_transfer(slot->transfer, devh, ep_out_addr, slot->buffer, len,
+                              out_transfer_cb, slot, OUT_TIMEOUT_MS);
+    slot->submit_us = now_us();
+    slot->origin_us = origin_us != 0 ? origin_us : slot->submit_us;
+
+    int r = libusb_submit_transfer(slot->transfer);
+    pthread_mutex_unlock(&devh_lock);
+    if (r < 0) {
+        __atomic_add_fetch(&out_stats.errors, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->in_use, 0, __ATOMIC_RELEASE);
+        return r;
+    }
+
+    __atomic_add_fetch(&out_stats.queued, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&out_stats.submitted, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&out_stats.direct, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&out_stats.bytes, len, __ATOMIC_RELAXED);
+    return len;
+}
+
+int send_keyjazz_direct(uint8_t note, uint8_t velocity, uint64_t origin_us) {
+    if (velocity > 0x7F)
+        velocity = 0x7F;
+    uint8_t buf[3] = {'K', note, velocity};
+    return send_msg_direct(buf, 3, origin_us);
+}
+
 int send_msg_keyjazz(uint8_t note, uint8_t velocity) {
     if (velocity > 0x7F)
         velocity = 0x7F;
-    char buf[3] = {'K', note, velocity};
-    int nbytes = 3;
+    uint8_t buf[3] = {'K', note, velocity};
     int result;
-    result = blocking_write(buf, nbytes, 5);
-    if (result != nbytes) {
-        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error sending keyjazz, code %d",
+    result = queue_msg(buf, 3);
+    if (result < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Error queueing keyjazz, code %d",
                      result);
         return -1;
     }
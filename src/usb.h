@@ -5,5 +5,103 @@
 #include <libusb.h>
 extern libusb_device_handle *devh;
 
+// Counters for the outgoing message queue
+typedef struct {
+    uint32_t queued;         // messages handed to the queue
+    uint32_t submitted;      // bulk writes submitted, each carrying one or more messages
+    uint32_t completed;      // writes that finished successfully
+    uint32_t errors;         // writes that failed to submit or complete
+    uint32_t dropped;        // messages that did not fit into the pending batch
+    uint32_t pool_exhausted; // ticks where every transfer was still in flight
+    uint32_t bytes;
+    uint64_t latency_us_total; // submit to completion, summed over all writes
+    uint32_t latency_us_max;
+    uint32_t direct;                  // messages sent with send_msg_direct()
+    uint64_t direct_latency_us_total; // from the originating event to completion
+    uint32_t direct_latency_us_max;
+} usb_out_stats_s;
+
+void usb_get_out_stats(usb_out_stats_s *stats);
+
+typedef enum {
+    USB_CONN_WAITING,   // no device open, waiting for it to appear
+    USB_CONN_BACKOFF,   // the last attempt to open it failed, retrying later
+    USB_CONN_CONNECTED
+} usb_conn_state_t;
+
+usb_conn_state_t usb_conn_state();
+
+/* Whether the main loop should try to open the M8 now. With hotplug support
+   this turns true as soon as the device is plugged in, otherwise it paces
+   polling. Report the outcome with usb_connect_result(). */
+int usb_connect_due();
+void usb_connect_result(int success);
+
+/* Whether the open device has been unplugged or stopped responding. The main
+   loop then closes it and calls usb_lost_handled(). */
+int usb_device_lost();
+void usb_lost_handled();
+
+// Called from transfer callbacks on the USB thread
+void usb_report_lost(const char *reason);
+void usb_report_data(uint32_t bytes);
+
+// Bytes read from the M8 since start, wraps around
+uint32_t usb_in_bytes();
+
+// Transfer states for the watchdog, safe to read from any thread
+typedef struct {
+    usb_conn_state_t conn_state;
+    int device_lost;
+    int read_active;          // the read transfer is submitted
+    int out_in_flight;        // outgoing transfers not completed yet
+    uint32_t ms_since_data;   // since the last read that returned data
+} usb_state_s;
+
+void usb_get_state(usb_state_s *state);
+
+// The read started by async_read() stopped, frees its transfer
+void usb_read_finished(struct libusb_transfer *transfer);
+
+// Stops the USB event thread and releases libusb, at exit only
+void usb_shutdown();
+
+/* Handles USB events until pending() returns 0. For cancelled transfers,
+   which must have called back before their handle is closed or they are
+   filled again. libusb calls back every cancelled transfer, so this does
+   not give up, it only logs while it waits. */
+void usb_wait_transfers(int (*pending)(), const char *what);
+
+// reset_display() queued the reset but every transfer was busy, the main
+// loop sends it with the next batch
+#define RESET_DEFERRED 2
+
+/* Submit a message right away from any thread, bypassing the per-tick batch.
+   origin_us is the CLOCK_MONOTONIC time in microseconds of the event that
+   caused it, used to measure event to wire latency. Returns the number of
+   bytes submitted or a negative value if no transfer was free. */
+int send_msg_direct(const uint8_t *msg, int len, uint64_t origin_us);
+
+int send_keyjazz_direct(uint8_t note, uint8_t velocity, uint64_t origin_us);
+
+#endif //M8C_USB_H
+#else
+#ifndef M8C_USB_H
+#define M8C_USB_H
+
+#include <stdint.h>
+
+struct libusb_transfer;
+
+// Without libusb there is no connection manager, the port is polled every tick
+static inline int usb_connect_due() { return 1; }
+static inline void usb_connect_result(int success) {}
+static inline int usb_device_lost() { return 0; }
+static inline void usb_lost_handled() {}
+static inline void usb_report_lost(const char *reason) {}
+static inline void usb_report_data(uint32_t bytes) {}
+static inline void usb_read_finished(struct libusb_transfer *transfer) {}
+static inline void usb_shutdown() {}
+
 #endif //M8C_USB_H
 #endif
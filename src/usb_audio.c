@@ -3,8 +3,18 @@
 #include <libusb.h>
 #include <errno.h>
 #include <SDL.h>
+#include <sys/resource.h>
+#include "audio.h"
+#include "audio_capture.h"
+#include "audio_convert.h"
+#include "audio_dsp.h"
+#include "flight_recorder.h"
 #include "ringbuffer.h"
+#include "stats.h"
 #include "usb.h"
+#include "threads.h"
+#include "trace.h"
+#include "watchdog.h"
 #include "SDL2_compat.h"
 #include "SDL_mutex.h"
 
@@ -14,42 +24,303 @@
 #define NUM_TRANSFERS 32
 #define PACKET_SIZE 180
 #define NUM_PACKETS 2
+// Packets per transfer while the M8 only sends silence, fewer wakeups
+#define NUM_PACKETS_IDLE 16
+
+// Failed transfers in a row that are resubmitted before one is given up on
+#define MAX_XFR_ERRORS 16
+
+// Length of the ramp applied when audio resumes after silence
+#define FADE_IN_FRAMES 256
+
+// Format of the audio stream coming from the M8
+#define M8_AUDIO_FREQ 44100
+#define M8_AUDIO_FRAME_SIZE 4
 
 #define SDL_zero(x) SDL_memset(&(x), 0, sizeof((x)))
 
 RingBuffer *audio_buffer = NULL;
 
+static audio_convert_s converter;
+static uint8_t *convert_buffer = NULL;
+static uint32_t convert_buffer_size = 0;
+
+// SDL creates a new audio thread every time the device is opened
+static int audio_thread_configured = 0;
+
+// Set once audio_init() has fully succeeded, so audio_destroy() runs only once
+static int audio_active = 0;
+
+/* While the M8 sends nothing but zeros the output is paused, packets are not
+   copied and transfers are resubmitted with more packets each. */
+static int silence_hold_ms = 3000;
+static int audio_idle = 0;
+static uint32_t ticks_last_sound = 0;
+static uint32_t fade_in_remaining = 0;
+// After idle the output restarts with one device period buffered instead of
+// waiting for the usual third of the ring, until that has built up again
+static int fast_resume = 0;
+static uint32_t resume_bytes = 0;
+
+// Counters for the current active or idle period. Outside audio_init() and
+// audio_disconnect(), which run while no transfer is in flight, only cb_xfr()
+// touches them
+static uint32_t usb_wakeups = 0;
+static uint32_t audio_callbacks = 0;
+static uint32_t ticks_period_start = 0;
+static uint64_t cpu_us_period_start = 0;
+
+// Since start, while not idle
+static uint32_t underruns = 0;
+static uint32_t overruns = 0;
+
+// Transfers submitted and not yet finished, so they are never freed or
+// refilled while libusb still owns them
+static int transfers_in_flight = 0;
+static int xfr_owned[NUM_TRANSFERS];
+
+// Set while the transfers are meant to be running, cleared before cancelling
+static int usb_streaming = 0;
+
+// Transfers that failed in a row, only touched on the USB thread
+static int xfr_errors = 0;
+
+void audio_set_silence_hold(int hold_ms) {
+    silence_hold_ms = hold_ms;
+}
+
+void audio_get_stats(audio_stats_s *stats) {
+    RingBuffer *rb = audio_buffer;
+    stats->fill_percent = rb != NULL && rb->max_size > 0 ? rb->size * 100 / rb->max_size : 0;
+    stats->underruns = __atomic_load_n(&underruns, __ATOMIC_RELAXED);
+    stats->overruns = __atomic_load_n(&overruns, __ATOMIC_RELAXED);
+    stats->playing = SDL_GetAudioStatus() == SDL_AUDIO_PLAYING;
+    stats->transfers_in_flight = __atomic_load_n(&transfers_in_flight, __ATOMIC_ACQUIRE);
+}
+
+static uint64_t process_cpu_us() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Log what the period that just ended cost and start counting a new one
+static void report_period(int was_idle) {
+    uint32_t now = SDL_GetTicks();
+    uint64_t cpu_us = process_cpu_us();
+    uint32_t elapsed = now - ticks_period_start;
+
+    if (ticks_period_start != 0 && elapsed > 0) {
+        SDL_Log("Audio %s for %.1f s: %.1f USB wakeups/s, %.1f output callbacks/s, %.1f%% CPU\n",
+                was_idle ? "idle" : "active", elapsed / 1000.0f,
+                usb_wakeups * 1000.0f / elapsed,
+                __atomic_load_n(&audio_callbacks, __ATOMIC_RELAXED) * 1000.0f / elapsed,
+                (cpu_us - cpu_us_period_start) / (elapsed * 10.0f));
+    }
+
+    usb_wakeups = 0;
+    __atomic_store_n(&audio_callbacks, 0, __ATOMIC_RELAXED);
+    ticks_period_start = now;
+    cpu_us_period_start = cpu_us;
+}
+
+static int packet_is_silent(const uint8_t *data, uint32_t length) {
+    // Packet buffers are 4-byte aligned, PACKET_SIZE being a multiple of 4
+    const uint32_t *words = (const uint32_t *) data;
+    uint32_t acc = 0;
+    uint32_t i;
+    for (i = 0; i < length / 4; i++) {
+        acc |= words[i];
+    }
+    for (i *= 4; i < length; i++) {
+        acc |= data[i];
+    }
+    return acc == 0;
+}
+
+// Ramp up the first frames after leaving idle so playback never starts with a step
+static void apply_fade_in(int16_t *samples, uint32_t frames) {
+    uint32_t remaining = __atomic_load_n(&fade_in_remaining, __ATOMIC_ACQUIRE);
+    if (remaining == 0) {
+        return;
+    }
+    uint32_t n = frames < remaining ? frames : remaining;
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t g = FADE_IN_FRAMES - remaining + i;
+        samples[2 * i] = (int16_t) (samples[2 * i] * g / FADE_IN_FRAMES);
+        samples[2 * i + 1] = (int16_t) (samples[2 * i + 1] * g / FADE_IN_FRAMES);
+    }
+    __atomic_store_n(&fade_in_remaining, remaining - n, __ATOMIC_RELEASE);
+}
+
+static void record_fill(uint8_t fill_percent, int underrun) {
+    flight_audio_sample_s sample = {fill_percent, underrun != 0};
+    flight_record(FLIGHT_AUDIO, &sample, sizeof(sample));
+}
+
 static void audio_callback(void *userdata, Uint8 *stream,
                            int len) {
+    if (!audio_thread_configured) {
+        audio_thread_configured = 1;
+        threads_apply(THREAD_ROLE_AUDIO);
+        TRACE_THREAD("audio");
+    }
+    TRACE_BEGIN(trace_callback);
+    watchdog_beat(WATCHDOG_AUDIO);
+
+    __atomic_add_fetch(&audio_callbacks, 1, __ATOMIC_RELAXED);
+    uint8_t fill_percent = audio_buffer->size * 100 / audio_buffer->max_size;
+    stats_audio_fill(fill_percent);
+
+    if (!converter.bypass) {
+        // Pull as much M8 audio as the converter needs for this callback
+        uint32_t out_frames = len / converter.out_frame_size;
+        uint32_t in_len = audio_convert_frames_needed(&converter, out_frames) * M8_AUDIO_FRAME_SIZE;
+        if (in_len > convert_buffer_size) {
+            in_len = convert_buffer_size;
+        }
+
+        uint32_t read_len = in_len > 0 ? ring_buffer_pop(audio_buffer, convert_buffer, in_len) : 0;
+        if (read_len == -1) {
+            SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Buffer underflow!");
+            read_len = 0;
+        }
+        if (read_len < in_len) {
+            __atomic_add_fetch(&underruns, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&fast_resume, 0, __ATOMIC_RELAXED);
+        }
+
+        apply_fade_in((int16_t *) convert_buffer, read_len / M8_AUDIO_FRAME_SIZE);
+        audio_dsp_process((int16_t *) convert_buffer, read_len / M8_AUDIO_FRAME_SIZE);
+        audio_convert_process(&converter, (const int16_t *) convert_buffer,
+                              read_len / M8_AUDIO_FRAME_SIZE, stream, out_frames);
+        record_fill(fill_percent, read_len < in_len);
+        TRACE_END(TRACE_AUDIO_CALLBACK, trace_callback, len);
+        return;
+    }
+
     uint32_t read_len = ring_buffer_pop(audio_buffer, stream, len);
 
+    if (read_len == -1 || read_len < len) {
+        __atomic_add_fetch(&underruns, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&fast_resume, 0, __ATOMIC_RELAXED);
+    }
     if (read_len == -1) {
         SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Buffer underflow!");
+    } else {
+        apply_fade_in((int16_t *) stream, read_len / M8_AUDIO_FRAME_SIZE);
+        audio_dsp_process((int16_t *) stream, read_len / M8_AUDIO_FRAME_SIZE);
     }
 
     if (read_len < len) {
 //        SDL_memset(&stream[read_len], 0, len - read_len);
         SDL_MixAudio(stream, &stream[read_len], len - read_len, SDL_MIX_MAXVOLUME);
     }
+    record_fill(fill_percent, read_len == -1 || read_len < len);
+    TRACE_END(TRACE_AUDIO_CALLBACK, trace_callback, len);
+
+}
 
+static void enter_idle() {
+    report_period(0);
+    audio_idle = 1;
+    // SDL outputs silence by itself while paused, without calling us
+    SDL_PauseAudio(1);
+    ring_buffer_clear(audio_buffer);
+    SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Audio idle after %d ms of silence\n",
+                 silence_hold_ms);
+}
+
+static void leave_idle() {
+    report_period(1);
+    audio_idle = 0;
+    __atomic_store_n(&fade_in_remaining, FADE_IN_FRAMES, __ATOMIC_RELEASE);
+    __atomic_store_n(&fast_resume, 1, __ATOMIC_RELAXED);
+}
+
+static int audio_transfers_pending() {
+    return __atomic_load_n(&transfers_in_flight, __ATOMIC_ACQUIRE);
+}
+
+// libusb handed the transfer back and it is not resubmitted
+static int release_transfer(struct libusb_transfer *xfr) {
+    __atomic_store_n((int *) xfr->user_data, 0, __ATOMIC_RELEASE);
+    return __atomic_sub_fetch(&transfers_in_flight, 1, __ATOMIC_RELEASE);
+}
+
+// Once the last transfer stops while streaming, audio is dead and the
+// connection manager reconnects
+static void retire_transfer(struct libusb_transfer *xfr) {
+    if (release_transfer(xfr) == 0 && __atomic_load_n(&usb_streaming, __ATOMIC_ACQUIRE)) {
+        usb_report_lost("audio stream stopped");
+    }
 }
 
 static void cb_xfr(struct libusb_transfer *xfr) {
     unsigned int i;
+    usb_wakeups++;
+    TRACE_BEGIN(trace_xfr);
+
+    if (xfr->status == LIBUSB_TRANSFER_CANCELLED) {
+        release_transfer(xfr);
+        return;
+    }
+    if (xfr->status == LIBUSB_TRANSFER_NO_DEVICE) {
+        usb_report_lost("audio stream stopped");
+        release_transfer(xfr);
+        return;
+    }
+    // Other errors are often a single missed frame, try again a few times
+    if (xfr->status != LIBUSB_TRANSFER_COMPLETED) {
+        if (xfr_errors++ == 0) {
+            SDL_Log("Audio transfer failed (status %d), resubmitting\n", xfr->status);
+        }
+        if (xfr_errors > MAX_XFR_ERRORS || libusb_submit_transfer(xfr) < 0) {
+            retire_transfer(xfr);
+        }
+        return;
+    }
+    xfr_errors = 0;
+
     for (i = 0; i < xfr->num_iso_packets; i++) {
         struct libusb_iso_packet_descriptor *pack = &xfr->iso_packet_desc[i];
 
+        // A lost packet is a gap in the sound, the next one may be fine
         if (pack->status != LIBUSB_TRANSFER_COMPLETED) {
-            SDL_Log("XFR callback error (status %d: %s)", pack->status,
-                    libusb_error_name(pack->status));
-            /* This doesn't happen, so bail out if it does. */
-            return;
+            SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Audio packet error (status %d: %s)",
+                         pack->status, libusb_error_name(pack->status));
+            continue;
         }
 
         const uint8_t *data = libusb_get_iso_packet_buffer_simple(xfr, i);
+        audio_capture_write(data, pack->actual_length);
+
+        if (silence_hold_ms > 0) {
+            if (!packet_is_silent(data, pack->actual_length)) {
+                ticks_last_sound = SDL_GetTicks();
+                if (audio_idle) {
+                    leave_idle();
+                }
+            } else if (audio_idle) {
+                continue;
+            } else if (SDL_GetTicks() - ticks_last_sound > (uint32_t) silence_hold_ms) {
+                enter_idle();
+                continue;
+            }
+        }
+
         uint32_t actual = ring_buffer_push(audio_buffer, data, pack->actual_length);
 
-        if (audio_buffer->size < audio_buffer->max_size/4) {
+        if (__atomic_load_n(&fast_resume, __ATOMIC_RELAXED)) {
+            // An underrun in the callback ends this and the low mark applies again
+            if (audio_buffer->size >= resume_bytes) {
+                SDL_PauseAudio(0);
+            }
+            if (audio_buffer->size > audio_buffer->max_size/3) {
+                __atomic_store_n(&fast_resume, 0, __ATOMIC_RELAXED);
+            }
+        } else if (audio_buffer->size < audio_buffer->max_size/4) {
             SDL_PauseAudio(1);
         } else if (audio_buffer->size > audio_buffer->max_size/3) {
             SDL_PauseAudio( 0);
@@ -58,35 +329,123 @@ static void cb_xfr(struct libusb_transfer *xfr) {
         if (actual == -1) {
             SDL_LogDebug(SDL_LOG_CATEGORY_APPLICATION, "Buffer overflow!");
         }
+        if (actual == -1 || actual < pack->actual_length) {
+            __atomic_add_fetch(&overruns, 1, __ATOMIC_RELAXED);
+        }
     }
 
+    // Batch more packets into each transfer while idle
+    int packets = audio_idle ? NUM_PACKETS_IDLE : NUM_PACKETS;
+    if (xfr->num_iso_packets != packets) {
+        xfr->num_iso_packets = packets;
+        xfr->length = PACKET_SIZE * packets;
+        libusb_set_iso_packet_lengths(xfr, PACKET_SIZE);
+    }
+    TRACE_END(TRACE_AUDIO_USB, trace_xfr, xfr->num_iso_packets);
+
     if (libusb_submit_transfer(xfr) < 0) {
         SDL_Log("error re-submitting URB\n");
-        SDL_free(xfr->buffer);
+        retire_transfer(xfr);
     }
 }
 
 static struct libusb_transfer *xfr[NUM_TRANSFERS];
 
+// The SDL side stays open across reconnects, only the USB side is restarted
+static int output_open = 0;
+
 static int benchmark_in() {
     int i;
+    int busy = 0;
 
     for (i = 0; i < NUM_TRANSFERS; i++) {
-        xfr[i] = libusb_alloc_transfer(NUM_PACKETS);
-        if (!xfr[i]) {
-            SDL_Log("Could not allocate transfer");
-            return -ENOMEM;
+        // Left pending by a disconnect that gave up waiting, libusb still
+        // owns it. It is picked up again on a later connection.
+        if (__atomic_load_n(&xfr_owned[i], __ATOMIC_ACQUIRE)) {
+            busy++;
+            continue;
         }
 
-        Uint8 *buffer = SDL_malloc(PACKET_SIZE * NUM_PACKETS);
+        // Allocated for the idle packet count, submitted with NUM_PACKETS.
+        // Kept for the lifetime of the program and refilled on reconnect.
+        if (xfr[i] == NULL) {
+            xfr[i] = libusb_alloc_transfer(NUM_PACKETS_IDLE);
+            if (!xfr[i]) {
+                SDL_Log("Could not allocate transfer");
+                return -ENOMEM;
+            }
+            xfr[i]->buffer = SDL_malloc(PACKET_SIZE * NUM_PACKETS_IDLE);
+        }
 
-        libusb_fill_iso_transfer(xfr[i], devh, EP_ISO_IN, buffer,
-                                 PACKET_SIZE * NUM_PACKETS, NUM_PACKETS, cb_xfr, NULL, 0);
+        libusb_fill_iso_transfer(xfr[i], devh, EP_ISO_IN, xfr[i]->buffer,
+                                 PACKET_SIZE * NUM_PACKETS, NUM_PACKETS, cb_xfr, &xfr_owned[i],
+                                 0);
         libusb_set_iso_packet_lengths(xfr[i], PACKET_SIZE);
 
-        libusb_submit_transfer(xfr[i]);
+        __atomic_store_n(&xfr_owned[i], 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&transfers_in_flight, 1, __ATOMIC_RELAXED);
+        if (libusb_submit_transfer(xfr[i]) != 0) {
+            __atomic_store_n(&xfr_owned[i], 0, __ATOMIC_RELEASE);
+            __atomic_sub_fetch(&transfers_in_flight, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (busy > 0) {
+        SDL_Log("%d audio transfers still pending from the last connection, not reused\n",
+                busy);
+    }
+
+    return 1;
+}
+
+static int open_output(int audio_buffer_size) {
+    if (!SDL_WasInit(SDL_INIT_AUDIO)) {
+        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+            SDL_Log("Init audio failed %s", SDL_GetError());
+            return -1;
+        }
+    } else {
+        SDL_Log("Audio was already initialised");
+    }
+
+    static SDL_AudioSpec audio_spec;
+    audio_spec.format = AUDIO_S16;
+    audio_spec.channels = 2;
+    audio_spec.freq = M8_AUDIO_FREQ;
+    audio_spec.samples = audio_buffer_size;
+    audio_spec.callback = audio_callback;
+
+    SDL_AudioSpec _obtained;
+    SDL_zero(_obtained);
+
+//  SDL_Log("Current audio driver is %s and device %s", SDL_GetCurrentAudioDriver(),
+//          output_device_name);
+
+    audio_thread_configured = 0;
+    if (SDL_OpenAudio(&audio_spec, &_obtained) < 0) {
+        SDL_Log("Failed to open audio output: %s\n", SDL_GetError());
+        return -1;
+    }
+
+    // The device may not run at the M8's rate or format, convert if needed
+    if (!audio_convert_init(&converter, M8_AUDIO_FREQ, &_obtained)) {
+        SDL_CloseAudio();
+        return -1;
     }
+    convert_buffer_size = (audio_convert_frames_needed(&converter, _obtained.samples) +
+                           AUDIO_CONVERT_TAPS) * M8_AUDIO_FRAME_SIZE;
+    convert_buffer = SDL_malloc(convert_buffer_size);
+    resume_bytes = audio_convert_frames_needed(&converter, _obtained.samples) * M8_AUDIO_FRAME_SIZE;
+
+    // The ring buffer holds M8 frames, so size it by frames and not by bytes of
+    // the output format
+    audio_buffer = ring_buffer_create(8 * _obtained.samples * M8_AUDIO_FRAME_SIZE);
 
+    SDL_Log("Obtained audio spec. Sample rate: %d, channels: %d, samples: %d, size: %d",
+            _obtained.freq,
+            _obtained.channels,
+            _obtained.samples, +_obtained.size);
+
+    output_open = 1;
     return 1;
 }
 
@@ -115,40 +474,26 @@ int audio_init(int audio_buffer_size, const char *output_device_name) {
     rc = libusb_set_interface_alt_setting(devh, IFACE_NUM, 1);
     if (rc < 0) {
         SDL_Log("Error setting alt setting: %s\n", libusb_error_name(rc));
+        libusb_release_interface(devh, IFACE_NUM);
         return rc;
     }
 
-    if (!SDL_WasInit(SDL_INIT_AUDIO)) {
-        if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
-            SDL_Log("Init audio failed %s", SDL_GetError());
-            return -1;
-        }
-    } else {
-        SDL_Log("Audio was already initialised");
+    if (output_open) {
+        SDL_Log("Reusing open audio output");
+    } else if ((rc = open_output(audio_buffer_size)) < 0) {
+        libusb_release_interface(devh, IFACE_NUM);
+        return rc;
     }
 
-    static SDL_AudioSpec audio_spec;
-    audio_spec.format = AUDIO_S16;
-    audio_spec.channels = 2;
-    audio_spec.freq = 44100;
-    audio_spec.samples = audio_buffer_size;
-    audio_spec.callback = audio_callback;
-
-    SDL_AudioSpec _obtained;
-    SDL_zero(_obtained);
-
-//  SDL_Log("Current audio driver is %s and device %s", SDL_GetCurrentAudioDriver(),
-//          output_device_name);
-
-    SDL_OpenAudio(&audio_spec, &_obtained);
-
-    audio_buffer = ring_buffer_create(8 * _obtained.size);
-
-    SDL_Log("Obtained audio spec. Sample rate: %d, channels: %d, samples: %d, size: %d",
-            _obtained.freq,
-            _obtained.channels,
-            _obtained.samples, +_obtained.size);
-
+    // Start out idle, the first packet with sound fades the output back in
+    audio_idle = silence_hold_ms > 0;
+    fast_resume = 0;
+    SDL_PauseAudio(1);
+    ring_buffer_clear(audio_buffer);
+    ticks_last_sound = SDL_GetTicks();
+    ticks_period_start = 0;
+    report_period(0);
+    xfr_errors = 0;
 
     // Good to go
     SDL_Log("Starting capture");
@@ -157,36 +502,80 @@ int audio_init(int audio_buffer_size, const char *output_device_name) {
         return rc;
     }
 
+    __atomic_store_n(&usb_streaming, 1, __ATOMIC_RELEASE);
+    audio_active = 1;
     SDL_Log("Successful init");
     return 1;
 }
 
-int audio_destroy() {
-    SDL_Log("Closing audio");
+int audio_disconnect() {
+    if (!usb_streaming) {
+        return 0;
+    }
+    __atomic_store_n(&usb_streaming, 0, __ATOMIC_RELEASE);
+
+    // A capture carries on across a reconnect, the file just has a gap
 
     int i, rc;
 
     for (i = 0; i < NUM_TRANSFERS; i++) {
-        rc = libusb_cancel_transfer(xfr[i]);
-        if (rc < 0) {
-            SDL_Log("Error cancelling transfer: %s\n", libusb_error_name(rc));
-        }
-        SDL_free(xfr[i]->buffer);
+        libusb_cancel_transfer(xfr[i]);
     }
 
+    // Buffers stay allocated, but must not be reused before every callback
+    // ran, nor left on a handle that disconnect() is about to close
+    usb_wait_transfers(audio_transfers_pending, "audio transfers");
+
+    // Only now, cb_xfr() updates the period counters and the idle state
+    // without locks until its last transfer is released
+    report_period(audio_idle);
+
     SDL_Log("Freeing interface %d", IFACE_NUM);
 
     rc = libusb_release_interface(devh, IFACE_NUM);
     if (rc < 0) {
         SDL_Log("Error releasing interface: %s\n", libusb_error_name(rc));
-        return rc;
+    }
+
+    // Keep the output open but silent until the M8 is back
+    SDL_PauseAudio(1);
+    ring_buffer_clear(audio_buffer);
+    audio_idle = silence_hold_ms > 0;
+    fast_resume = 0;
+    return 1;
+}
+
+int audio_destroy() {
+    if (!audio_active) {
+        return 0;
+    }
+    audio_active = 0;
+    SDL_Log("Closing audio");
+
+    audio_capture_stop();
+    audio_disconnect();
+
+    // Transfers still owned by libusb are leaked rather than freed under it
+    for (int i = 0; i < NUM_TRANSFERS; i++) {
+        if (xfr[i] != NULL && !__atomic_load_n(&xfr_owned[i], __ATOMIC_ACQUIRE)) {
+            SDL_free(xfr[i]->buffer);
+            libusb_free_transfer(xfr[i]);
+        }
+        xfr[i] = NULL;
     }
 
     SDL_CloseAudio();
+    output_open = 0;
 
     SDL_Log("Audio closed");
 
+    audio_convert_free(&converter);
+    SDL_free(convert_buffer);
+    convert_buffer = NULL;
+    convert_buffer_size = 0;
+
     ring_buffer_free(audio_buffer);
+    audio_buffer = NULL;
     return 1;
 }
 
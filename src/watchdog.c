@@ -0,0 +1,180 @@
+#include "watchdog.h"
+
+#include <SDL.h>
+
+#include "audio.h"
+#include "command_queue.h"
+#include "flight_recorder.h"
+#include "input.h"
+#include "stats.h"
+#include "usb.h"
+#include "SDL2_compat.h"
+
+#define POLL_MS 250
+
+typedef enum {
+    ACTION_LOG,
+    ACTION_RESYNC,
+    ACTION_RECONNECT
+} watchdog_action_t;
+
+static const char *thread_names[WATCHDOG_THREADS] = {"USB", "render", "audio"};
+
+uint32_t watchdog_beats[WATCHDOG_THREADS];
+uint32_t watchdog_command = 0;
+
+// Only the watchdog thread uses these
+static uint32_t last_beats[WATCHDOG_THREADS];
+static uint32_t last_change_ticks[WATCHDOG_THREADS];
+static int stalled[WATCHDOG_THREADS];
+
+static int do_exit = 0;
+static SDL_Thread *watchdog_thread = NULL;
+static uint32_t threshold_ms = 0;
+static watchdog_action_t action = ACTION_LOG;
+
+#ifdef USE_LIBUSB
+static const char *conn_names[] = {"waiting", "backoff", "connected"};
+#endif
+
+static void log_snapshot(int thread, uint32_t stalled_ms) {
+    SDL_Log("Watchdog: %s thread stalled for %u ms\n", thread_names[thread], stalled_ms);
+    flight_record_event("watchdog: %s thread stalled for %u ms", thread_names[thread],
+                        stalled_ms);
+
+    uint32_t now = SDL_GetTicks();
+    for (int i = 0; i < WATCHDOG_THREADS; i++) {
+        SDL_Log("  %-6s %u beats, last progress %u ms ago\n", thread_names[i],
+                __atomic_load_n(&watchdog_beats[i], __ATOMIC_RELAXED),
+                now - last_change_ticks[i]);
+    }
+
+    uint32_t command = __atomic_load_n(&watchdog_command, __ATOMIC_RELAXED);
+    SDL_Log("  command queue: %d waiting, %u dropped, last command 0x%02X (%u bytes)\n",
+            command_queue_depth(), command_queue_overflows(), command >> 24,
+            command & 0xFFFFFF);
+
+#ifdef USE_LIBUSB
+    usb_state_s usb;
+    usb_get_state(&usb);
+    usb_out_stats_s out;
+    usb_get_out_stats(&out);
+    SDL_Log("  USB: %s%s, read %s, %d writes in flight, last data %u ms ago\n",
+            conn_names[usb.conn_state], usb.device_lost ? " (lost)" : "",
+            usb.read_active ? "submitted" : "idle", usb.out_in_flight, usb.ms_since_data);
+    SDL_Log("  USB out: %u submitted, %u completed, %u errors\n", out.submitted, out.completed,
+            out.errors);
+#endif
+
+    audio_stats_s audio;
+    audio_get_stats(&audio);
+    SDL_Log("  audio: %s, %u%% buffered, %d transfers in flight, %u underruns, %u overruns\n",
+            audio.playing ? "playing" : "paused", audio.fill_percent, audio.transfers_in_flight,
+            audio.underruns, audio.overruns);
+}
+
+static void take_action(int thread) {
+#ifdef USE_LIBUSB
+    usb_state_s usb;
+    usb_get_state(&usb);
+    if (usb.conn_state != USB_CONN_CONNECTED) {
+        return;
+    }
+#endif
+    switch (action) {
+        case ACTION_RESYNC:
+            SDL_Log("Watchdog: requesting a redraw from the M8\n");
+            input_send_external(special, msg_reset_display, 0, 1, SDL_GetTicks());
+            input_send_external(special, msg_reset_display, 0, 0, SDL_GetTicks());
+            break;
+        case ACTION_RECONNECT:
+#ifdef USE_LIBUSB
+            // The main loop closes the device and opens it again
+            usb_report_lost(thread == WATCHDOG_AUDIO ? "watchdog, audio stalled"
+                                                     : "watchdog, thread stalled");
+#endif
+            break;
+        default:
+            break;
+    }
+}
+
+static int expected(int thread) {
+    if (thread == WATCHDOG_AUDIO) {
+        audio_stats_s audio;
+        audio_get_stats(&audio);
+        return audio.playing;
+    }
+    return 1;
+}
+
+static void check(uint32_t now) {
+    for (int i = 0; i < WATCHDOG_THREADS; i++) {
+        uint32_t beats = __atomic_load_n(&watchdog_beats[i], __ATOMIC_RELAXED);
+        if (beats != last_beats[i] || beats == 0 || !expected(i)) {
+            if (stalled[i] && beats != last_beats[i]) {
+                SDL_Log("Watchdog: %s thread resumed after %u ms\n", thread_names[i],
+                        now - last_change_ticks[i]);
+                flight_record_event("watchdog: %s thread resumed", thread_names[i]);
+            }
+            last_beats[i] = beats;
+            last_change_ticks[i] = now;
+            stalled[i] = 0;
+            continue;
+        }
+        if (!stalled[i] && now - last_change_ticks[i] >= threshold_ms) {
+            stalled[i] = 1;
+            stats_add(STAT_WATCHDOG_STALLS, 1);
+            log_snapshot(i, now - last_change_ticks[i]);
+            take_action(i);
+        }
+    }
+}
+
+static int watchdog_loop(void *data) {
+    while (!__atomic_load_n(&do_exit, __ATOMIC_ACQUIRE)) {
+        SDL_Delay(POLL_MS);
+        check(SDL_GetTicks());
+    }
+    return 0;
+}
+
+int watchdog_init(config_params_s *conf) {
+    if (conf->watchdog_ms <= 0) {
+        return 0;
+    }
+    threshold_ms = conf->watchdog_ms;
+    action = ACTION_LOG;
+    if (SDL_strcmp(conf->watchdog_action, "resync") == 0) {
+        action = ACTION_RESYNC;
+    } else if (SDL_strcmp(conf->watchdog_action, "reconnect") == 0) {
+        action = ACTION_RECONNECT;
+    }
+
+    uint32_t now = SDL_GetTicks();
+    for (int i = 0; i < WATCHDOG_THREADS; i++) {
+        last_beats[i] = __atomic_load_n(&watchdog_beats[i], __ATOMIC_RELAXED);
+        last_change_ticks[i] = now;
+        stalled[i] = 0;
+    }
+
+    do_exit = 0;
+    watchdog_thread = SDL_CreateThread(&watchdog_loop, NULL);
+    if (watchdog_thread == NULL) {
+        return 0;
+    }
+    SDL_Log("Watchdog: threads stalled for %u ms are logged%s\n", threshold_ms,
+            action == ACTION_RESYNC      ? ", then the display is redrawn"
+            : action == ACTION_RECONNECT ? ", then the M8 is reconnected"
+                                         : "");
+    return 1;
+}
+
+void watchdog_destroy() {
+    if (watchdog_thread == NULL) {
+        return;
+    }
+    __atomic_store_n(&do_exit, 1, __ATOMIC_RELEASE);
+    SDL_WaitThread(watchdog_thread, NULL);
+    watchdog_thread = NULL;
+}
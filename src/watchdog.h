@@ -0,0 +1,41 @@
+#ifndef M8C_WATCHDOG_H
+#define M8C_WATCHDOG_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+/* Notices when the USB event thread, the main loop or the audio callback
+   stops making progress. Each of them bumps a heartbeat counter; a thread
+   of its own checks them a few times a second and logs a snapshot of the
+   queues and transfers when one has not moved for conf->watchdog_ms.
+   conf->watchdog_action then asks the M8 for a redraw ("resync") or drops
+   the connection so the main loop opens it again ("reconnect").
+
+   A heartbeat is only watched once it has started. The audio callback is
+   only expected while the output plays, SDL pauses it around silence and
+   buffer refills. */
+typedef enum {
+    WATCHDOG_USB,    // usb_loop(), every libusb event wait
+    WATCHDOG_RENDER, // every main loop iteration
+    WATCHDOG_AUDIO,  // every audio output callback
+    WATCHDOG_THREADS
+} watchdog_thread_t;
+
+extern uint32_t watchdog_beats[WATCHDOG_THREADS];
+extern uint32_t watchdog_command;
+
+static inline void watchdog_beat(watchdog_thread_t thread) {
+    __atomic_add_fetch(&watchdog_beats[thread], 1, __ATOMIC_RELAXED);
+}
+
+// The main loop processed a command, kept for the snapshot
+static inline void watchdog_note_command(const uint8_t *data, uint32_t size) {
+    __atomic_store_n(&watchdog_command, (uint32_t) data[0] << 24 | (size & 0xFFFFFF),
+                     __ATOMIC_RELAXED);
+}
+
+int watchdog_init(config_params_s *conf);
+void watchdog_destroy();
+
+#endif //M8C_WATCHDOG_H